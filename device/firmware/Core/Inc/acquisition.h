@@ -0,0 +1,79 @@
+/**
+  ******************************************************************************
+  * @file    acquisition.h
+  * @brief   Timer-triggered ADC sampling into log blocks.
+  ******************************************************************************
+  */
+#ifndef __ACQUISITION_H__
+#define __ACQUISITION_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+#include "main.h"
+#include "log.h"
+
+/* TIM2 update rate that triggers one conversion of the regular group; a scan
+   of four channels at 480 cycles each takes 94 us of the 200 us period */
+#define ACQ_CAPTURE_RATE      5000
+/* lower rate the thermal policy falls back to */
+#define ACQ_THROTTLE_RATE     1000
+
+/* rate of the logged sample stream, each sample the mean of the conversions in its period */
+#define ACQ_SAMPLE_RATE       100
+
+/* the regular group converts the log channels up to the temperature, which is injected */
+#define ACQ_REGULAR_CHANNELS  LOG_CH_TEMPERATURE
+
+/* conversions per half of the circular DMA buffer; 2 x 100 scans fit in 1600 bytes */
+#define ACQ_HALF_SAMPLES      100
+
+/* store samples delta + bit-packed (LOG_TYPE_PACKED) rather than raw */
+#ifndef ACQ_PACKED
+#define ACQ_PACKED            1
+#endif
+
+/* nominal front-end calibration; override per board from the command line */
+#ifndef CAL_LV_VOLTAGE_SCALE
+#define CAL_LV_VOLTAGE_SCALE  (3.3f / 4096 * 7.8f)
+#endif
+#ifndef CAL_HV_VOLTAGE_SCALE
+#define CAL_HV_VOLTAGE_SCALE  (750.0f / 4096)
+#endif
+/* the Hall sensor output is ratiometric to its 5 V supply, sampled on ADC_5V_REF;
+   the zero is the starting point for autozero.c */
+#ifndef CAL_HV_CURRENT_ZERO
+#define CAL_HV_CURRENT_ZERO   0.5f
+#endif
+#ifndef CAL_HV_CURRENT_SPAN
+#define CAL_HV_CURRENT_SPAN   1500.0f
+#endif
+
+/* running HV totals since acquisition_start() */
+typedef struct {
+  double energy_j;
+  double charge_c;
+  float peak_power_w;
+} acq_totals_t;
+
+void acquisition_start(void);
+
+#ifdef USE_FREERTOS
+/* processes the halves the DMA interrupt hands over; starts sampling itself */
+void acquisition_task(void *arg);
+#endif
+void acquisition_calib(log_calib_t *calib);
+/* switch to ACQ_THROTTLE_RATE or back, at the next DMA half */
+void acquisition_throttle(bool on);
+/* conversions per second */
+uint32_t acquisition_rate(void);
+void acquisition_totals(acq_totals_t *totals, bool reset_peak);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ACQUISITION_H__ */
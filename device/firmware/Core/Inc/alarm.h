@@ -0,0 +1,76 @@
+/**
+  ******************************************************************************
+  * @file    alarm.h
+  * @brief   Limit rules with hysteresis and debounce, checked on every conversion.
+  ******************************************************************************
+  */
+#ifndef __ALARM_H__
+#define __ALARM_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+#include "main.h"
+#include "log.h"
+
+/* rule slots, numbered from 0 */
+#define ALARM_RULES           8
+
+/* rule changes waiting for the logger and the host; further ones are dropped when full */
+#define ALARM_EVENTS          8
+
+/* quantities a rule can watch */
+typedef enum {
+  ALARM_POWER,                  // HV power, W
+  ALARM_CURRENT,                // HV current, A
+  ALARM_VOLTAGE,                // HV voltage, V
+  ALARM_LV_VOLTAGE,             // LV voltage, V
+  ALARM_CURRENT_CODE,           // raw Hall sensor ADC code, for saturation
+  ALARM_QUANTITIES,
+} alarm_quantity_t;
+
+/* a rule as the host states it */
+typedef struct {
+  uint8_t quantity;             // alarm_quantity_t
+  bool below;                   // fires under the limit rather than over it
+  float limit;
+  float hysteresis;             // how far back past the limit the value must go to clear
+  uint32_t debounce_ms;         // how long either condition must hold
+} alarm_rule_t;
+
+/* built-in rules, loaded by alarm_init() */
+#ifndef ALARM_DEFAULT_RULES
+#define ALARM_DEFAULT_RULES { \
+  { ALARM_POWER, false, 80000.0f, 2000.0f, 100 }, \
+  { ALARM_CURRENT_CODE, false, 4050.0f, 50.0f, 10 }, \
+  { ALARM_CURRENT_CODE, true, 45.0f, 50.0f, 10 }, \
+}
+#endif
+
+void alarm_init(void);
+
+/* replace rule n, or disable it with NULL; false if the rule is invalid */
+bool alarm_set(uint32_t n, const alarm_rule_t *rule);
+/* false if rule n is disabled */
+bool alarm_get(uint32_t n, alarm_rule_t *rule);
+/* bit n set while rule n is firing */
+uint32_t alarm_active(void);
+/* short name of a quantity, as the commands take it; NULL if out of range */
+const char *alarm_quantity_name(uint32_t quantity);
+
+/* one conversion at time, with its HV values; acquisition context only */
+void alarm_feed(const uint16_t sample[LOG_CH_COUNT], uint64_t time, float current, float voltage, float power);
+
+/* sends the rule changes to the host; same context as the command interface */
+void alarm_task(void);
+/* fills block with the next rule change for the log; false if none */
+bool alarm_take(log_block_t *block);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ALARM_H__ */
@@ -0,0 +1,50 @@
+/**
+  ******************************************************************************
+  * @file    autozero.h
+  * @brief   HV current sensor zero tracking over idle periods.
+  ******************************************************************************
+  */
+#ifndef __AUTOZERO_H__
+#define __AUTOZERO_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+#include "main.h"
+#include "log.h"
+
+/* logged samples an idle period must last to give one zero measurement, 5 s */
+#define AUTOZERO_WINDOW       500
+
+/* idle means the HV is off and steady over the whole window */
+#ifndef AUTOZERO_HV_OFF_V
+#define AUTOZERO_HV_OFF_V     30.0f
+#endif
+#define AUTOZERO_HV_STEADY_V  2.0f
+/* largest spread of the current / 5V ref ratio over the window, about 3 A */
+#define AUTOZERO_RATIO_STEADY 0.002f
+/* measurements this far from CAL_HV_CURRENT_ZERO are not a zero; about 75 A */
+#define AUTOZERO_RATIO_LIMIT  0.05f
+
+/* share of the prediction error taken per measurement, for the zero and the tempco */
+#define AUTOZERO_GAIN         0.1f
+/* least die temperature change, C, the tempco is learned from */
+#define AUTOZERO_TEMP_SPAN    3.0f
+/* tempco bound, ratio per C */
+#define AUTOZERO_TEMPCO_MAX   0.0015f
+
+/* one logged-rate sample at the smoothed die temperature; acquisition context only */
+void autozero_feed(const uint16_t sample[LOG_CH_COUNT], float celsius, uint64_t time);
+/* zero ratio for the current temperature */
+float autozero_zero(void);
+/* fills block with the last zero update not logged yet; false if none */
+bool autozero_take(log_block_t *block);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AUTOZERO_H__ */
@@ -0,0 +1,65 @@
+/**
+  ******************************************************************************
+  * @file    capture.h
+  * @brief   Pre/post trigger capture of transients at the conversion rate.
+  ******************************************************************************
+  */
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+#include "main.h"
+#include "log.h"
+
+/* capture window in samples at ACQ_CAPTURE_RATE: 40 ms before the trigger, 120 ms from it;
+   the ring holds exactly this window, 8000 bytes */
+#define CAPTURE_PRE           200
+#define CAPTURE_POST          600
+#define CAPTURE_LEN           (CAPTURE_PRE + CAPTURE_POST)
+
+/* trigger limits; 0 disables one. Each fires when its condition becomes true */
+#ifndef CAPTURE_CURRENT_A
+#define CAPTURE_CURRENT_A     500.0f
+#endif
+#ifndef CAPTURE_VOLTAGE_V
+#define CAPTURE_VOLTAGE_V     600.0f
+#endif
+#ifndef CAPTURE_DPDT_W_S
+#define CAPTURE_DPDT_W_S      50e6f
+#endif
+
+/* samples the power slope is taken over, to keep single-LSB noise out of it */
+#define CAPTURE_DPDT_SPAN     5
+
+/* least time from one trigger to the next */
+#define CAPTURE_HOLDOFF_MS    1000
+
+/* capture frames encoded per DMA half, bounding the time spent in the acquisition path */
+#define CAPTURE_FRAMES_PER_HALF 4
+
+/* one conversion at time, with its HV values; acquisition context only */
+void capture_feed(const uint16_t sample[LOG_CH_COUNT], uint64_t time, float current, float voltage, float power);
+/* encode part of a frozen window; acquisition context, once per DMA half */
+void capture_service(void);
+
+/* trigger on the next conversion */
+void capture_force(void);
+/* stop or resume triggering and filling the ring; a window in progress is finished */
+void capture_suspend(bool on);
+uint32_t capture_count(void);
+bool capture_armed(void);
+
+/* event and capture blocks in order; NULL if none */
+log_block_t *capture_take(void);
+void capture_written(log_block_t *block);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CAPTURE_H__ */
@@ -0,0 +1,42 @@
+/**
+  ******************************************************************************
+  * @file    codec.h
+  * @brief   Lossless delta + bit-packing codec for sample frames.
+  ******************************************************************************
+  */
+#ifndef __CODEC_H__
+#define __CODEC_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+#include "log.h"
+
+/* ADC resolution; a first-order delta of it needs one more bit */
+#define CODEC_SAMPLE_BITS     12
+
+/* per-channel header: first sample, frame-of-reference base, bit width */
+#define CODEC_CH_HEADER       5
+
+/* encoded size bounds of one frame of LOG_PACKED_FRAME samples */
+#define CODEC_FRAME_MIN       (LOG_CH_COUNT * CODEC_CH_HEADER)
+#define CODEC_FRAME_MAX \
+  (LOG_CH_COUNT * (CODEC_CH_HEADER + ((LOG_PACKED_FRAME - 1) * (CODEC_SAMPLE_BITS + 1) + 7) / 8))
+
+/* most samples a packed block can hold */
+#define CODEC_BLOCK_MAX_SAMPLES (LOG_PAYLOAD_SIZE / CODEC_FRAME_MIN * LOG_PACKED_FRAME)
+
+/* returns the encoded size, at most CODEC_FRAME_MAX for CODEC_SAMPLE_BITS input;
+   not reentrant, call from one context only */
+uint32_t codec_encode(const uint16_t (*src)[LOG_CH_COUNT], uint32_t n, uint8_t *dst);
+
+/* returns the bytes consumed, 0 if the frame runs past len */
+uint32_t codec_decode(const uint8_t *src, uint32_t len, uint16_t (*dst)[LOG_CH_COUNT], uint32_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CODEC_H__ */
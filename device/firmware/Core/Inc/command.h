@@ -0,0 +1,31 @@
+/**
+  ******************************************************************************
+  * @file    command.h
+  * @brief   Line-based command interface on the CDC port.
+  ******************************************************************************
+  */
+#ifndef __COMMAND_H__
+#define __COMMAND_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+/* longest command line, terminator excluded */
+#define COMMAND_LINE_MAX      63
+
+/* feed bytes received from the host */
+void command_input(const char *buf, uint32_t len);
+
+/* unsolicited line to the host, "!" first by convention; command context only */
+void command_notify(const char *fmt, ...);
+/* v with three decimals, as the replies print values */
+int command_fixed(char *buf, uint32_t size, float v);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __COMMAND_H__ */
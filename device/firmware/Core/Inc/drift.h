@@ -0,0 +1,37 @@
+/**
+  ******************************************************************************
+  * @file    drift.h
+  * @brief   LSI drift estimation and RTC trimming against TIM5.
+  ******************************************************************************
+  */
+#ifndef __DRIFT_H__
+#define __DRIFT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+#include "main.h"
+
+/* measurement window; a multiple of the 32 s smooth calibration cycle */
+#define DRIFT_WINDOW_MS       64000
+
+/* LSI nominal frequency the prescalers are sized for */
+#define DRIFT_LSI_HZ          32000
+
+void drift_task(void);
+
+/* drop the window in progress, e.g. after the clock was set */
+void drift_reset(void);
+
+/* LSI error against DRIFT_LSI_HZ and the total RTC correction applied, in ppm;
+   false until the first window has completed */
+bool drift_status(float *lsi_ppm, float *trim_ppm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DRIFT_H__ */
@@ -0,0 +1,51 @@
+/**
+  ******************************************************************************
+  * @file    latency.h
+  * @brief   Worst-case interrupt entry delay and run time per source.
+  ******************************************************************************
+  */
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+typedef enum {
+  LATENCY_ADC_DMA,
+  LATENCY_SDIO,
+  LATENCY_SD_DMA,
+  LATENCY_USB,
+  LATENCY_USB_SERVICE,
+  LATENCY_SOURCES,
+} latency_source_t;
+
+/* all times in TIM5 ticks */
+typedef struct {
+  uint32_t count;
+  uint32_t entry_min;           // hardware event to handler entry, sources with a timestamp only
+  uint32_t entry_max;
+  uint32_t run_max;             // handler entry to exit, preemption included
+} latency_stat_t;
+
+/* first statement of a handler; TIM5 is the free-running timebase counter */
+static inline uint32_t latency_enter(void) {
+  return TIM5->CNT;
+}
+
+/* event is the TIM5 value latched by the hardware event that raised the interrupt */
+void latency_event(latency_source_t src, uint32_t event, uint32_t enter);
+
+/* last statement of a handler */
+void latency_exit(latency_source_t src, uint32_t enter);
+
+void latency_get(latency_source_t src, latency_stat_t *stat);
+void latency_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LATENCY_H__ */
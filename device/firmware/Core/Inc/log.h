@@ -0,0 +1,249 @@
+/**
+  ******************************************************************************
+  * @file    log.h
+  * @brief   On-card log format shared by the firmware and host tools.
+  *
+  *          A log file is a sequence of 512-byte blocks, one SD sector each.
+  *          Every block carries its own header and hardware CRC so it can be
+  *          decoded and validated independently of its neighbours.
+  ******************************************************************************
+  */
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define LOG_BLOCK_SIZE        512
+#define LOG_BLOCK_MAGIC       0x4C4D45AA  /* "\xAA" "EML" in file order */
+#define LOG_FORMAT_VERSION    2
+
+/* session index on the card root, one log_index_t per segment */
+#define LOG_INDEX_FILE        "SESSIONS.IDX"
+#define LOG_INDEX_MAGIC       0x58444945  /* "EIDX" */
+
+/* block types */
+enum {
+  LOG_TYPE_SAMPLE = 1,
+  LOG_TYPE_SESSION = 2,
+  LOG_TYPE_SUMMARY = 3,
+  LOG_TYPE_DIRECTORY = 4,
+  LOG_TYPE_PACKED = 5,
+  LOG_TYPE_EVENT = 6,
+  LOG_TYPE_CAPTURE = 7,
+};
+
+/* block flags */
+enum {
+  LOG_FLAG_OVERRUN = (1 << 0), // blocks were dropped right before this one
+};
+
+/* sample channels: the ADC regular group ranks in conversion order, then
+   the temperature, which holds the latest injected conversion */
+enum {
+  LOG_CH_LV_VOLTAGE,
+  LOG_CH_5V_REF,
+  LOG_CH_HV_CURRENT,
+  LOG_CH_HV_VOLTAGE,
+  LOG_CH_TEMPERATURE,
+  LOG_CH_COUNT,
+};
+
+typedef struct {
+  uint32_t magic;     // LOG_BLOCK_MAGIC
+  uint8_t type;       // LOG_TYPE_*
+  uint8_t version;    // LOG_FORMAT_VERSION
+  uint16_t count;     // number of valid entries in the payload
+  uint32_t seq;       // sample block sequence number since boot; other block
+                      // types carry the number of the sample block after them
+  uint32_t flags;     // LOG_FLAG_*
+  uint64_t time;      // TIM5 ticks since boot at the first sample, see log_session_t
+} log_header_t;
+
+#define LOG_PAYLOAD_SIZE      (LOG_BLOCK_SIZE - sizeof(log_header_t) - sizeof(uint32_t))
+#define LOG_SAMPLES_PER_BLOCK 48
+
+/*
+ * A packed sample block holds hdr.count samples as back-to-back frames of
+ * LOG_PACKED_FRAME samples (the last one may be shorter). Each frame has,
+ * for every channel in order:
+ *   uint16_t first;   first sample
+ *   uint16_t base;    smallest zigzagged delta of the frame
+ *   uint8_t width;    bits per packed delta, 0 if all deltas are equal
+ *   (n - 1) deltas as zigzag(int16_t(s[i] - s[i-1])) - base, packed LSB first
+ *   and padded to a whole byte
+ */
+#define LOG_PACKED_FRAME      LOG_SAMPLES_PER_BLOCK
+
+/* front-end calibration used by the device when the segment was written */
+typedef struct {
+  float lv_voltage_scale;     // V per LSB
+  float hv_voltage_scale;     // V per LSB
+  float hv_current_zero;      // HV current / 5V ref code ratio at 0 A, at segment start
+  float hv_current_span;      // A per unit of HV current / 5V ref ratio
+} log_calib_t;
+
+/* session flags */
+enum {
+  LOG_SESSION_TIME_SET = (1 << 0), // RTC was set by the host and kept running since
+  LOG_SESSION_DRIFT = (1 << 1),    // lsi_ppm and trim_ppm hold a measurement
+};
+
+/*
+ * First block of every segment file. Its hdr.time is the TIM5 tick at which
+ * start was read, so the wall-clock time of any block in the session is
+ * start + start_ms / 1000 + (hdr.time - session hdr.time) / tick_hz.
+ */
+typedef struct {
+  uint16_t session;       // session number, one per logger start
+  uint16_t segment;       // segment number within the session
+  uint32_t start;         // RTC time at segment start, seconds since 1970
+  uint16_t sample_rate;   // Hz
+  uint16_t samples_per_block;
+  uint16_t channels;      // LOG_CH_COUNT
+  uint16_t start_ms;      // sub-second part of start
+  log_calib_t calib;
+  uint32_t tick_hz;       // TIM5 ticks per second
+  uint32_t sample_ticks;  // TIM5 ticks between samples; each sample is the
+                          // mean of the conversions over this period from its time
+  uint32_t flags;         // LOG_SESSION_*
+  float lsi_ppm;          // measured RTC clock (LSI) error
+  float trim_ppm;         // correction applied to the RTC for it
+} log_session_t;
+
+/* summary levels, bucket length in seconds of each */
+#define LOG_SUMMARY_LEVELS    3
+#define LOG_SUMMARY_PERIODS   { 1, 10, 60 }
+
+/* event kinds */
+enum {
+  LOG_EVENT_CAPTURE = 1,  // a transient capture follows
+  LOG_EVENT_ALARM = 2,    // an alarm rule fired
+  LOG_EVENT_ALARM_CLEAR = 3,  // an alarm rule cleared
+  LOG_EVENT_ZERO = 4,     // the HV current zero was measured while idle
+  LOG_EVENT_THERMAL = 5,  // the thermal policy changed level
+};
+
+/* capture trigger causes */
+enum {
+  LOG_TRIGGER_CURRENT = (1 << 0),  // |HV current| rose above its limit
+  LOG_TRIGGER_VOLTAGE = (1 << 1),  // HV voltage rose above its limit
+  LOG_TRIGGER_DPDT = (1 << 2),     // |dP/dt| of HV power rose above its limit
+  LOG_TRIGGER_MANUAL = (1 << 3),   // requested by the host
+};
+
+/*
+ * Something that happened at hdr.time. A capture event is followed by the
+ * LOG_TYPE_CAPTURE blocks of its window, (pre + post) samples at the capture
+ * rate in total: packed frames as in LOG_TYPE_PACKED, with sample i of a
+ * block at hdr.time + i * sample_ticks. Capture blocks are not summarized.
+ * Alarm events are stamped with the conversion that ended the debounce,
+ * zero updates with the last sample of their idle window; from a zero
+ * update on, the HV current zero at die temperature T is
+ * zero + tempco * (T - temperature). Thermal events carry the level entered
+ * in cause: 0 normal, 1 capture suspended, 2 conversion rate lowered.
+ */
+typedef struct {
+  uint16_t kind;          // LOG_EVENT_*
+  uint16_t cause;         // capture: LOG_TRIGGER_* bits that fired; alarm: rule number; thermal: level
+  uint32_t number;        // events of this source since boot
+  uint32_t sample_ticks;  // capture: TIM5 ticks between capture samples
+  uint16_t pre;           // capture: samples before the trigger sample
+  uint16_t post;          // capture: samples from the trigger sample on
+  float current_a;        // HV values at the event
+  float voltage_v;
+  float power_w;
+  float dpdt_w_s;         // capture only
+  float value;            // alarm: the value the rule watches; zero: the measured ratio; thermal: die C
+  float zero;             // zero: filtered HV current zero ratio at temperature
+  float tempco;           // zero: its change per C
+  float temperature;      // zero: mean die temperature over the window, C
+} log_event_t;
+
+/* per-channel statistics of one bucket */
+typedef struct {
+  uint16_t min[LOG_CH_COUNT];
+  uint16_t max[LOG_CH_COUNT];
+  uint16_t mean[LOG_CH_COUNT];
+  uint16_t count;         // samples in the bucket; short only at the end of a segment
+  uint32_t block;         // segment block index of the sample block holding the first sample
+} log_summary_t;
+
+#define LOG_SUMMARIES_PER_BLOCK 13
+
+typedef struct {
+  uint8_t level;          // index into LOG_SUMMARY_PERIODS
+  uint8_t reserved;
+  uint16_t period;        // bucket length in seconds
+  uint32_t first;         // bucket number of summary[0], counted from segment start
+  log_summary_t summary[LOG_SUMMARIES_PER_BLOCK];
+} log_summary_block_t;
+
+/*
+ * Trailer of a closed segment. The last block of the file is the last
+ * directory block, preceded by the other (total - 1) directory blocks.
+ * Together they list every summary block of the segment in write order.
+ */
+#define LOG_DIRECTORY_PER_BLOCK 120
+
+typedef struct {
+  uint16_t index;         // position of this block within the trailer
+  uint16_t total;         // directory blocks in the trailer
+  uint32_t block[LOG_DIRECTORY_PER_BLOCK];  // segment block index of each summary block
+} log_directory_t;
+
+typedef struct {
+  log_header_t hdr;
+  union {
+    uint8_t raw[LOG_PAYLOAD_SIZE];
+    uint16_t sample[LOG_SAMPLES_PER_BLOCK][LOG_CH_COUNT];
+    log_session_t session;
+    log_summary_block_t summary;
+    log_directory_t directory;
+    log_event_t event;
+  };
+  uint32_t crc;       // STM32 CRC32 over all preceding words
+} log_block_t;
+
+/* index flags */
+enum {
+  LOG_INDEX_CLOSED = (1 << 0),    // segment was closed cleanly and its totals are final
+  LOG_INDEX_RECOVERED = (1 << 1), // segment was cut back to `blocks` at the next start after
+                                  // a power loss; its totals are those of the last sync
+};
+
+/* SESSIONS.IDX record, rewritten in place while its segment is open */
+typedef struct {
+  uint32_t magic;         // LOG_INDEX_MAGIC
+  uint16_t session;
+  uint16_t segment;
+  uint32_t first_seq;     // sequence number of the segment's session block
+  uint32_t blocks;        // blocks in the segment file, session block included
+  uint32_t start;         // RTC time at segment start, seconds since 1970
+  uint32_t duration_ms;
+  float energy_wh;        // HV energy over the segment
+  float charge_ah;        // HV charge over the segment
+  float peak_power_w;     // largest HV power sample in the segment
+  uint32_t flags;         // LOG_INDEX_*
+  uint32_t reserved[5];
+  uint32_t crc;           // STM32 CRC32 over all preceding words
+} log_index_t;
+
+_Static_assert(sizeof(log_header_t) == 24, "log header layout");
+_Static_assert(sizeof(log_session_t) <= LOG_PAYLOAD_SIZE, "session payload overflow");
+_Static_assert(sizeof(log_summary_t) == 36, "summary record layout");
+_Static_assert(sizeof(log_summary_block_t) <= LOG_PAYLOAD_SIZE, "summary payload overflow");
+_Static_assert(sizeof(log_directory_t) <= LOG_PAYLOAD_SIZE, "directory payload overflow");
+_Static_assert(sizeof(log_event_t) == 48, "event record layout");
+_Static_assert(sizeof(log_index_t) == 64, "index record layout");
+_Static_assert(sizeof(log_block_t) == LOG_BLOCK_SIZE, "log block must fill one sector");
+_Static_assert(sizeof(uint16_t) * LOG_SAMPLES_PER_BLOCK * LOG_CH_COUNT <= LOG_PAYLOAD_SIZE, "sample payload overflow");
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LOG_H__ */
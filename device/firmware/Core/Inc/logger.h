@@ -0,0 +1,60 @@
+/**
+  ******************************************************************************
+  * @file    logger.h
+  * @brief   Block queue between the acquisition path and the SD card.
+  ******************************************************************************
+  */
+#ifndef __LOGGER_H__
+#define __LOGGER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+#include "main.h"
+#include "log.h"
+
+/* blocks buffered between acquisition and the SD card; power of two */
+#define LOG_QUEUE_LEN         8
+
+/* flush the FAT, directory entry and index record at least this often */
+#define LOG_SYNC_INTERVAL_MS  1000
+
+/* a segment is closed and the next one opened when either limit is reached */
+#define LOG_SEGMENT_SIZE        (32UL * 1024 * 1024)
+#define LOG_SEGMENT_DURATION_MS (60UL * 60 * 1000)
+
+void logger_init(void);
+void logger_task(void);
+
+/* start a new segment at the next logger_task(), e.g. after the clock was set */
+void logger_rotate(void);
+
+/* STM32 CRC32 over whole words, safe to call from any context */
+uint32_t logger_crc(const void *data, uint32_t words);
+
+/* one event record on its way to the log; a newer one overwrites a record not taken yet */
+typedef struct {
+  log_event_t event;
+  uint64_t time;
+  volatile bool ready;
+} logger_event_t;
+
+/* hand over an event from any context, and take it back as an event block in the logger */
+void logger_event_post(logger_event_t *slot, const log_event_t *event, uint64_t time);
+bool logger_event_take(logger_event_t *slot, log_block_t *block);
+
+/* fill block as the event block of event at time */
+void logger_event_block(log_block_t *block, const log_event_t *event, uint64_t time);
+
+/* producer side, called from the acquisition interrupt */
+log_block_t *logger_alloc(void);
+void logger_commit(log_block_t *block);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LOGGER_H__ */
@@ -41,7 +41,24 @@ extern "C" {
 
 /* Exported constants --------------------------------------------------------*/
 /* USER CODE BEGIN EC */
-
+/* Interrupt preemption levels, NVIC_PRIORITYGROUP_4 (no subpriorities).
+   A lower number preempts a higher one; handlers on one level never nest.
+   The generated MSP code takes its numbers from firmware.ioc.
+
+     0  DMA2_Stream0, ADC   acquisition: a late half-buffer is overwritten
+     1  TIM5                timebase; no interrupt sources are enabled
+     2  SDIO, DMA2_Stream3/6  SD transfers the main loop waits on
+     3  OTG_FS              tinyusb only queues events for tud_task
+     4  PendSV              tud_task, see usb_service.c
+    15  SysTick
+
+   Data shared between levels is guarded by short PRIMASK sections. The
+   LAT command reports the measured entry delay and run time per level.
+
+   The FreeRTOS build keeps this order but shifts every peripheral level
+   down by configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY (see rtos.c), and
+   the kernel takes PendSV and SysTick at 15. */
+#define IRQ_PRIORITY_USB      3
 /* USER CODE END EC */
 
 /* Exported macro ------------------------------------------------------------*/
@@ -53,7 +70,8 @@ extern "C" {
 void Error_Handler(void);
 
 /* USER CODE BEGIN EFP */
-
+void led_blinking_task(void);
+void cdc_task(void);
 /* USER CODE END EFP */
 
 /* Private defines -----------------------------------------------------------*/
@@ -29,18 +29,27 @@ extern "C" {
 #include "main.h"
 
 /* USER CODE BEGIN Includes */
+#include <stdbool.h>
 
 /* USER CODE END Includes */
 
 extern RTC_HandleTypeDef hrtc;
 
 /* USER CODE BEGIN Private defines */
+/* RTC_BKP_DR0 value while the calendar holds a host-set time */
+#define RTC_BKUP_MAGIC  0x32F2
 
 /* USER CODE END Private defines */
 
 void MX_RTC_Init(void);
 
 /* USER CODE BEGIN Prototypes */
+uint32_t rtc_get_unix(void);
+uint64_t rtc_get_unix_ms(void);
+uint64_t rtc_get_units(uint32_t *hz);
+bool rtc_time_valid(void);
+HAL_StatusTypeDef rtc_set_unix_ms(uint64_t ms);
+HAL_StatusTypeDef rtc_set_prescaler(uint32_t synch);
 
 /* USER CODE END Prototypes */
 
@@ -0,0 +1,50 @@
+/**
+  ******************************************************************************
+  * @file    rtos.h
+  * @brief   Task layout of the FreeRTOS build (make RTOS=1).
+  ******************************************************************************
+  */
+#ifndef __RTOS_H__
+#define __RTOS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+#include "main.h"
+
+/* task priorities, highest first; idle is 0 */
+#define RTOS_PRIO_ACQUISITION 4
+#define RTOS_PRIO_USB         3
+#define RTOS_PRIO_WRITER      2
+#define RTOS_PRIO_HOUSEKEEPING 1
+
+/* stack sizes in words */
+#define RTOS_STACK_ACQUISITION 256
+#define RTOS_STACK_USB        256
+#define RTOS_STACK_WRITER     768
+#define RTOS_STACK_HOUSEKEEPING 512
+
+/* writer and housekeeping poll periods */
+#define RTOS_WRITER_PERIOD_MS 10
+#define RTOS_HOUSEKEEPING_PERIOD_MS 1
+
+/* CPU usage is averaged over this window */
+#define RTOS_STATS_WINDOW_MS  1000
+
+/* create the tasks and start the scheduler; does not return */
+void rtos_start(void);
+
+/* name of task n, NULL past the last one */
+const char *rtos_task_name(uint32_t n);
+
+/* free stack in words at its lowest so far and CPU share over the last window */
+bool rtos_task_stats(const char *name, uint32_t *stack_free, uint32_t *cpu_permille);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RTOS_H__ */
@@ -0,0 +1,40 @@
+/**
+  ******************************************************************************
+  * @file    stream.h
+  * @brief   Live sample stream to the host over the CDC port.
+  ******************************************************************************
+  */
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+#include "main.h"
+#include "log.h"
+
+/* logged-rate samples buffered for the host, 320 ms; a power of two */
+#define STREAM_DEPTH          32
+
+/* CDC transmit room kept free for command replies and notifications */
+#define STREAM_TX_RESERVE     96
+
+void stream_enable(bool on);
+bool stream_enabled(void);
+/* samples lost to a full buffer since the stream was enabled */
+uint32_t stream_dropped(void);
+
+/* one logged-rate sample; acquisition context only */
+void stream_feed(const uint16_t sample[LOG_CH_COUNT]);
+
+/* sends the buffered samples as far as the CDC port takes them; same context as the command interface */
+void stream_task(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STREAM_H__ */
@@ -0,0 +1,44 @@
+/**
+  ******************************************************************************
+  * @file    summary.h
+  * @brief   Multi-resolution min/max/mean index built while logging.
+  ******************************************************************************
+  */
+#ifndef __SUMMARY_H__
+#define __SUMMARY_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+#include "main.h"
+#include "log.h"
+
+/* summary blocks a segment can list in its trailer */
+#define SUMMARY_MAX_BLOCKS    384
+
+/* blocks to keep free at the end of a segment for the final summaries and the trailer */
+#define SUMMARY_RESERVE_BLOCKS \
+  (2 * LOG_SUMMARY_LEVELS + (SUMMARY_MAX_BLOCKS + LOG_DIRECTORY_PER_BLOCK - 1) / LOG_DIRECTORY_PER_BLOCK)
+
+void summary_reset(void);
+/* samples of the sample block at segment block index */
+void summary_feed(const uint16_t (*sample)[LOG_CH_COUNT], uint32_t n, uint32_t index);
+void summary_flush(void);
+bool summary_full(void);
+
+/* completed summary blocks, oldest level first; NULL if none */
+log_block_t *summary_take(void);
+void summary_written(log_block_t *block, uint32_t index);
+
+/* trailer listing every written summary block */
+uint32_t summary_directory_blocks(void);
+void summary_directory(log_block_t *block, uint32_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SUMMARY_H__ */
@@ -0,0 +1,57 @@
+/**
+  ******************************************************************************
+  * @file    thermal.h
+  * @brief   Die temperature from the injected sensor conversion, and the load policy on it.
+  ******************************************************************************
+  */
+#ifndef __THERMAL_H__
+#define __THERMAL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+#include "main.h"
+#include "log.h"
+
+/* policy levels; each one includes the measures of those below */
+typedef enum {
+  THERMAL_NORMAL,
+  THERMAL_WARM,                 // transient capture suspended
+  THERMAL_HOT,                  // conversion rate lowered to ACQ_THROTTLE_RATE
+  THERMAL_LEVELS,
+} thermal_level_t;
+
+/* die temperatures entering each level above normal; the operating limit is 80 C */
+#ifndef THERMAL_WARM_C
+#define THERMAL_WARM_C        70.0f
+#endif
+#ifndef THERMAL_HOT_C
+#define THERMAL_HOT_C         75.0f
+#endif
+/* how far under its threshold the temperature must fall to leave a level */
+#define THERMAL_HYSTERESIS_C  5.0f
+
+/* typical sensor curve, for parts without factory calibration */
+#define THERMAL_V25           0.76f
+#define THERMAL_SLOPE_V_C     0.0025f
+
+/* reads the last conversion and starts the next; acquisition context, once per DMA half */
+void thermal_service(uint64_t time);
+
+/* latest sensor code, held in the temperature channel of the samples */
+uint16_t thermal_code(void);
+/* smoothed die temperature */
+float thermal_celsius(void);
+thermal_level_t thermal_level(void);
+
+/* fills block with the last level change not logged yet; false if none */
+bool thermal_take(log_block_t *block);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __THERMAL_H__ */
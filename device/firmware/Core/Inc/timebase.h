@@ -0,0 +1,35 @@
+/**
+  ******************************************************************************
+  * @file    timebase.h
+  * @brief   64-bit sample clock from the free-running TIM5 counter.
+  ******************************************************************************
+  */
+#ifndef __TIMEBASE_H__
+#define __TIMEBASE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+void timebase_start(void);
+
+/* TIM5 input clock, ticks per second */
+uint32_t timebase_hz(void);
+
+/* TIM5 ticks between two TIM2 conversion triggers: the current TIM2 period,
+   the throttled one while acquisition_switch() has lowered the rate */
+uint32_t timebase_sample_ticks(void);
+
+/* counter now, extended to 64 bits */
+uint64_t timebase_now(void);
+
+/* counter latched in hardware by the latest TIM2 sample trigger, extended to 64 bits */
+uint64_t timebase_capture(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TIMEBASE_H__ */
@@ -0,0 +1,48 @@
+/**
+  ******************************************************************************
+  * @file    usb_service.h
+  * @brief   tinyusb device task run from a PendSV slice instead of the main loop.
+  ******************************************************************************
+  */
+#ifndef __USB_SERVICE_H__
+#define __USB_SERVICE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+#include "main.h"
+
+/* CDC bytes buffered on each side of the slice; powers of two */
+#define USB_CDC_RX_LEN        128
+#define USB_CDC_TX_LEN        256
+
+/* longest gap between two services when no USB event arrives */
+#define USB_SERVICE_INTERVAL_MS 1
+
+/* tusb_init() and start servicing */
+void usb_service_start(void);
+
+/* request a slice; from the USB interrupt, SysTick or the main loop */
+void usb_service_kick(void);
+
+#ifdef USE_FREERTOS
+void usb_service_task(void *arg);
+#else
+/* the slice itself, run by PendSV_Handler */
+void usb_service_run(void);
+#endif
+
+/* main loop side of the CDC port; send queues all of len or nothing */
+uint32_t usb_cdc_receive(char *buf, uint32_t len);
+bool usb_cdc_send(const char *buf, uint32_t len);
+/* bytes usb_cdc_send() would take right now */
+uint32_t usb_cdc_free(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USB_SERVICE_H__ */
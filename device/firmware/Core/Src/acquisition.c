@@ -0,0 +1,327 @@
+/**
+  ******************************************************************************
+  * @file    acquisition.c
+  * @brief   Timer-triggered ADC sampling into log blocks.
+  *
+  *          TIM2 TRGO starts one scan of the regular group per conversion
+  *          period and DMA2 Stream0 stores the 12-bit results as packed
+  *          halfwords in a circular buffer, sample-major. Each half of the
+  *          buffer holds ACQ_HALF_SAMPLES conversions. The temperature
+  *          channel is converted apart at a low rate (see thermal.c) and its
+  *          latest value completes each sample.
+  *
+  *          Every conversion is integrated into the HV totals and fed to the
+  *          transient capture (see capture.c) and the alarm rules (see
+  *          alarm.c). The logged stream is decimated
+  *          to ACQ_SAMPLE_RATE by averaging the conversions of each sample
+  *          period, which also filters it, and collected into frames.
+  *          The HV current zero follows the sensor drift (see autozero.c),
+  *          which is measured on these means.
+  *          Conversion times are counted from the first hardware timestamp,
+  *          as TIM2 and TIM5 share one clock.
+  *
+  *          The conversion rate is changed only between two halves, which
+  *          are also sample period boundaries at either rate. The half after
+  *          a change is counted from its own timestamp again.
+  *
+  *          With ACQ_PACKED each frame is encoded by the codec and appended
+  *          to the same queue block until the next one no longer fits,
+  *          typically three or four of them per block. Otherwise each frame
+  *          is copied into a raw sample block.
+  *
+  *          The bare-metal build does this work in the DMA interrupt. The
+  *          FreeRTOS build only timestamps the half there and passes it to
+  *          acquisition_task(); the DMA comes back to the same half a whole
+  *          buffer period later.
+  ******************************************************************************
+  */
+#include <string.h>
+
+#include "acquisition.h"
+#include "adc.h"
+#include "tim.h"
+#include "logger.h"
+#include "codec.h"
+#include "capture.h"
+#include "alarm.h"
+#include "autozero.h"
+#include "stream.h"
+#include "thermal.h"
+#include "timebase.h"
+
+#ifdef USE_FREERTOS
+#include "FreeRTOS.h"
+#include "stream_buffer.h"
+#endif
+
+_Static_assert(ACQ_HALF_SAMPLES % (ACQ_CAPTURE_RATE / ACQ_SAMPLE_RATE) == 0 &&
+               ACQ_HALF_SAMPLES % (ACQ_THROTTLE_RATE / ACQ_SAMPLE_RATE) == 0,
+               "a half must hold whole sample periods at either rate");
+
+typedef uint16_t sample_t[LOG_CH_COUNT];
+typedef uint16_t scan_t[ACQ_REGULAR_CHANNELS];
+typedef uint16_t frame_t[LOG_PACKED_FRAME][LOG_CH_COUNT];
+
+static scan_t adc_buf[2][ACQ_HALF_SAMPLES] __attribute__((aligned(4)));
+
+// rate asked for by acquisition_throttle(); the DMA interrupt applies it
+static volatile uint32_t rate_request = ACQ_CAPTURE_RATE;
+// the half now filling is the first at a new rate
+static bool switched;
+
+// TIM5 tick of the next conversion, counted from the first capture
+static uint64_t next_time;
+static bool anchored;
+
+/* decimation into the logged stream */
+static uint32_t mean_sum[LOG_CH_COUNT];
+static uint32_t mean_count;
+static frame_t base;
+static uint32_t base_fill;
+static uint64_t base_time;             // time of base[0]
+
+static acq_totals_t totals;
+
+#ifdef USE_FREERTOS
+// a finished half of adc_buf, from the DMA interrupt to the acquisition task
+typedef struct {
+  uint32_t half;
+  uint64_t last;
+  uint32_t ticks;
+  bool restart;
+} acq_half_t;
+
+static StreamBufferHandle_t halves;
+#endif
+
+#if ACQ_PACKED
+static uint8_t frame[CODEC_FRAME_MAX];
+
+// queue block being filled; owned by the producer until committed
+static log_block_t *packed;
+static uint32_t packed_len;
+#endif
+
+#if ACQ_PACKED
+static void acquisition_push(const frame_t src, uint64_t time) {
+  uint32_t len = codec_encode(src, LOG_PACKED_FRAME, frame);
+
+  if (packed && packed_len + len > LOG_PAYLOAD_SIZE) {
+    logger_commit(packed);
+    packed = NULL;
+  }
+
+  if (!packed) {
+    if (!(packed = logger_alloc())) {
+      return;
+    }
+
+    packed->hdr.type = LOG_TYPE_PACKED;
+    packed->hdr.time = time;
+    packed_len = 0;
+  }
+
+  memcpy(&packed->raw[packed_len], frame, len);
+  packed_len += len;
+  packed->hdr.count += LOG_PACKED_FRAME;
+}
+#else
+static void acquisition_push(const frame_t src, uint64_t time) {
+  log_block_t *block = logger_alloc();
+
+  if (!block) {
+    return;
+  }
+
+  block->hdr.type = LOG_TYPE_SAMPLE;
+  block->hdr.count = LOG_SAMPLES_PER_BLOCK;
+  block->hdr.time = time;
+  memcpy(block->sample, src, sizeof(frame_t));
+
+  logger_commit(block);
+}
+#endif
+
+// add one conversion to the mean being averaged; a full frame of means goes to the log
+static void acquisition_decimate(const sample_t src, uint64_t time, uint32_t decimation) {
+  if (mean_count == 0 && base_fill == 0) {
+    base_time = time;
+  }
+
+  for (uint32_t ch = 0; ch < LOG_CH_COUNT; ch++) {
+    mean_sum[ch] += src[ch];
+  }
+
+  if (++mean_count < decimation) {
+    return;
+  }
+
+  for (uint32_t ch = 0; ch < LOG_CH_COUNT; ch++) {
+    base[base_fill][ch] = (mean_sum[ch] + decimation / 2) / decimation;
+    mean_sum[ch] = 0;
+  }
+
+  mean_count = 0;
+  autozero_feed(base[base_fill], thermal_celsius(), time);
+  stream_feed(base[base_fill]);
+
+  if (++base_fill == LOG_PACKED_FRAME) {
+    acquisition_push(base, base_time);
+    base_fill = 0;
+  }
+}
+
+// last is the trigger time of the last conversion of the half, ticks the
+// conversion period it was taken at; restart counts the times from last
+static void acquisition_half(const scan_t *half, uint64_t last, uint32_t ticks, bool restart) {
+  const float dt = (float)ticks / timebase_hz();
+  const float zero = autozero_zero();
+  const uint32_t decimation = timebase_hz() / ACQ_SAMPLE_RATE / ticks;
+  float energy = 0, charge = 0, peak = totals.peak_power_w;
+  sample_t src;
+
+  if (!anchored || restart) {
+    next_time = last - (uint64_t)(ACQ_HALF_SAMPLES - 1) * ticks;
+    anchored = true;
+  }
+
+  src[LOG_CH_TEMPERATURE] = thermal_code();
+
+  for (uint32_t i = 0; i < ACQ_HALF_SAMPLES; i++, next_time += ticks) {
+    memcpy(src, half[i], sizeof(scan_t));
+
+    float ref = src[LOG_CH_5V_REF] ? (float)src[LOG_CH_5V_REF] : 1.0f;
+    float current = ((float)src[LOG_CH_HV_CURRENT] / ref - zero) * CAL_HV_CURRENT_SPAN;
+    float voltage = (float)src[LOG_CH_HV_VOLTAGE] * CAL_HV_VOLTAGE_SCALE;
+    float power = voltage * current;
+
+    energy += power * dt;
+    charge += current * dt;
+
+    if (power > peak) {
+      peak = power;
+    }
+
+    capture_feed(src, next_time, current, voltage, power);
+    alarm_feed(src, next_time, current, voltage, power);
+    acquisition_decimate(src, next_time, decimation);
+  }
+
+  // keep the long-running sums in double; per-half sums are small enough for float
+  totals.energy_j += energy;
+  totals.charge_c += charge;
+  totals.peak_power_w = peak;
+
+  capture_service();
+  thermal_service(last);
+}
+
+void acquisition_calib(log_calib_t *calib) {
+  calib->lv_voltage_scale = CAL_LV_VOLTAGE_SCALE;
+  calib->hv_voltage_scale = CAL_HV_VOLTAGE_SCALE;
+  calib->hv_current_zero = autozero_zero();
+  calib->hv_current_span = CAL_HV_CURRENT_SPAN;
+}
+
+void acquisition_throttle(bool on) {
+  rate_request = on ? ACQ_THROTTLE_RATE : ACQ_CAPTURE_RATE;
+}
+
+uint32_t acquisition_rate(void) {
+  return timebase_hz() / timebase_sample_ticks();
+}
+
+// apply a requested rate between two halves; true if it changed
+static bool acquisition_switch(void) {
+  uint32_t period = timebase_hz() / (htim2.Init.Prescaler + 1) / rate_request - 1;
+
+  if (period == htim2.Init.Period) {
+    return false;
+  }
+
+  // this also updates htim2.Init.Period, which timebase_sample_ticks() reads
+  __HAL_TIM_SET_AUTORELOAD(&htim2, period);
+
+  // a shorter period must not leave the counter past it, or it would run up to 2^32
+  if (__HAL_TIM_GET_COUNTER(&htim2) > period) {
+    __HAL_TIM_SET_COUNTER(&htim2, period);
+  }
+
+  return true;
+}
+
+void acquisition_totals(acq_totals_t *out, bool reset_peak) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  *out = totals;
+
+  if (reset_peak) {
+    totals.peak_power_w = 0;
+  }
+
+  __set_PRIMASK(primask);
+}
+
+void acquisition_start(void) {
+#ifdef USE_FREERTOS
+  if (!(halves = xStreamBufferCreate(2 * sizeof(acq_half_t), sizeof(acq_half_t)))) {
+    Error_Handler();
+  }
+#endif
+
+  // the length counts DMA transfers, which are halfwords now
+  if (HAL_ADC_Start_DMA(&hadc1, (uint32_t *)adc_buf, sizeof(adc_buf) / sizeof(uint16_t)) != HAL_OK) {
+    Error_Handler();
+  }
+
+  if (HAL_TIM_Base_Start(&htim2) != HAL_OK) {
+    Error_Handler();
+  }
+}
+
+#ifdef USE_FREERTOS
+void acquisition_task(void *arg) {
+  acq_half_t msg;
+
+  acquisition_start();
+
+  for (;;) {
+    if (xStreamBufferReceive(halves, &msg, sizeof(msg), portMAX_DELAY) == sizeof(msg)) {
+      acquisition_half(adc_buf[msg.half], msg.last, msg.ticks, msg.restart);
+    }
+  }
+}
+
+static void acquisition_done(uint32_t half) {
+  // the next trigger comes one TIM2 period after the last one, longer than a
+  // scan takes at either rate, so the capture still holds the trigger of the
+  // half's last scan; only the first capture and those after a rate change are used
+  acq_half_t msg = { half, timebase_capture(), timebase_sample_ticks(), switched };
+  BaseType_t woken = pdFALSE;
+
+  switched = acquisition_switch();
+
+  // a full buffer means the task is a whole half behind; the half is lost either way
+  xStreamBufferSendFromISR(halves, &msg, sizeof(msg), &woken);
+  portYIELD_FROM_ISR(woken);
+}
+#else
+static void acquisition_done(uint32_t half) {
+  // the capture holds the trigger of the half's last scan, as in the FreeRTOS build
+  uint64_t last = timebase_capture();
+  uint32_t ticks = timebase_sample_ticks();
+  bool restart = switched;
+
+  switched = acquisition_switch();
+  acquisition_half(adc_buf[half], last, ticks, restart);
+}
+#endif
+
+void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef *hadc) {
+  acquisition_done(0);
+}
+
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc) {
+  acquisition_done(1);
+}
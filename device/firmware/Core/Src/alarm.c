@@ -0,0 +1,244 @@
+/**
+  ******************************************************************************
+  * @file    alarm.c
+  * @brief   Limit rules with hysteresis and debounce, checked on every conversion.
+  *
+  *          Rules are kept as the host states them and compiled into a flat
+  *          table of the enabled ones, each with its comparison folded into a
+  *          sign so the evaluator runs one multiply and one compare per rule
+  *          and conversion. A rule fires once its limit has been exceeded for
+  *          the debounce time, and clears once the value has stayed back past
+  *          the limit by the hysteresis for as long.
+  *
+  *          Evaluation runs in the acquisition path, so a rule change is seen
+  *          within one DMA half. Each change is queued once and read by two
+  *          consumers: the logger writes it as an event block and alarm_task()
+  *          sends it to the host as an unsolicited line.
+  ******************************************************************************
+  */
+#include <math.h>
+#include <string.h>
+
+#include "alarm.h"
+#include "acquisition.h"
+#include "command.h"
+#include "logger.h"
+#include "timebase.h"
+
+// a rule in evaluator form
+typedef struct {
+  uint8_t rule;                 // slot number
+  uint8_t quantity;             // alarm_quantity_t
+  float sign;                   // -1 for rules that fire under the limit
+  float set;                    // sign * limit
+  float clear;                  // sign * limit - hysteresis
+  uint64_t debounce;            // timer ticks, so it holds at any conversion rate
+} alarm_op_t;
+
+// keeps limits printable with three decimals in a long
+#define ALARM_LIMIT_MAX       1e6f
+
+static const alarm_rule_t defaults[] = ALARM_DEFAULT_RULES;
+
+_Static_assert(sizeof(defaults) / sizeof(defaults[0]) <= ALARM_RULES, "too many default alarm rules");
+_Static_assert((ALARM_EVENTS & (ALARM_EVENTS - 1)) == 0, "ALARM_EVENTS must be a power of two");
+
+/* rules as stated; command context only */
+static alarm_rule_t rules[ALARM_RULES];
+static uint32_t enabled;
+
+/* evaluator state; acquisition context, replaced with interrupts off */
+static alarm_op_t ops[ALARM_RULES];
+static uint32_t op_count;
+static uint64_t since[ALARM_RULES];     // when the pending change started, by slot
+static uint32_t pending;                // slots with a change pending
+static volatile uint32_t active;
+
+/* rule changes, one producer and two consumers with their own tails */
+typedef struct {
+  uint64_t time;
+  log_event_t event;
+} alarm_record_t;
+
+static alarm_record_t records[ALARM_EVENTS];
+static volatile uint32_t record_head;
+static volatile uint32_t log_tail;
+static volatile uint32_t notify_tail;
+static uint32_t events;
+
+static const char *const quantity_names[ALARM_QUANTITIES] = {
+  [ALARM_POWER] = "P",
+  [ALARM_CURRENT] = "I",
+  [ALARM_VOLTAGE] = "V",
+  [ALARM_LV_VOLTAGE] = "LV",
+  [ALARM_CURRENT_CODE] = "IRAW",
+};
+
+static void alarm_compile(uint32_t changed) {
+  alarm_op_t table[ALARM_RULES];
+  uint32_t count = 0;
+
+  for (uint32_t n = 0; n < ALARM_RULES; n++) {
+    if (!(enabled & (1UL << n))) {
+      continue;
+    }
+
+    const alarm_rule_t *r = &rules[n];
+    alarm_op_t *op = &table[count++];
+
+    op->rule = n;
+    op->quantity = r->quantity;
+    op->sign = r->below ? -1.0f : 1.0f;
+    op->set = op->sign * r->limit;
+    op->clear = op->set - r->hysteresis;
+    op->debounce = (uint64_t)r->debounce_ms * timebase_hz() / 1000;
+  }
+
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  memcpy(ops, table, count * sizeof(alarm_op_t));
+  op_count = count;
+
+  // a changed rule starts over, cleared
+  pending &= ~changed;
+  active &= ~changed;
+
+  __set_PRIMASK(primask);
+}
+
+void alarm_init(void) {
+  memset(rules, 0, sizeof(rules));
+  enabled = 0;
+
+  for (uint32_t n = 0; n < sizeof(defaults) / sizeof(defaults[0]); n++) {
+    rules[n] = defaults[n];
+    enabled |= 1UL << n;
+  }
+
+  alarm_compile((1UL << ALARM_RULES) - 1);
+}
+
+bool alarm_set(uint32_t n, const alarm_rule_t *rule) {
+  if (n >= ALARM_RULES) {
+    return false;
+  }
+
+  if (!rule) {
+    enabled &= ~(1UL << n);
+  } else if (rule->quantity < ALARM_QUANTITIES && fabsf(rule->limit) <= ALARM_LIMIT_MAX &&
+             rule->hysteresis >= 0 && rule->hysteresis <= ALARM_LIMIT_MAX) {
+    rules[n] = *rule;
+    enabled |= 1UL << n;
+  } else {
+    return false;
+  }
+
+  alarm_compile(1UL << n);
+  return true;
+}
+
+bool alarm_get(uint32_t n, alarm_rule_t *rule) {
+  if (n >= ALARM_RULES || !(enabled & (1UL << n))) {
+    return false;
+  }
+
+  *rule = rules[n];
+  return true;
+}
+
+uint32_t alarm_active(void) {
+  return active;
+}
+
+const char *alarm_quantity_name(uint32_t quantity) {
+  return quantity < ALARM_QUANTITIES ? quantity_names[quantity] : NULL;
+}
+
+static void alarm_record(const alarm_op_t *op, bool on, float value, uint64_t time, float current, float voltage,
+                         float power) {
+  uint32_t head = record_head;
+
+  // both consumers drain on their own, so this only happens in a burst; keep the older changes
+  if (head - log_tail >= ALARM_EVENTS || head - notify_tail >= ALARM_EVENTS) {
+    return;
+  }
+
+  alarm_record_t *rec = &records[head & (ALARM_EVENTS - 1)];
+
+  memset(rec, 0, sizeof(alarm_record_t));
+  rec->time = time;
+  rec->event.kind = on ? LOG_EVENT_ALARM : LOG_EVENT_ALARM_CLEAR;
+  rec->event.cause = op->rule;
+  rec->event.number = events++;
+  rec->event.current_a = current;
+  rec->event.voltage_v = voltage;
+  rec->event.power_w = power;
+  rec->event.value = value;
+
+  __DMB();
+  record_head = head + 1;
+}
+
+void alarm_feed(const uint16_t sample[LOG_CH_COUNT], uint64_t time, float current, float voltage, float power) {
+  float q[ALARM_QUANTITIES];
+  uint32_t on = active;
+
+  q[ALARM_POWER] = power;
+  q[ALARM_CURRENT] = current;
+  q[ALARM_VOLTAGE] = voltage;
+  q[ALARM_LV_VOLTAGE] = (float)sample[LOG_CH_LV_VOLTAGE] * CAL_LV_VOLTAGE_SCALE;
+  q[ALARM_CURRENT_CODE] = (float)sample[LOG_CH_HV_CURRENT];
+
+  for (uint32_t i = 0; i < op_count; i++) {
+    const alarm_op_t *op = &ops[i];
+    uint32_t bit = 1UL << op->rule;
+    float y = op->sign * q[op->quantity];
+    bool crossing = (on & bit) ? y < op->clear : y > op->set;
+
+    if (!crossing) {
+      pending &= ~bit;
+      continue;
+    }
+
+    if (!(pending & bit)) {
+      since[op->rule] = time;
+      pending |= bit;
+    }
+
+    if (time - since[op->rule] < op->debounce) {
+      continue;
+    }
+
+    pending &= ~bit;
+    on ^= bit;
+    alarm_record(op, on & bit, q[op->quantity], time, current, voltage, power);
+  }
+
+  active = on;
+}
+
+void alarm_task(void) {
+  while (notify_tail != record_head) {
+    const alarm_record_t *rec = &records[notify_tail & (ALARM_EVENTS - 1)];
+    char value[16];
+
+    command_fixed(value, sizeof(value), rec->event.value);
+    command_notify("!ALARM %u %u %s", rec->event.cause, rec->event.kind == LOG_EVENT_ALARM, value);
+
+    notify_tail++;
+  }
+}
+
+bool alarm_take(log_block_t *block) {
+  if (log_tail == record_head) {
+    return false;
+  }
+
+  const alarm_record_t *rec = &records[log_tail & (ALARM_EVENTS - 1)];
+
+  logger_event_block(block, &rec->event, rec->time);
+
+  log_tail++;
+  return true;
+}
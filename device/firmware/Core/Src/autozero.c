@@ -0,0 +1,123 @@
+/**
+  ******************************************************************************
+  * @file    autozero.c
+  * @brief   HV current sensor zero tracking over idle periods.
+  *
+  *          The Hall sensor output at 0 A drifts with temperature. While the
+  *          HV is off and steady, the current / 5V ref ratio is the sensor
+  *          zero, so each idle window of AUTOZERO_WINDOW logged samples gives
+  *          one measurement of it at the window's mean die temperature.
+  *
+  *          The zero is tracked as a value at a reference temperature plus a
+  *          linear tempco. The first measurement sets the zero outright; each
+  *          later one moves both by AUTOZERO_GAIN of the prediction error, the
+  *          tempco only when the temperature has changed enough to tell it
+  *          apart from noise. Between measurements the zero follows the
+  *          temperature through the tempco. Every update is logged as an
+  *          event and the session block carries the zero in use.
+  ******************************************************************************
+  */
+#include <math.h>
+#include <string.h>
+
+#include "autozero.h"
+#include "acquisition.h"
+#include "logger.h"
+
+/* window being checked */
+static uint32_t window_count;
+static float v_min, v_max;
+static float r_min, r_max;
+static float r_sum, t_sum;
+
+/* model; written in acquisition context only */
+static bool measured;
+static float zero = CAL_HV_CURRENT_ZERO;  // ratio at zero_temp
+static float zero_temp;                 // die temperature, C
+static float tempco;                    // ratio per C
+static float temp;                      // die temperature now, C
+static uint32_t updates;
+
+/* last update for the log; an older one not taken yet is overwritten */
+static logger_event_t update_event;
+
+static void autozero_restart(void) {
+  window_count = 0;
+  r_sum = t_sum = 0;
+}
+
+static void autozero_update(float z, float t, uint64_t time) {
+  float predicted = zero + tempco * (t - zero_temp);
+  float error = z - predicted;
+  float dt = t - zero_temp;
+
+  if (!measured) {
+    zero = z;
+    measured = true;
+  } else {
+    if (fabsf(dt) >= AUTOZERO_TEMP_SPAN) {
+      tempco += AUTOZERO_GAIN * error / dt;
+      tempco = fminf(fmaxf(tempco, -AUTOZERO_TEMPCO_MAX), AUTOZERO_TEMPCO_MAX);
+    }
+
+    zero = predicted + AUTOZERO_GAIN * error;
+  }
+
+  zero_temp = t;
+
+  log_event_t event;
+
+  memset(&event, 0, sizeof(event));
+  event.kind = LOG_EVENT_ZERO;
+  event.number = updates++;
+  event.value = z;
+  event.zero = zero;
+  event.tempco = tempco;
+  event.temperature = t;
+  logger_event_post(&update_event, &event, time);
+}
+
+void autozero_feed(const uint16_t sample[LOG_CH_COUNT], float celsius, uint64_t time) {
+  float ref = sample[LOG_CH_5V_REF] ? (float)sample[LOG_CH_5V_REF] : 1.0f;
+  float r = (float)sample[LOG_CH_HV_CURRENT] / ref;
+  float v = (float)sample[LOG_CH_HV_VOLTAGE] * CAL_HV_VOLTAGE_SCALE;
+  float t = celsius;
+
+  temp = t;
+
+  if (v >= AUTOZERO_HV_OFF_V || fabsf(r - CAL_HV_CURRENT_ZERO) > AUTOZERO_RATIO_LIMIT) {
+    autozero_restart();
+    return;
+  }
+
+  if (window_count == 0) {
+    v_min = v_max = v;
+    r_min = r_max = r;
+  }
+
+  v_min = fminf(v_min, v);
+  v_max = fmaxf(v_max, v);
+  r_min = fminf(r_min, r);
+  r_max = fmaxf(r_max, r);
+
+  if (v_max - v_min > AUTOZERO_HV_STEADY_V || r_max - r_min > AUTOZERO_RATIO_STEADY) {
+    autozero_restart();
+    return;
+  }
+
+  r_sum += r;
+  t_sum += t;
+
+  if (++window_count == AUTOZERO_WINDOW) {
+    autozero_update(r_sum / AUTOZERO_WINDOW, t_sum / AUTOZERO_WINDOW, time);
+    autozero_restart();
+  }
+}
+
+float autozero_zero(void) {
+  return zero + tempco * (temp - zero_temp);
+}
+
+bool autozero_take(log_block_t *block) {
+  return logger_event_take(&update_event, block);
+}
@@ -0,0 +1,273 @@
+/**
+  ******************************************************************************
+  * @file    capture.c
+  * @brief   Pre/post trigger capture of transients at the conversion rate.
+  *
+  *          Every conversion goes into a RAM ring that holds one capture
+  *          window. While armed, a trigger on current, voltage or power
+  *          slope (or a host request) marks the current sample; the ring
+  *          keeps filling for CAPTURE_POST samples and then freezes. The
+  *          frozen window is encoded a few frames per DMA half into two
+  *          alternating output blocks, an event block first and packed
+  *          capture blocks after it, which the logger writes next to the
+  *          regular samples. Once the last block is handed over the ring is
+  *          rearmed. The thermal policy can suspend the capture, which then
+  *          skips the armed ring altogether and starts over empty on resume.
+  ******************************************************************************
+  */
+#include <math.h>
+#include <string.h>
+
+#include "capture.h"
+#include "acquisition.h"
+#include "codec.h"
+#include "timebase.h"
+
+#define CAPTURE_HOLDOFF       (CAPTURE_HOLDOFF_MS * ACQ_CAPTURE_RATE / 1000)
+
+_Static_assert(CAPTURE_PRE < 0xFFFF && CAPTURE_POST > 0 && CAPTURE_POST < 0xFFFF, "capture window range");
+
+typedef enum {
+  CAPTURE_ARMED,
+  CAPTURE_POST_TRIGGER,         // filling the part after the trigger
+  CAPTURE_FROZEN,               // encoding the window
+} capture_state_t;
+
+static volatile capture_state_t state = CAPTURE_ARMED;
+static volatile bool force;
+static volatile bool suspended;
+static volatile uint32_t events;
+
+static uint16_t ring[CAPTURE_LEN][LOG_CH_COUNT];
+static uint32_t ring_pos;               // next slot to write
+static uint32_t ring_filled;            // valid samples since the ring was armed
+
+// power history for the slope trigger
+static float power_hist[CAPTURE_DPDT_SPAN];
+static uint32_t power_pos;
+static uint32_t power_filled;
+
+static uint32_t conditions;             // LOG_TRIGGER_* conditions true at the last sample
+static uint32_t since = CAPTURE_HOLDOFF;  // samples since the last trigger, saturating
+static uint32_t remaining;              // post-trigger samples still to come
+
+static log_event_t event;
+static uint64_t trigger_time;
+
+/* window being encoded */
+static uint32_t window_first;           // ring slot of the first sample
+static uint32_t window_emitted;         // samples encoded so far
+static bool announced;                  // the event block went out
+static uint16_t frame[LOG_PACKED_FRAME][LOG_CH_COUNT];
+static uint8_t encoded[CODEC_FRAME_MAX];
+static uint32_t encoded_len;            // encoded frame not yet placed in a block
+
+/* output blocks, filled and taken in strict alternation */
+static log_block_t out[2] __attribute__((aligned(4)));
+static volatile bool ready[2];
+static uint32_t fill;                   // producer side
+static uint32_t out_len;                // payload bytes in out[fill]
+static uint32_t next;                   // logger side
+
+static void capture_trigger(uint32_t cause, uint64_t time, float current, float voltage, float power, float dpdt) {
+  uint32_t pre = ring_filled - 1;
+
+  if (pre > CAPTURE_PRE) {
+    pre = CAPTURE_PRE;
+  }
+
+  memset(&event, 0, sizeof(event));
+  event.kind = LOG_EVENT_CAPTURE;
+  event.cause = cause;
+  event.number = events++;
+  event.sample_ticks = timebase_sample_ticks();
+  event.pre = pre;
+  event.post = CAPTURE_POST;
+  event.current_a = current;
+  event.voltage_v = voltage;
+  event.power_w = power;
+  event.dpdt_w_s = dpdt;
+
+  trigger_time = time;
+  since = 0;
+  remaining = CAPTURE_POST - 1;
+}
+
+static void capture_freeze(void) {
+  uint32_t total = event.pre + event.post;
+
+  window_first = (ring_pos + CAPTURE_LEN - total) % CAPTURE_LEN;
+  window_emitted = 0;
+  announced = false;
+  encoded_len = 0;
+  state = CAPTURE_FROZEN;
+}
+
+void capture_feed(const uint16_t sample[LOG_CH_COUNT], uint64_t time, float current, float voltage, float power) {
+  float dpdt = 0;
+  uint32_t now = 0;
+
+  // a window already triggered is still completed
+  if (suspended && state == CAPTURE_ARMED) {
+    ring_filled = 0;
+    power_filled = 0;
+    conditions = 0;
+    return;
+  }
+
+  if (power_filled == CAPTURE_DPDT_SPAN) {
+    dpdt = (power - power_hist[power_pos]) * ((float)ACQ_CAPTURE_RATE / CAPTURE_DPDT_SPAN);
+  } else {
+    power_filled++;
+  }
+
+  power_hist[power_pos] = power;
+  power_pos = (power_pos + 1) % CAPTURE_DPDT_SPAN;
+
+  if (CAPTURE_CURRENT_A > 0 && fabsf(current) > CAPTURE_CURRENT_A) {
+    now |= LOG_TRIGGER_CURRENT;
+  }
+  if (CAPTURE_VOLTAGE_V > 0 && voltage > CAPTURE_VOLTAGE_V) {
+    now |= LOG_TRIGGER_VOLTAGE;
+  }
+  if (CAPTURE_DPDT_W_S > 0 && fabsf(dpdt) > CAPTURE_DPDT_W_S) {
+    now |= LOG_TRIGGER_DPDT;
+  }
+
+  uint32_t rising = now & ~conditions;
+  conditions = now;
+
+  if (since < CAPTURE_HOLDOFF) {
+    since++;
+  }
+
+  if (state == CAPTURE_FROZEN) {
+    return;
+  }
+
+  memcpy(ring[ring_pos], sample, sizeof(ring[0]));
+  ring_pos = (ring_pos + 1) % CAPTURE_LEN;
+
+  if (ring_filled < CAPTURE_LEN) {
+    ring_filled++;
+  }
+
+  if (state == CAPTURE_ARMED) {
+    if (force) {
+      force = false;
+      rising |= LOG_TRIGGER_MANUAL;
+    } else if (since < CAPTURE_HOLDOFF) {
+      rising = 0;
+    }
+
+    if (rising) {
+      capture_trigger(rising, time, current, voltage, power, dpdt);
+      state = CAPTURE_POST_TRIGGER;
+    }
+  } else {
+    remaining--;
+  }
+
+  if (state == CAPTURE_POST_TRIGGER && remaining == 0) {
+    capture_freeze();
+  }
+}
+
+static void capture_publish(void) {
+  __DMB();
+  ready[fill] = true;
+  fill ^= 1;
+  out_len = 0;
+}
+
+void capture_service(void) {
+  uint32_t total = event.pre + event.post;
+
+  for (uint32_t frames = 0; state == CAPTURE_FROZEN && frames < CAPTURE_FRAMES_PER_HALF;) {
+    log_block_t *block = &out[fill];
+
+    // the logger still has this one; try again next half
+    if (ready[fill]) {
+      return;
+    }
+
+    if (!announced) {
+      memset(block, 0, sizeof(log_block_t));
+      block->hdr.type = LOG_TYPE_EVENT;
+      block->hdr.count = 1;
+      block->hdr.time = trigger_time;
+      block->event = event;
+
+      capture_publish();
+      announced = true;
+      continue;
+    }
+
+    uint32_t left = total - window_emitted;
+
+    if (left == 0) {
+      if (out_len) {
+        capture_publish();
+      }
+
+      ring_filled = 0;
+      state = CAPTURE_ARMED;
+      return;
+    }
+
+    uint32_t n = left < LOG_PACKED_FRAME ? left : LOG_PACKED_FRAME;
+
+    if (!encoded_len) {
+      for (uint32_t i = 0; i < n; i++) {
+        memcpy(frame[i], ring[(window_first + window_emitted + i) % CAPTURE_LEN], sizeof(frame[0]));
+      }
+
+      encoded_len = codec_encode(frame, n, encoded);
+      frames++;
+    }
+
+    if (out_len && out_len + encoded_len > LOG_PAYLOAD_SIZE) {
+      capture_publish();
+      continue;
+    }
+
+    if (!out_len) {
+      memset(block, 0, sizeof(log_block_t));
+      block->hdr.type = LOG_TYPE_CAPTURE;
+      block->hdr.time = trigger_time + ((int64_t)window_emitted - event.pre) * event.sample_ticks;
+    }
+
+    memcpy(&block->raw[out_len], encoded, encoded_len);
+    out_len += encoded_len;
+    block->hdr.count += n;
+    window_emitted += n;
+    encoded_len = 0;
+  }
+}
+
+void capture_force(void) {
+  force = true;
+}
+
+void capture_suspend(bool on) {
+  suspended = on;
+}
+
+uint32_t capture_count(void) {
+  return events;
+}
+
+bool capture_armed(void) {
+  return state == CAPTURE_ARMED;
+}
+
+log_block_t *capture_take(void) {
+  return ready[next] ? &out[next] : NULL;
+}
+
+void capture_written(log_block_t *block) {
+  if (block == &out[next]) {
+    ready[next] = false;
+    next ^= 1;
+  }
+}
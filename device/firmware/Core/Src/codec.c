@@ -0,0 +1,154 @@
+/**
+  ******************************************************************************
+  * @file    codec.c
+  * @brief   Lossless delta + bit-packing codec for sample frames.
+  *
+  *          Each channel of a frame is coded on its own: the first sample as
+  *          is, then the zigzagged first-order deltas minus their minimum
+  *          (frame of reference), packed LSB first at the smallest width that
+  *          holds the largest of them. Deltas wrap at 16 bits, so any input
+  *          round-trips; slowly moving 12-bit channels end up at 2-4 bits
+  *          per sample.
+  ******************************************************************************
+  */
+#include "codec.h"
+
+_Static_assert(CODEC_FRAME_MAX <= LOG_PAYLOAD_SIZE, "a frame must fit one packed block");
+
+static inline uint16_t zigzag(int32_t v) {
+  return (uint16_t)(((uint32_t)v << 1) ^ (0U - ((uint32_t)v >> 31)));
+}
+
+static inline int32_t unzigzag(uint32_t v) {
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+// zigzagged deltas of the frame being encoded, row i - 1 for sample i;
+// same sample-major halfword layout as the DMA buffer
+static uint16_t zz[LOG_PACKED_FRAME][LOG_CH_COUNT] __attribute__((aligned(4)));
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+// two channels at once: halfword deltas, doubled, xor-ed with their sign masks
+static inline uint32_t zigzag2(uint32_t cur, uint32_t prev) {
+  uint32_t d = __SSUB16(cur, prev);
+  return __SADD16(d, d) ^ __SSUB16(0, (d >> 15) & 0x00010001);
+}
+#endif
+
+static void codec_deltas(const uint16_t (*src)[LOG_CH_COUNT], uint32_t n) {
+  for (uint32_t i = 1; i < n; i++) {
+    uint32_t ch = 0;
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+    // rows are 10 bytes, so every other one is only halfword aligned; the M4
+    // handles those word accesses in hardware
+    for (; ch + 2 <= LOG_CH_COUNT; ch += 2) {
+      uint32_t z = zigzag2(__UNALIGNED_UINT32_READ(&src[i][ch]), __UNALIGNED_UINT32_READ(&src[i - 1][ch]));
+      __UNALIGNED_UINT32_WRITE(&zz[i - 1][ch], z);
+    }
+#endif
+
+    for (; ch < LOG_CH_COUNT; ch++) {
+      zz[i - 1][ch] = zigzag((int16_t)(src[i][ch] - src[i - 1][ch]));
+    }
+  }
+}
+
+uint32_t codec_encode(const uint16_t (*src)[LOG_CH_COUNT], uint32_t n, uint8_t *dst) {
+  uint8_t *p = dst;
+
+  codec_deltas(src, n);
+
+  for (uint32_t ch = 0; ch < LOG_CH_COUNT; ch++) {
+    uint16_t first = n ? src[0][ch] : 0;
+    uint16_t base = 0xFFFF, top = 0;
+
+    for (uint32_t i = 0; i + 1 < n; i++) {
+      if (zz[i][ch] < base) {
+        base = zz[i][ch];
+      }
+      if (zz[i][ch] > top) {
+        top = zz[i][ch];
+      }
+    }
+
+    if (n < 2) {
+      base = top = 0;
+    }
+
+    uint32_t width = 32 - __builtin_clz((uint32_t)(top - base) | 1);
+
+    if (top == base) {
+      width = 0;
+    }
+
+    *p++ = first;
+    *p++ = first >> 8;
+    *p++ = base;
+    *p++ = base >> 8;
+    *p++ = width;
+
+    if (width == 0) {
+      continue;
+    }
+
+    uint32_t acc = 0, bits = 0;
+
+    for (uint32_t i = 0; i + 1 < n; i++) {
+      acc |= (uint32_t)(uint16_t)(zz[i][ch] - base) << bits;
+      bits += width;
+
+      while (bits >= 8) {
+        *p++ = acc;
+        acc >>= 8;
+        bits -= 8;
+      }
+    }
+
+    if (bits) {
+      *p++ = acc;
+    }
+  }
+
+  return p - dst;
+}
+
+uint32_t codec_decode(const uint8_t *src, uint32_t len, uint16_t (*dst)[LOG_CH_COUNT], uint32_t n) {
+  const uint8_t *p = src, *end = src + len;
+
+  for (uint32_t ch = 0; ch < LOG_CH_COUNT; ch++) {
+    if (end - p < CODEC_CH_HEADER) {
+      return 0;
+    }
+
+    uint16_t value = p[0] | p[1] << 8;
+    uint16_t base = p[2] | p[3] << 8;
+    uint32_t width = p[4];
+    p += CODEC_CH_HEADER;
+
+    if (width > 16 || (uint32_t)(end - p) < (n ? ((n - 1) * width + 7) / 8 : 0)) {
+      return 0;
+    }
+
+    uint32_t acc = 0, bits = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+      if (i) {
+        while (bits < width) {
+          acc |= (uint32_t)*p++ << bits;
+          bits += 8;
+        }
+
+        uint32_t z = (acc & ((1UL << width) - 1)) + base;
+        acc >>= width;
+        bits -= width;
+
+        value += unzigzag(z & 0xFFFF);
+      }
+
+      dst[i][ch] = value;
+    }
+  }
+
+  return p - src;
+}
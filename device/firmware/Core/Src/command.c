@@ -0,0 +1,398 @@
+/**
+  ******************************************************************************
+  * @file    command.c
+  * @brief   Line-based command interface on the CDC port.
+  *
+  *          The host sends ASCII lines terminated by LF (CR is ignored). The
+  *          first word selects the command; every command answers with one
+  *          line starting with "OK" or "ERR". Lines starting with "!" are
+  *          notifications the device sends on its own, at any time:
+  *
+  *          !ALARM <n> <1 fired, 0 cleared> <value>
+  *          !S <sample number> <HV V> <HV A> <LV V> <die C>, while streaming
+  *
+  *          TIME                 -> OK <unix seconds>.<ms> <1 if host-set>
+  *          TIME <secs>[.<ms>]   -> OK, sets the RTC and starts a new segment
+  *          LAT <source>         -> OK <count> <entry min ns> <entry max ns> <run max ns>
+  *                                  for adc, sdio, sddma, usb or usbsvc; entry is "-"
+  *                                  where the source has no hardware timestamp
+  *          LAT CLEAR            -> OK, restarts the latency statistics
+  *          CAPTURE              -> OK <captures since boot> <1 if armed>
+  *          CAPTURE NOW          -> OK, triggers a transient capture once armed
+  *          ALARM                -> OK <bit mask of the firing rules>
+  *          ALARM <n>            -> OK <quantity> <op> <limit> <hysteresis> <debounce ms>, or OK OFF
+  *          ALARM <n> <quantity> <op> <limit> <hysteresis> <debounce ms>
+  *                               -> OK, replaces rule n; quantity is P, I, V, LV or IRAW,
+  *                                  op is > or <
+  *          ALARM <n> OFF        -> OK, disables rule n
+  *          STREAM               -> OK <1 if on> <samples dropped since it was turned on>
+  *          STREAM ON|OFF        -> OK, starts or stops the !S sample lines (see stream.c)
+  *          TEMP                 -> OK <die C> <thermal level: 0 normal, 1 capture
+  *                                  suspended, 2 conversion rate lowered>
+  *          TASK                 -> OK <task names>, FreeRTOS build only
+  *          TASK <name>          -> OK <free stack words> <CPU permille>
+  ******************************************************************************
+  */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "command.h"
+#include "alarm.h"
+#include "capture.h"
+#include "drift.h"
+#include "latency.h"
+#include "logger.h"
+#include "rtc.h"
+#include "stream.h"
+#include "thermal.h"
+#include "timebase.h"
+#include "usb_service.h"
+
+#ifdef USE_FREERTOS
+#include "rtos.h"
+#endif
+
+typedef struct {
+  const char *name;
+  void (*handler)(char *args);
+} command_t;
+
+static char line[COMMAND_LINE_MAX + 1];
+static uint32_t line_len;
+static bool line_overflow;
+
+static void command_send(const char *fmt, va_list ap) {
+  char buf[80];
+  int len = vsnprintf(buf, sizeof(buf) - 1, fmt, ap);
+
+  if (len < 0) {
+    return;
+  }
+  if (len > (int)sizeof(buf) - 2) {
+    len = sizeof(buf) - 2;
+  }
+
+  buf[len++] = '\n';
+  usb_cdc_send(buf, len);
+}
+
+static void command_reply(const char *fmt, ...) {
+  va_list ap;
+
+  va_start(ap, fmt);
+  command_send(fmt, ap);
+  va_end(ap);
+}
+
+void command_notify(const char *fmt, ...) {
+  va_list ap;
+
+  va_start(ap, fmt);
+  command_send(fmt, ap);
+  va_end(ap);
+}
+
+int command_fixed(char *buf, uint32_t size, float v) {
+  long milli = (long)(v * 1000 + (v < 0 ? -0.5f : 0.5f));
+  unsigned long mag = milli < 0 ? -(unsigned long)milli : (unsigned long)milli;
+
+  return snprintf(buf, size, "%s%lu.%03lu", milli < 0 ? "-" : "", mag / 1000, mag % 1000);
+}
+
+static void command_time(char *args) {
+  if (*args == '\0') {
+    uint64_t ms = rtc_get_unix_ms();
+    command_reply("OK %lu.%03u %u", (unsigned long)(ms / 1000), (unsigned)(ms % 1000), rtc_time_valid());
+    return;
+  }
+
+  char *end;
+  uint64_t ms = (uint64_t)strtoul(args, &end, 10) * 1000;
+
+  if (end == args) {
+    command_reply("ERR time");
+    return;
+  }
+
+  if (*end == '.') {
+    // up to three fraction digits, right-padded
+    uint32_t frac = 0, digits = 0;
+
+    for (end++; *end >= '0' && *end <= '9'; end++) {
+      if (digits++ < 3) {
+        frac = frac * 10 + (*end - '0');
+      }
+    }
+    for (; digits < 3; digits++) {
+      frac *= 10;
+    }
+
+    ms += frac;
+  }
+
+  if (*end != '\0' || rtc_set_unix_ms(ms) != HAL_OK) {
+    command_reply("ERR time");
+    return;
+  }
+
+  // the open segment maps its ticks to the old clock
+  logger_rotate();
+  drift_reset();
+  command_reply("OK");
+}
+
+static const struct {
+  const char *name;
+  bool timed;                   // entry delay is measured
+} latency_sources[LATENCY_SOURCES] = {
+  [LATENCY_ADC_DMA] = { "adc", true },
+  [LATENCY_SDIO] = { "sdio", false },
+  [LATENCY_SD_DMA] = { "sddma", false },
+  [LATENCY_USB] = { "usb", false },
+  [LATENCY_USB_SERVICE] = { "usbsvc", true },
+};
+
+static unsigned long command_ns(uint32_t ticks) {
+  return (unsigned long)((uint64_t)ticks * 1000000000 / timebase_hz());
+}
+
+static void command_latency(char *args) {
+  if (strcmp(args, "CLEAR") == 0) {
+    latency_clear();
+    command_reply("OK");
+    return;
+  }
+
+  for (uint32_t i = 0; i < LATENCY_SOURCES; i++) {
+    if (strcmp(args, latency_sources[i].name) != 0) {
+      continue;
+    }
+
+    latency_stat_t stat;
+    latency_get(i, &stat);
+
+    if (latency_sources[i].timed) {
+      command_reply("OK %lu %lu %lu %lu", (unsigned long)stat.count, command_ns(stat.entry_min),
+                    command_ns(stat.entry_max), command_ns(stat.run_max));
+    } else {
+      command_reply("OK %lu - - %lu", (unsigned long)stat.count, command_ns(stat.run_max));
+    }
+    return;
+  }
+
+  command_reply("ERR source");
+}
+
+static void command_capture(char *args) {
+  if (*args == '\0') {
+    command_reply("OK %lu %u", (unsigned long)capture_count(), capture_armed());
+    return;
+  }
+
+  if (strcmp(args, "NOW") != 0) {
+    command_reply("ERR capture");
+    return;
+  }
+
+  capture_force();
+  command_reply("OK");
+}
+
+static void command_alarm(char *args) {
+  alarm_rule_t rule;
+  char *tok[6];
+  uint32_t n = 0;
+
+  if (*args == '\0') {
+    command_reply("OK %lu", (unsigned long)alarm_active());
+    return;
+  }
+
+  for (char *t = strtok(args, " "); t && n < 6; t = strtok(NULL, " ")) {
+    tok[n++] = t;
+  }
+
+  if (n == 0) {
+    command_reply("ERR rule");
+    return;
+  }
+
+  char *end;
+  uint32_t slot = strtoul(tok[0], &end, 10);
+
+  if (*end != '\0' || slot >= ALARM_RULES) {
+    command_reply("ERR rule");
+    return;
+  }
+
+  if (n == 1) {
+    char limit[16], hysteresis[16];
+
+    if (!alarm_get(slot, &rule)) {
+      command_reply("OK OFF");
+      return;
+    }
+
+    command_fixed(limit, sizeof(limit), rule.limit);
+    command_fixed(hysteresis, sizeof(hysteresis), rule.hysteresis);
+    command_reply("OK %s %c %s %s %lu", alarm_quantity_name(rule.quantity), rule.below ? '<' : '>', limit, hysteresis,
+                  (unsigned long)rule.debounce_ms);
+    return;
+  }
+
+  if (n == 2 && strcmp(tok[1], "OFF") == 0) {
+    alarm_set(slot, NULL);
+    command_reply("OK");
+    return;
+  }
+
+  if (n != 6) {
+    command_reply("ERR rule");
+    return;
+  }
+
+  for (rule.quantity = 0; rule.quantity < ALARM_QUANTITIES; rule.quantity++) {
+    if (strcmp(tok[1], alarm_quantity_name(rule.quantity)) == 0) {
+      break;
+    }
+  }
+
+  rule.below = tok[2][0] == '<';
+  rule.limit = strtof(tok[3], &end);
+  bool ok = *end == '\0' && (tok[2][0] == '<' || tok[2][0] == '>') && tok[2][1] == '\0';
+  rule.hysteresis = strtof(tok[4], &end);
+  ok = ok && *end == '\0';
+  rule.debounce_ms = strtoul(tok[5], &end, 10);
+  ok = ok && *end == '\0';
+
+  if (!ok || !alarm_set(slot, &rule)) {
+    command_reply("ERR rule");
+    return;
+  }
+
+  command_reply("OK");
+}
+
+static void command_stream(char *args) {
+  if (*args == '\0') {
+    command_reply("OK %u %lu", stream_enabled(), (unsigned long)stream_dropped());
+    return;
+  }
+
+  if (strcmp(args, "ON") == 0) {
+    stream_enable(true);
+  } else if (strcmp(args, "OFF") == 0) {
+    stream_enable(false);
+  } else {
+    command_reply("ERR stream");
+    return;
+  }
+
+  command_reply("OK");
+}
+
+static void command_temp(char *args) {
+  char celsius[16];
+
+  command_fixed(celsius, sizeof(celsius), thermal_celsius());
+  command_reply("OK %s %u", celsius, (unsigned)thermal_level());
+}
+
+#ifdef USE_FREERTOS
+static void command_task(char *args) {
+  if (*args == '\0') {
+    char names[64];
+    uint32_t len = 0;
+    const char *name;
+
+    names[0] = '\0';
+
+    for (uint32_t i = 0; (name = rtos_task_name(i)) != NULL && len < sizeof(names); i++) {
+      len += snprintf(&names[len], sizeof(names) - len, " %s", name);
+    }
+
+    command_reply("OK%s", names);
+    return;
+  }
+
+  uint32_t stack_free, cpu;
+
+  if (!rtos_task_stats(args, &stack_free, &cpu)) {
+    command_reply("ERR task");
+    return;
+  }
+
+  command_reply("OK %lu %lu", (unsigned long)stack_free, (unsigned long)cpu);
+}
+#endif
+
+static const command_t commands[] = {
+  { "TIME", command_time },
+  { "LAT", command_latency },
+  { "CAPTURE", command_capture },
+  { "ALARM", command_alarm },
+  { "STREAM", command_stream },
+  { "TEMP", command_temp },
+#ifdef USE_FREERTOS
+  { "TASK", command_task },
+#endif
+};
+
+static void command_execute(char *cmd) {
+  char *args = cmd;
+
+  while (*args && *args != ' ') {
+    args++;
+  }
+  if (*args) {
+    *args++ = '\0';
+  }
+  while (*args == ' ') {
+    args++;
+  }
+
+  if (*cmd == '\0') {
+    return;
+  }
+
+  for (uint32_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+    if (strcmp(cmd, commands[i].name) == 0) {
+      commands[i].handler(args);
+      return;
+    }
+  }
+
+  command_reply("ERR unknown");
+}
+
+void command_input(const char *buf, uint32_t len) {
+  for (uint32_t i = 0; i < len; i++) {
+    char c = buf[i];
+
+    if (c == '\r') {
+      continue;
+    }
+
+    if (c != '\n') {
+      if (line_len < COMMAND_LINE_MAX) {
+        line[line_len++] = c;
+      } else {
+        line_overflow = true;
+      }
+      continue;
+    }
+
+    line[line_len] = '\0';
+
+    if (line_overflow) {
+      command_reply("ERR length");
+    } else {
+      command_execute(line);
+    }
+
+    line_len = 0;
+    line_overflow = false;
+  }
+}
@@ -0,0 +1,159 @@
+/**
+  ******************************************************************************
+  * @file    drift.c
+  * @brief   LSI drift estimation and RTC trimming against TIM5.
+  *
+  *          The RTC runs from the LSI, which is off by up to several percent
+  *          and moves with temperature. TIM5 counts the HSE-derived timer
+  *          clock, which is good to a few ppm, so comparing the two over a
+  *          window gives the LSI error directly; the 1 kHz USB SOF would only
+  *          be another HSE-derived reference.
+  *
+  *          Each measurement waits for a sub-second tick of the RTC and
+  *          latches TIM5 right at it, so both ends of the window sit on an
+  *          RTC edge and the result is not limited by the 1 ms RTC
+  *          resolution. The filtered error is removed by the smooth
+  *          calibration (+-487 ppm, 0.95 ppm steps). Larger errors are
+  *          taken out of the synchronous prescaler first, but only while the
+  *          RTC holds no host-set time, since that step loses the sub-second
+  *          phase.
+  ******************************************************************************
+  */
+#include <math.h>
+
+#include "drift.h"
+#include "rtc.h"
+#include "timebase.h"
+
+/* smooth calibration range and step */
+#define DRIFT_CALIB_STEP      (1e6f / (1 << 20))
+#define DRIFT_CALIB_MAX       (511 * DRIFT_CALIB_STEP)
+
+/* a window that moves the estimate by more than this is dropped as disturbed */
+#define DRIFT_SANE_PPM        20000
+
+static bool started;
+static bool measured;
+static uint32_t window_start_ms;
+static uint64_t ref_tick;
+static uint64_t ref_units;
+static uint32_t ref_hz;
+
+static float lsi_ppm;
+static float calib_ppm;   // smooth calibration in effect
+
+// RTC and TIM5 at the next RTC sub-second edge
+static bool drift_sample(uint64_t *tick, uint64_t *units, uint32_t *hz) {
+  uint32_t ss = RTC->SSR;
+  (void)RTC->DR;  // unlock the shadow registers again
+  uint64_t deadline = timebase_now() + timebase_hz() / 100;
+
+  while (RTC->SSR == ss) {
+    (void)RTC->DR;
+
+    if (timebase_now() > deadline) {
+      return false;
+    }
+  }
+
+  *tick = timebase_now();
+  *units = rtc_get_units(hz);
+  return true;
+}
+
+static float drift_calib_read(void) {
+  uint32_t calr = RTC->CALR;
+  int32_t pulses = ((calr & RTC_CALR_CALP) ? 512 : 0) - (int32_t)(calr & RTC_CALR_CALM);
+
+  return pulses * DRIFT_CALIB_STEP;
+}
+
+static void drift_calib_write(float ppm) {
+  // CALP adds 512 pulses per cycle, CALM masks up to 511 of them
+  int32_t pulses = lroundf(ppm / DRIFT_CALIB_STEP);
+  uint32_t plus = pulses > 0 ? RTC_SMOOTHCALIB_PLUSPULSES_SET : RTC_SMOOTHCALIB_PLUSPULSES_RESET;
+  uint32_t minus = pulses > 0 ? 512 - pulses : -pulses;
+
+  if (minus > 511) {
+    minus = 511;
+  }
+
+  HAL_RTCEx_SetSmoothCalib(&hrtc, RTC_SMOOTHCALIB_PERIOD_32SEC, plus, minus);
+}
+
+void drift_reset(void) {
+  started = drift_sample(&ref_tick, &ref_units, &ref_hz);
+  window_start_ms = HAL_GetTick();
+}
+
+void drift_task(void) {
+  uint64_t tick, units;
+  uint32_t hz;
+
+  if (!started) {
+    calib_ppm = drift_calib_read();
+    drift_reset();
+    return;
+  }
+
+  if (HAL_GetTick() - window_start_ms < DRIFT_WINDOW_MS) {
+    return;
+  }
+
+  if (!drift_sample(&tick, &units, &hz) || hz != ref_hz) {
+    drift_reset();
+    return;
+  }
+
+  // RTC rate against TIM5 over the window, calibration included
+  double rtc_s = (double)(int64_t)(units - ref_units) / hz;
+  double tim_s = (double)(tick - ref_tick) / timebase_hz();
+  double rate = rtc_s / tim_s;
+
+  ref_tick = tick;
+  ref_units = units;
+  window_start_ms = HAL_GetTick();
+
+  // rate = (lsi / (32 * hz)) * (1 + calib), with the asynchronous prescaler at 32
+  double lsi = rate * hz / (DRIFT_LSI_HZ / 32) / (1 + calib_ppm * 1e-6) - 1;
+
+  if (fabs(lsi) > 0.5 || (measured && fabs(lsi * 1e6 - lsi_ppm) > DRIFT_SANE_PPM)) {
+    return;
+  }
+
+  lsi_ppm = measured ? lsi_ppm + (float)(lsi * 1e6 - lsi_ppm) / 4 : (float)(lsi * 1e6);
+  measured = true;
+
+  // prescaled LSI against one RTC second, and the calibration that cancels it
+  double prescaled = (1 + lsi_ppm * 1e-6) * (DRIFT_LSI_HZ / 32) / hz;
+  float need = (float)((1 / prescaled - 1) * 1e6);
+
+  if (fabsf(need) > DRIFT_CALIB_MAX && !rtc_time_valid()) {
+    uint32_t synch = lround((1 + lsi_ppm * 1e-6) * (DRIFT_LSI_HZ / 32)) - 1;
+
+    if (rtc_set_prescaler(synch) == HAL_OK) {
+      prescaled = (1 + lsi_ppm * 1e-6) * (DRIFT_LSI_HZ / 32) / (synch + 1);
+      need = (float)((1 / prescaled - 1) * 1e6);
+    }
+  }
+
+  need = fmaxf(-DRIFT_CALIB_MAX, fminf(need, 512 * DRIFT_CALIB_STEP));
+
+  if (fabsf(need - calib_ppm) >= DRIFT_CALIB_STEP) {
+    drift_calib_write(need);
+    calib_ppm = drift_calib_read();
+    // the window in progress ran at the old calibration
+    drift_reset();
+  }
+}
+
+bool drift_status(float *lsi, float *trim) {
+  if (!measured) {
+    return false;
+  }
+
+  // prescaler offset from the 32 kHz nominal plus the smooth calibration
+  *lsi = lsi_ppm;
+  *trim = ((float)(DRIFT_LSI_HZ / 32) / (hrtc.Init.SynchPrediv + 1) - 1) * 1e6f + calib_ppm;
+  return true;
+}
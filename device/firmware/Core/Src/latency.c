@@ -0,0 +1,57 @@
+/**
+  ******************************************************************************
+  * @file    latency.c
+  * @brief   Worst-case interrupt entry delay and run time per source.
+  *
+  *          Handlers stamp TIM5 on entry and exit. The ADC DMA interrupt also
+  *          has the TIM5 capture of the trigger that started its last
+  *          conversion, so its entry delay is measured directly: the constant
+  *          part is the conversion of one scan, the spread above the minimum
+  *          is what masking and other handlers added. The USB service slice
+  *          is measured from the first request for it. SDIO and USB have no
+  *          hardware timestamp; their run times bound how long they can hold
+  *          off everything at or below their own level (see main.h).
+  ******************************************************************************
+  */
+#include <string.h>
+
+#include "latency.h"
+
+static latency_stat_t stats[LATENCY_SOURCES];
+
+// each source is only written by its own handler, so no locking is needed there
+void latency_event(latency_source_t src, uint32_t event, uint32_t enter) {
+  latency_stat_t *s = &stats[src];
+  uint32_t delay = enter - event;
+
+  if (s->count == 0 || delay < s->entry_min) {
+    s->entry_min = delay;
+  }
+  if (delay > s->entry_max) {
+    s->entry_max = delay;
+  }
+}
+
+void latency_exit(latency_source_t src, uint32_t enter) {
+  latency_stat_t *s = &stats[src];
+  uint32_t run = TIM5->CNT - enter;
+
+  if (run > s->run_max) {
+    s->run_max = run;
+  }
+  s->count++;
+}
+
+void latency_get(latency_source_t src, latency_stat_t *stat) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  *stat = stats[src];
+  __set_PRIMASK(primask);
+}
+
+void latency_clear(void) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  memset(stats, 0, sizeof(stats));
+  __set_PRIMASK(primask);
+}
@@ -0,0 +1,621 @@
+/**
+  ******************************************************************************
+  * @file    logger.c
+  * @brief   Block queue between the acquisition path and the SD card.
+  *
+  *          The acquisition interrupt fills blocks in place and FatFs takes
+  *          them straight from the queue, whole sectors at sector-aligned
+  *          offsets, so the SDIO DMA reads the queue memory without a copy.
+  *
+  *          Each logger start is a session of preallocated segment files
+  *          LOGsssss_ggg.BIN, each opened by a session block and listed in
+  *          SESSIONS.IDX. Summary, event and capture blocks go between the
+  *          sample runs, and a directory of the summaries closes the segment,
+  *          one bounded step per logger_task() call. A segment left open by
+  *          a power loss is cut back to its indexed length at the next start.
+  ******************************************************************************
+  */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "acquisition.h"
+#include "alarm.h"
+#include "autozero.h"
+#include "capture.h"
+#include "codec.h"
+#include "crc.h"
+#include "fatfs.h"
+#include "rtc.h"
+#include "summary.h"
+#include "thermal.h"
+#include "timebase.h"
+#include "drift.h"
+
+_Static_assert((LOG_QUEUE_LEN & (LOG_QUEUE_LEN - 1)) == 0, "LOG_QUEUE_LEN must be a power of two");
+_Static_assert(LOG_SEGMENT_SIZE % LOG_BLOCK_SIZE == 0, "LOG_SEGMENT_SIZE must be a whole number of blocks");
+
+// sample runs stop here; the rest of the preallocation is kept for the summaries and trailer
+#define LOG_SEGMENT_LIMIT (LOG_SEGMENT_SIZE / LOG_BLOCK_SIZE - SUMMARY_RESERVE_BLOCKS)
+
+static log_block_t queue[LOG_QUEUE_LEN] __attribute__((aligned(4)));
+
+// free-running indices; head is owned by the producer, tail by the writer
+static volatile uint32_t head;
+static volatile uint32_t tail;
+
+static volatile uint32_t seq;
+static uint32_t pending_flags;
+
+static bool opened = false;
+static bool rotate = false;
+static uint32_t last_sync_ms;
+
+// segment switch, done one step per logger_task() so the main loop keeps turning
+typedef enum {
+  LOGGER_RUN,
+  LOGGER_CLOSE_SUMMARIES,       // full and partial summary blocks
+  LOGGER_CLOSE_DIRECTORY,       // one directory block per step
+  LOGGER_CLOSE_FILE,            // final index record, truncate
+  LOGGER_OPEN,                  // next segment
+} logger_state_t;
+
+static logger_state_t state = LOGGER_RUN;
+static uint32_t directory_next;
+
+/* current segment */
+static uint16_t session;
+static uint16_t segment;
+static uint32_t segment_blocks;
+static uint32_t segment_start_ms;
+static acq_totals_t segment_base;
+
+// session and trailer blocks written by the logger itself
+static log_block_t meta_block __attribute__((aligned(4)));
+
+/* SESSIONS.IDX and the record of the current segment */
+static FIL index_file;
+static log_index_t entry;
+static FSIZE_t entry_offset;
+
+uint32_t logger_crc(const void *data, uint32_t words) {
+  // the CRC unit is shared with the acquisition interrupt
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  uint32_t crc = HAL_CRC_Calculate(&hcrc, (uint32_t *)data, words);
+
+  __set_PRIMASK(primask);
+  return crc;
+}
+
+void logger_event_post(logger_event_t *slot, const log_event_t *event, uint64_t time) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  slot->event = *event;
+  slot->time = time;
+  slot->ready = true;
+
+  __set_PRIMASK(primask);
+}
+
+bool logger_event_take(logger_event_t *slot, log_block_t *block) {
+  // the record is small; copy it with the producers held off
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  bool ready = slot->ready;
+  log_event_t event = slot->event;
+  uint64_t time = slot->time;
+  slot->ready = false;
+
+  __set_PRIMASK(primask);
+
+  if (ready) {
+    logger_event_block(block, &event, time);
+  }
+
+  return ready;
+}
+
+void logger_event_block(log_block_t *block, const log_event_t *event, uint64_t time) {
+  memset(block, 0, sizeof(log_block_t));
+  block->hdr.type = LOG_TYPE_EVENT;
+  block->hdr.count = 1;
+  block->hdr.time = time;
+  block->event = *event;
+}
+
+static FRESULT logger_write_index(void) {
+  UINT written;
+  FRESULT ret;
+
+  entry.crc = logger_crc(&entry, offsetof(log_index_t, crc) / sizeof(uint32_t));
+
+  if ((ret = f_lseek(&index_file, entry_offset)) != FR_OK) {
+    return ret;
+  }
+
+  if ((ret = f_write(&index_file, &entry, sizeof(entry), &written)) != FR_OK) {
+    return ret;
+  }
+
+  return f_sync(&index_file);
+}
+
+static void logger_update_index(bool closed) {
+  acq_totals_t now;
+  acquisition_totals(&now, false);
+
+  entry.blocks = segment_blocks;
+  entry.duration_ms = HAL_GetTick() - segment_start_ms;
+  entry.energy_wh = (float)((now.energy_j - segment_base.energy_j) / 3600);
+  entry.charge_ah = (float)((now.charge_c - segment_base.charge_c) / 3600);
+  entry.peak_power_w = now.peak_power_w;
+  entry.flags = closed ? LOG_INDEX_CLOSED : 0;
+
+  logger_write_index();
+}
+
+static bool logger_index_valid(const log_index_t *e) {
+  return e->magic == LOG_INDEX_MAGIC && e->crc == logger_crc(e, offsetof(log_index_t, crc) / sizeof(uint32_t));
+}
+
+// highest session number among the LOGsssss_ggg.BIN files on the card, -1 if there are none
+static int32_t logger_last_file_session(void) {
+  static DIR dir;
+  static FILINFO info;
+  int32_t last = -1;
+
+  if (f_opendir(&dir, USERPath) != FR_OK) {
+    return last;
+  }
+
+  while (f_readdir(&dir, &info) == FR_OK && info.fname[0]) {
+    const char *name = info.fname;
+    char *end;
+
+    if (strlen(name) != 16 || strncmp(name, "LOG", 3) != 0 || name[8] != '_' || strcmp(name + 12, ".BIN") != 0) {
+      continue;
+    }
+
+    int32_t n = (int32_t)strtoul(name + 3, &end, 10);
+
+    if (end == name + 8 && n > last) {
+      last = n;
+    }
+  }
+
+  f_closedir(&dir);
+  return last;
+}
+
+// cut a segment that was still open at a power loss back to the blocks its
+// record counts; the preallocated rest of the file is stale card data
+static FRESULT logger_recover_segment(void) {
+  char path[24];
+  FRESULT ret;
+
+  snprintf(path, sizeof(path), "%sLOG%05u_%03u.BIN", USERPath, entry.session, entry.segment);
+
+  if ((ret = f_open(&USERFile, path, FA_OPEN_EXISTING | FA_WRITE)) == FR_OK) {
+    if ((ret = f_lseek(&USERFile, (FSIZE_t)entry.blocks * LOG_BLOCK_SIZE)) == FR_OK) {
+      ret = f_truncate(&USERFile);
+    }
+
+    f_close(&USERFile);
+  }
+
+  if (ret != FR_OK && ret != FR_NO_FILE) {
+    return ret;
+  }
+
+  entry.flags |= LOG_INDEX_RECOVERED;
+  return logger_write_index();
+}
+
+// find the end of SESSIONS.IDX, recover the segment its last record left
+// open, and pick a session number no record or segment file has used
+static FRESULT logger_open_index(void) {
+  char path[20];
+  bool found = false;
+  UINT read;
+  FRESULT ret;
+
+  snprintf(path, sizeof(path), "%s%s", USERPath, LOG_INDEX_FILE);
+
+  if ((ret = f_open(&index_file, path, FA_OPEN_ALWAYS | FA_READ | FA_WRITE)) != FR_OK) {
+    return ret;
+  }
+
+  // only the last record is ever rewritten, but a power loss can leave it
+  // short or torn at full length; step back to the last one that checks out
+  entry_offset = f_size(&index_file) / sizeof(log_index_t) * sizeof(log_index_t);
+
+  while (!found && entry_offset) {
+    entry_offset -= sizeof(log_index_t);
+
+    if ((ret = f_lseek(&index_file, entry_offset)) != FR_OK) {
+      return ret;
+    }
+
+    found = f_read(&index_file, &entry, sizeof(entry), &read) == FR_OK && read == sizeof(entry) &&
+            logger_index_valid(&entry);
+  }
+
+  if (found && !(entry.flags & (LOG_INDEX_CLOSED | LOG_INDEX_RECOVERED)) && (ret = logger_recover_segment()) != FR_OK) {
+    return ret;
+  }
+
+  // new records go after the last good one, over anything torn
+  if (found) {
+    entry_offset += sizeof(log_index_t);
+  }
+
+  // segment files whose record was lost still hold their numbers
+  int32_t next = found ? entry.session + 1 : 0;
+  int32_t files = logger_last_file_session() + 1;
+
+  session = next > files ? next : files;
+  return FR_OK;
+}
+
+// non-sample blocks borrow the sequence number of the sample block after them
+static uint32_t logger_next_seq(void) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  uint32_t next_seq = head != tail ? queue[tail & (LOG_QUEUE_LEN - 1)].hdr.seq : seq;
+  __set_PRIMASK(primask);
+
+  return next_seq;
+}
+
+static FRESULT logger_write_block(log_block_t *block) {
+  UINT written;
+  FRESULT ret;
+
+  block->hdr.magic = LOG_BLOCK_MAGIC;
+  block->hdr.version = LOG_FORMAT_VERSION;
+  block->hdr.seq = logger_next_seq();
+  block->crc = logger_crc(block, offsetof(log_block_t, crc) / sizeof(uint32_t));
+
+  if ((ret = f_write(&USERFile, block, LOG_BLOCK_SIZE, &written)) != FR_OK) {
+    return ret;
+  }
+
+  segment_blocks++;
+  return written == LOG_BLOCK_SIZE ? FR_OK : FR_DISK_ERR;
+}
+
+// write every summary block that filled up
+static FRESULT logger_write_summaries(void) {
+  log_block_t *block;
+  FRESULT ret;
+
+  while ((block = summary_take()) != NULL) {
+    uint32_t index = segment_blocks;
+
+    if ((ret = logger_write_block(block)) != FR_OK) {
+      return ret;
+    }
+
+    summary_written(block, index);
+  }
+
+  return FR_OK;
+}
+
+// write the alarm events, zero updates, thermal changes and capture blocks handed over so far, within the sample room
+static FRESULT logger_write_events(void) {
+  log_block_t *block;
+  FRESULT ret;
+
+  while (segment_blocks < LOG_SEGMENT_LIMIT && (alarm_take(&meta_block) || autozero_take(&meta_block) ||
+                                                thermal_take(&meta_block))) {
+    if ((ret = logger_write_block(&meta_block)) != FR_OK) {
+      return ret;
+    }
+  }
+
+  while (segment_blocks < LOG_SEGMENT_LIMIT && (block = capture_take()) != NULL) {
+    if ((ret = logger_write_block(block)) != FR_OK) {
+      return ret;
+    }
+
+    capture_written(block);
+  }
+
+  return FR_OK;
+}
+
+// feed a queued block into the summaries; true once a summary block is ready
+static bool logger_summarize(const log_block_t *block, uint32_t index) {
+  static uint16_t frame[LOG_PACKED_FRAME][LOG_CH_COUNT];
+
+  if (block->hdr.type == LOG_TYPE_SAMPLE) {
+    summary_feed(block->sample, block->hdr.count, index);
+  } else if (block->hdr.type == LOG_TYPE_PACKED) {
+    uint32_t pos = 0;
+
+    for (uint32_t left = block->hdr.count; left;) {
+      uint32_t n = left < LOG_PACKED_FRAME ? left : LOG_PACKED_FRAME;
+      uint32_t used = codec_decode(&block->raw[pos], LOG_PAYLOAD_SIZE - pos, frame, n);
+
+      if (!used) {
+        break;
+      }
+
+      summary_feed(frame, n, index);
+      pos += used;
+      left -= n;
+    }
+  }
+
+  return summary_take() != NULL;
+}
+
+static FRESULT logger_open_segment(void) {
+  char path[24];
+  FRESULT ret;
+
+  // never write over an existing file; one in the way moves the segment to the next session number
+  for (;;) {
+    snprintf(path, sizeof(path), "%sLOG%05u_%03u.BIN", USERPath, session, segment);
+
+    if ((ret = f_open(&USERFile, path, FA_CREATE_NEW | FA_WRITE)) != FR_EXIST) {
+      break;
+    }
+
+    session++;
+    segment = 0;
+  }
+
+  if (ret != FR_OK) {
+    return ret;
+  }
+
+  // a contiguous preallocation keeps FAT updates out of the write path;
+  // on a fragmented card the file simply grows cluster by cluster instead
+  f_expand(&USERFile, LOG_SEGMENT_SIZE, 1);
+
+  segment_blocks = 0;
+  segment_start_ms = HAL_GetTick();
+  acquisition_totals(&segment_base, true);
+
+  summary_reset();
+
+  // read both clocks back to back; this pair maps sample ticks to wall-clock time
+  uint64_t unix_ms = rtc_get_unix_ms();
+  uint64_t tick = timebase_now();
+
+  memset(&meta_block, 0, sizeof(meta_block));
+  meta_block.hdr.type = LOG_TYPE_SESSION;
+  meta_block.hdr.count = 1;
+  meta_block.hdr.time = tick;
+  meta_block.session.session = session;
+  meta_block.session.segment = segment;
+  meta_block.session.start = unix_ms / 1000;
+  meta_block.session.start_ms = unix_ms % 1000;
+  meta_block.session.sample_rate = ACQ_SAMPLE_RATE;
+  meta_block.session.samples_per_block = LOG_SAMPLES_PER_BLOCK;
+  meta_block.session.channels = LOG_CH_COUNT;
+  acquisition_calib(&meta_block.session.calib);
+  meta_block.session.tick_hz = timebase_hz();
+  meta_block.session.sample_ticks = timebase_hz() / ACQ_SAMPLE_RATE;
+  meta_block.session.flags = rtc_time_valid() ? LOG_SESSION_TIME_SET : 0;
+
+  if (drift_status(&meta_block.session.lsi_ppm, &meta_block.session.trim_ppm)) {
+    meta_block.session.flags |= LOG_SESSION_DRIFT;
+  }
+
+  if ((ret = logger_write_block(&meta_block)) != FR_OK) {
+    return ret;
+  }
+
+  memset(&entry, 0, sizeof(entry));
+  entry.magic = LOG_INDEX_MAGIC;
+  entry.session = session;
+  entry.segment = segment;
+  entry.first_seq = meta_block.hdr.seq;
+  entry.start = meta_block.session.start;
+
+  logger_update_index(false);
+
+  return f_sync(&USERFile);
+}
+
+// one step of closing the segment and opening the next; samples wait in the queue meanwhile
+static FRESULT logger_switch_step(void) {
+  switch (state) {
+    case LOGGER_CLOSE_SUMMARIES:
+      // emit the partial buckets, then the directory as the last blocks of the file
+      state = LOGGER_CLOSE_FILE;
+
+      if (logger_write_summaries() == FR_OK) {
+        summary_flush();
+
+        if (logger_write_summaries() == FR_OK) {
+          directory_next = 0;
+          state = LOGGER_CLOSE_DIRECTORY;
+        }
+      }
+      break;
+
+    case LOGGER_CLOSE_DIRECTORY:
+      summary_directory(&meta_block, directory_next);
+
+      if (logger_write_block(&meta_block) != FR_OK || ++directory_next == summary_directory_blocks()) {
+        state = LOGGER_CLOSE_FILE;
+      }
+      break;
+
+    case LOGGER_CLOSE_FILE:
+      logger_update_index(true);
+
+      // give back the unused part of the preallocation
+      f_truncate(&USERFile);
+      f_close(&USERFile);
+
+      entry_offset += sizeof(log_index_t);
+      segment++;
+      state = LOGGER_OPEN;
+      break;
+
+    case LOGGER_OPEN:
+      // this segment satisfies any rotation asked for up to now
+      rotate = false;
+      state = LOGGER_RUN;
+      last_sync_ms = HAL_GetTick();
+
+      return logger_open_segment();
+
+    default:
+      break;
+  }
+
+  return FR_OK;
+}
+
+static void logger_fail(void) {
+  f_close(&USERFile);
+  f_close(&index_file);
+  opened = false;
+  state = LOGGER_RUN;
+}
+
+void logger_init(void) {
+  if (retUSER != 0) {
+    return;
+  }
+
+  if (f_mount(&USERFatFS, USERPath, 1) != FR_OK) {
+    return;
+  }
+
+  if (logger_open_index() != FR_OK) {
+    return;
+  }
+
+  segment = 0;
+
+  if (logger_open_segment() != FR_OK) {
+    logger_fail();
+    return;
+  }
+
+  opened = true;
+  last_sync_ms = HAL_GetTick();
+}
+
+void logger_rotate(void) {
+  rotate = true;
+}
+
+log_block_t *logger_alloc(void) {
+  if (head - tail >= LOG_QUEUE_LEN) {
+    // writer fell behind; drop this block but keep the sequence gap visible
+    seq++;
+    pending_flags |= LOG_FLAG_OVERRUN;
+    return NULL;
+  }
+
+  log_block_t *block = &queue[head & (LOG_QUEUE_LEN - 1)];
+  memset(block, 0, sizeof(log_block_t));
+
+  return block;
+}
+
+void logger_commit(log_block_t *block) {
+  block->hdr.magic = LOG_BLOCK_MAGIC;
+  block->hdr.version = LOG_FORMAT_VERSION;
+  block->hdr.seq = seq++;
+  block->hdr.flags |= pending_flags;
+  block->crc = logger_crc(block, offsetof(log_block_t, crc) / sizeof(uint32_t));
+
+  pending_flags = 0;
+
+  // publish the block only after it is complete
+  __DMB();
+  head++;
+}
+
+void logger_task(void) {
+  uint32_t pending = head - tail;
+
+  if (!opened) {
+    log_block_t *block;
+
+    tail += pending;
+
+    // keep the captures and events going round without a card
+    while ((block = capture_take()) != NULL) {
+      capture_written(block);
+    }
+    while (alarm_take(&meta_block)) {
+    }
+    autozero_take(&meta_block);
+    thermal_take(&meta_block);
+    return;
+  }
+
+  if (state != LOGGER_RUN) {
+    if (logger_switch_step() != FR_OK) {
+      logger_fail();
+    }
+    return;
+  }
+
+  if (pending) {
+    // write the run up to the end of the ring or the segment in a single call
+    // so FatFs can issue one multi-block transfer for it
+    uint32_t idx = tail & (LOG_QUEUE_LEN - 1);
+    uint32_t count = pending < LOG_QUEUE_LEN - idx ? pending : LOG_QUEUE_LEN - idx;
+    uint32_t room = segment_blocks < LOG_SEGMENT_LIMIT ? LOG_SEGMENT_LIMIT - segment_blocks : 0;
+    UINT written;
+
+    if (count > room) {
+      count = room;
+    }
+
+    // end the run at a block that completed a summary block, so the
+    // summary is written before the next one can fill up
+    for (uint32_t i = 0; i < count; i++) {
+      if (logger_summarize(&queue[idx + i], segment_blocks + i)) {
+        count = i + 1;
+      }
+    }
+
+    if (f_write(&USERFile, &queue[idx], count * LOG_BLOCK_SIZE, &written) != FR_OK || written != count * LOG_BLOCK_SIZE) {
+      logger_fail();
+      return;
+    }
+
+    tail += count;
+    segment_blocks += count;
+
+    if (logger_write_summaries() != FR_OK) {
+      logger_fail();
+      return;
+    }
+  }
+
+  if (logger_write_events() != FR_OK) {
+    logger_fail();
+    return;
+  }
+
+  if (rotate || segment_blocks >= LOG_SEGMENT_LIMIT || summary_full() || HAL_GetTick() - segment_start_ms >= LOG_SEGMENT_DURATION_MS) {
+    state = LOGGER_CLOSE_SUMMARIES;
+    return;
+  }
+
+  if (HAL_GetTick() - last_sync_ms >= LOG_SYNC_INTERVAL_MS) {
+    last_sync_ms = HAL_GetTick();
+    f_sync(&USERFile);
+    logger_update_index(false);
+  }
+}
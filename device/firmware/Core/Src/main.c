@@ -31,6 +31,19 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "tusb.h"
+
+#include "usb_service.h"
+#include "acquisition.h"
+#include "logger.h"
+#include "timebase.h"
+#include "command.h"
+#include "drift.h"
+#include "alarm.h"
+#include "stream.h"
+
+#ifdef USE_FREERTOS
+#include "rtos.h"
+#endif
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -71,12 +84,11 @@ enum {
   BLINK_NOT_MOUNTED = 250,
   BLINK_MOUNTED = 1000,
   BLINK_SUSPENDED = 2500,
+  BLINK_ALARM = 100,            // any alarm rule firing, over the USB state
 };
 
-static uint32_t blink_interval_ms = BLINK_NOT_MOUNTED;
-
-void led_blinking_task(void);
-void cdc_task(void);
+// set from the tinyusb callbacks in the USB service slice
+static volatile uint32_t blink_interval_ms = BLINK_NOT_MOUNTED;
 /* USER CODE END 0 */
 
 /**
@@ -112,6 +124,7 @@ int main(void)
   MX_ADC1_Init();
   MX_CRC_Init();
   MX_RTC_Init();
+  MX_TIM2_Init();
   MX_TIM5_Init();
   MX_SDIO_SD_Init();
   MX_FATFS_Init();
@@ -152,15 +165,29 @@ int main(void)
   USB_OTG_FS->GCCFG &= ~USB_OTG_GCCFG_VBUSBSEN;
   USB_OTG_FS->GCCFG &= ~USB_OTG_GCCFG_VBUSASEN;
 
-  tusb_init();
+  usb_service_start();
+
+  timebase_start();
+  alarm_init();
+
+#ifdef USE_FREERTOS
+  // the tasks take over from here, see rtos.c
+  rtos_start();
+#endif
+
+  logger_init();
+  acquisition_start();
   /* USER CODE END 2 */
 
   /* Infinite loop */
   /* USER CODE BEGIN WHILE */
   while (1) {
-    tud_task();
     led_blinking_task();
     cdc_task();
+    alarm_task();
+    stream_task();
+    logger_task();
+    drift_task();
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
@@ -247,24 +274,12 @@ void tud_resume_cb(void) {
 // USB CDC
 //--------------------------------------------------------------------+
 void cdc_task(void) {
-  // connected() check for DTR bit
-  // Most but not all terminal client set this when making connection
-  // if ( tud_cdc_connected() )
-  {
-    // connected and there are data available
-    if (tud_cdc_available()) {
-      // read data
-      char buf[64];
-      uint32_t count = tud_cdc_read(buf, sizeof(buf));
-      (void) count;
-
-      // Echo back
-      // Note: Skip echo by commenting out write() and write_flush()
-      // for throughput test e.g
-      //    $ dd if=/dev/zero of=/dev/ttyACM0 count=10000
-      tud_cdc_write(buf, count);
-      tud_cdc_write_flush();
-    }
+  // bytes the USB service slice took from the host
+  char buf[64];
+  uint32_t count = usb_cdc_receive(buf, sizeof(buf));
+
+  if (count) {
+    command_input(buf, count);
   }
 }
 
@@ -293,9 +308,11 @@ void led_blinking_task(void) {
   static uint32_t start_ms = 0;
   static bool led_state = false;
 
+  uint32_t interval_ms = alarm_active() ? BLINK_ALARM : blink_interval_ms;
+
   // Blink every interval ms
-  if (HAL_GetTick() - start_ms < blink_interval_ms) return; // not enough time
-  start_ms += blink_interval_ms;
+  if (HAL_GetTick() - start_ms < interval_ms) return; // not enough time
+  start_ms += interval_ms;
 
   HAL_GPIO_WritePin(LED_GPIO_Port, LED_Pin, led_state);
   led_state = 1 - led_state; // toggle
@@ -45,8 +45,8 @@ void MX_RTC_Init(void)
   */
   hrtc.Instance = RTC;
   hrtc.Init.HourFormat = RTC_HOURFORMAT_24;
-  hrtc.Init.AsynchPrediv = 127;
-  hrtc.Init.SynchPrediv = 255;
+  hrtc.Init.AsynchPrediv = 31;
+  hrtc.Init.SynchPrediv = 999;
   hrtc.Init.OutPut = RTC_OUTPUT_DISABLE;
   hrtc.Init.OutPutPolarity = RTC_OUTPUT_POLARITY_HIGH;
   hrtc.Init.OutPutType = RTC_OUTPUT_TYPE_OPENDRAIN;
@@ -56,7 +56,15 @@ void MX_RTC_Init(void)
   }
 
   /* USER CODE BEGIN Check_RTC_BKUP */
+  // the LSI stops without VDD, so a time kept on VBAT over a power cycle is stale
+  bool power_on = __HAL_RCC_GET_FLAG(RCC_FLAG_PORRST) || __HAL_RCC_GET_FLAG(RCC_FLAG_BORRST);
+  __HAL_RCC_CLEAR_RESET_FLAGS();
 
+  if (!power_on && HAL_RTCEx_BKUPRead(&hrtc, RTC_BKP_DR0) == RTC_BKUP_MAGIC) {
+    return;
+  }
+
+  HAL_RTCEx_BKUPWrite(&hrtc, RTC_BKP_DR0, 0);
   /* USER CODE END Check_RTC_BKUP */
 
   /** Initialize RTC and set the Time and Date
@@ -70,10 +78,10 @@ void MX_RTC_Init(void)
   {
     Error_Handler();
   }
-  sDate.WeekDay = RTC_WEEKDAY_FRIDAY;
-  sDate.Month = RTC_MONTH_MAY;
-  sDate.Date = 0x12;
-  sDate.Year = 0x99;
+  sDate.WeekDay = RTC_WEEKDAY_SATURDAY;
+  sDate.Month = RTC_MONTH_JANUARY;
+  sDate.Date = 0x1;
+  sDate.Year = 0x0;
 
   if (HAL_RTC_SetDate(&hrtc, &sDate, RTC_FORMAT_BCD) != HAL_OK)
   {
@@ -107,6 +115,12 @@ void HAL_RTC_MspInit(RTC_HandleTypeDef* rtcHandle)
     /* RTC clock enable */
     __HAL_RCC_RTC_ENABLE();
   /* USER CODE BEGIN RTC_MspInit 1 */
+    // restore the LSI trim of rtc_set_prescaler() before HAL_RTC_Init() applies it
+    uint32_t saved = HAL_RTCEx_BKUPRead(rtcHandle, RTC_BKP_DR1);
+
+    if ((saved >> 16) == RTC_BKUP_MAGIC) {
+      rtcHandle->Init.SynchPrediv = saved & RTC_PRER_PREDIV_S;
+    }
 
   /* USER CODE END RTC_MspInit 1 */
   }
@@ -129,5 +143,127 @@ void HAL_RTC_MspDeInit(RTC_HandleTypeDef* rtcHandle)
 }
 
 /* USER CODE BEGIN 1 */
+/* RTC year 0 is 2000 */
+#define RTC_EPOCH_2000  946684800UL
+#define RTC_EPOCH_2100  4102444800UL
+
+// days from civil, with March as the first month of the year
+static uint32_t rtc_days_from_civil(int32_t y, uint32_t m, uint32_t d) {
+  y -= m <= 2;
+  int32_t era = y / 400;
+  uint32_t yoe = (uint32_t)(y - era * 400);
+  uint32_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+  return era * 146097 + doe - 719468;
+}
+
+static void rtc_civil_from_days(uint32_t days, RTC_DateTypeDef *date) {
+  uint32_t z = days + 719468;
+  uint32_t era = z / 146097;
+  uint32_t doe = z - era * 146097;
+  uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  uint32_t mp = (5 * doy + 2) / 153;
+  uint32_t m = mp < 10 ? mp + 3 : mp - 9;
+  uint32_t y = yoe + era * 400 + (m <= 2);
+
+  date->Year = y - 2000;
+  date->Month = m;
+  date->Date = doy - (153 * mp + 2) / 5 + 1;
+  date->WeekDay = (days + 3) % 7 + 1;  // 1970-01-01 was a Thursday
+}
+
+/* time since 1970-01-01 in sub-second counter units, *hz of them per second */
+uint64_t rtc_get_units(uint32_t *hz) {
+  RTC_TimeTypeDef time;
+  RTC_DateTypeDef date;
+
+  // date must be read after time to unlock the shadow registers
+  HAL_RTC_GetTime(&hrtc, &time, RTC_FORMAT_BIN);
+  HAL_RTC_GetDate(&hrtc, &date, RTC_FORMAT_BIN);
+
+  uint32_t days = rtc_days_from_civil(2000 + date.Year, date.Month, date.Date);
+  uint64_t secs = (uint64_t)days * 86400 + time.Hours * 3600 + time.Minutes * 60 + time.Seconds;
+
+  *hz = time.SecondFraction + 1;
+
+  // the sub-second counter counts down; right after a shift it can be above
+  // SecondFraction, which means the second has not started yet
+  return secs * *hz + (int32_t)time.SecondFraction - (int32_t)time.SubSeconds;
+}
+
+/* milliseconds since 1970-01-01 */
+uint64_t rtc_get_unix_ms(void) {
+  uint32_t hz;
+  uint64_t units = rtc_get_units(&hz);
+
+  return units * 1000 / hz;
+}
+
+/* seconds since 1970-01-01 */
+uint32_t rtc_get_unix(void) {
+  return rtc_get_unix_ms() / 1000;
+}
+
+/* true once the host has set the clock and it kept running since */
+bool rtc_time_valid(void) {
+  return HAL_RTCEx_BKUPRead(&hrtc, RTC_BKP_DR0) == RTC_BKUP_MAGIC;
+}
+
+/* change the synchronous prescaler, kept across resets in RTC_BKP_DR1 */
+HAL_StatusTypeDef rtc_set_prescaler(uint32_t synch) {
+  HAL_StatusTypeDef ret;
+
+  hrtc.Init.SynchPrediv = synch;
+
+  if ((ret = HAL_RTC_Init(&hrtc)) != HAL_OK) {
+    return ret;
+  }
+
+  HAL_RTCEx_BKUPWrite(&hrtc, RTC_BKP_DR1, RTC_BKUP_MAGIC << 16 | synch);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef rtc_set_unix_ms(uint64_t ms) {
+  RTC_TimeTypeDef time = {0};
+  RTC_DateTypeDef date = {0};
+  uint32_t secs = ms / 1000;
+  uint32_t frac = ms % 1000;
+  HAL_StatusTypeDef ret;
+
+  if (ms / 1000 < RTC_EPOCH_2000 || ms / 1000 >= RTC_EPOCH_2100) {
+    return HAL_ERROR;
+  }
+
+  rtc_civil_from_days(secs / 86400, &date);
+  time.Hours = secs % 86400 / 3600;
+  time.Minutes = secs % 3600 / 60;
+  time.Seconds = secs % 60;
+  time.DayLightSaving = RTC_DAYLIGHTSAVING_NONE;
+  time.StoreOperation = RTC_STOREOPERATION_RESET;
+
+  if ((ret = HAL_RTC_SetTime(&hrtc, &time, RTC_FORMAT_BIN)) != HAL_OK) {
+    return ret;
+  }
+
+  if ((ret = HAL_RTC_SetDate(&hrtc, &date, RTC_FORMAT_BIN)) != HAL_OK) {
+    return ret;
+  }
+
+  // the calendar restarts at the top of the second; move it forward by the
+  // fraction, as one second ahead minus the rest of it
+  if (frac) {
+    uint32_t subfs = (1000 - frac) * (hrtc.Init.SynchPrediv + 1) / 1000;
+
+    if ((ret = HAL_RTCEx_SetSynchroShift(&hrtc, RTC_SHIFTADD1S_SET, subfs)) != HAL_OK) {
+      return ret;
+    }
+  }
+
+  HAL_RTCEx_BKUPWrite(&hrtc, RTC_BKP_DR0, RTC_BKUP_MAGIC);
+
+  return HAL_OK;
+}
 
 /* USER CODE END 1 */
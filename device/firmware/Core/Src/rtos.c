@@ -0,0 +1,152 @@
+/**
+  ******************************************************************************
+  * @file    rtos.c
+  * @brief   Task layout of the FreeRTOS build (make RTOS=1).
+  *
+  *          The superloop of the bare-metal build is split by what each part
+  *          waits on. The ADC DMA interrupt hands finished buffer halves to
+  *          the acquisition task through a stream buffer; that task
+  *          integrates and encodes them into the log block queue, which the
+  *          writer task drains to the card. tinyusb runs its own task and
+  *          blocks on its event queue. The LED, CDC commands and the RTC
+  *          drift estimate share a housekeeping task at the lowest priority.
+  *
+  *          Every interrupt keeps its bare-metal level, shifted below
+  *          configMAX_SYSCALL_INTERRUPT_PRIORITY so that it may call the
+  *          FromISR API; kernel critical sections mask none of them longer
+  *          than a few instructions.
+  ******************************************************************************
+  */
+#include <string.h>
+
+#include "rtos.h"
+#include "acquisition.h"
+#include "alarm.h"
+#include "drift.h"
+#include "logger.h"
+#include "stream.h"
+#include "usb_service.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+typedef struct {
+  const char *name;
+  TaskFunction_t entry;
+  uint16_t stack;
+  UBaseType_t prio;
+  TaskHandle_t handle;
+  configRUN_TIME_COUNTER_TYPE last;   // run time at the start of the window
+  uint32_t cpu_permille;
+} rtos_task_t;
+
+static void writer_task(void *arg);
+static void housekeeping_task(void *arg);
+
+static rtos_task_t tasks[] = {
+  { "acq", acquisition_task, RTOS_STACK_ACQUISITION, RTOS_PRIO_ACQUISITION },
+  { "usb", usb_service_task, RTOS_STACK_USB, RTOS_PRIO_USB },
+  { "writer", writer_task, RTOS_STACK_WRITER, RTOS_PRIO_WRITER },
+  { "house", housekeeping_task, RTOS_STACK_HOUSEKEEPING, RTOS_PRIO_HOUSEKEEPING },
+  { "idle" },
+};
+
+#define RTOS_TASKS (sizeof(tasks) / sizeof(tasks[0]))
+
+// interrupts that may call into the kernel
+static const IRQn_Type irqs[] = {
+  DMA2_Stream0_IRQn, ADC_IRQn, TIM5_IRQn, SDIO_IRQn, DMA2_Stream3_IRQn, DMA2_Stream6_IRQn, OTG_FS_IRQn,
+};
+
+static configRUN_TIME_COUNTER_TYPE window_start;
+static uint32_t window_start_ms;
+
+static void writer_task(void *arg) {
+  logger_init();
+
+  for (;;) {
+    logger_task();
+    vTaskDelay(pdMS_TO_TICKS(RTOS_WRITER_PERIOD_MS));
+  }
+}
+
+static void rtos_stats_update(void) {
+  configRUN_TIME_COUNTER_TYPE now = portGET_RUN_TIME_COUNTER_VALUE();
+  configRUN_TIME_COUNTER_TYPE span = now - window_start;
+
+  tasks[RTOS_TASKS - 1].handle = xTaskGetIdleTaskHandle();
+
+  for (uint32_t i = 0; i < RTOS_TASKS; i++) {
+    configRUN_TIME_COUNTER_TYPE run = ulTaskGetRunTimeCounter(tasks[i].handle);
+
+    tasks[i].cpu_permille = span ? (uint32_t)((run - tasks[i].last) * 1000 / span) : 0;
+    tasks[i].last = run;
+  }
+
+  window_start = now;
+}
+
+static void housekeeping_task(void *arg) {
+  for (;;) {
+    led_blinking_task();
+    cdc_task();
+    alarm_task();
+    stream_task();
+    drift_task();
+
+    if (HAL_GetTick() - window_start_ms >= RTOS_STATS_WINDOW_MS) {
+      window_start_ms = HAL_GetTick();
+      rtos_stats_update();
+    }
+
+    vTaskDelay(pdMS_TO_TICKS(RTOS_HOUSEKEEPING_PERIOD_MS));
+  }
+}
+
+void rtos_start(void) {
+  for (uint32_t i = 0; i < sizeof(irqs) / sizeof(irqs[0]); i++) {
+    uint32_t preempt, sub;
+
+    HAL_NVIC_GetPriority(irqs[i], NVIC_PRIORITYGROUP_4, &preempt, &sub);
+    HAL_NVIC_SetPriority(irqs[i], preempt + configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, sub);
+  }
+
+  for (uint32_t i = 0; i < RTOS_TASKS; i++) {
+    if (tasks[i].entry &&
+        xTaskCreate(tasks[i].entry, tasks[i].name, tasks[i].stack, NULL, tasks[i].prio, &tasks[i].handle) != pdPASS) {
+      Error_Handler();
+    }
+  }
+
+  window_start_ms = HAL_GetTick();
+  vTaskStartScheduler();
+
+  // only reached when the idle task could not be created
+  Error_Handler();
+}
+
+const char *rtos_task_name(uint32_t n) {
+  return n < RTOS_TASKS ? tasks[n].name : NULL;
+}
+
+bool rtos_task_stats(const char *name, uint32_t *stack_free, uint32_t *cpu_permille) {
+  for (uint32_t i = 0; i < RTOS_TASKS; i++) {
+    if (strcmp(name, tasks[i].name) != 0 || !tasks[i].handle) {
+      continue;
+    }
+
+    *stack_free = uxTaskGetStackHighWaterMark(tasks[i].handle);
+    *cpu_permille = tasks[i].cpu_permille;
+    return true;
+  }
+
+  return false;
+}
+
+void vApplicationStackOverflowHook(TaskHandle_t task, char *name) {
+  Error_Handler();
+}
+
+void vApplicationMallocFailedHook(void) {
+  Error_Handler();
+}
@@ -23,6 +23,16 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "tusb.h"
+
+#include "latency.h"
+#include "usb_service.h"
+
+#ifdef USE_FREERTOS
+#include "FreeRTOS.h"
+#include "task.h"
+
+void xPortSysTickHandler(void);
+#endif
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -144,19 +154,6 @@ void UsageFault_Handler(void)
   }
 }
 
-/**
-  * @brief This function handles System service call via SWI instruction.
-  */
-void SVC_Handler(void)
-{
-  /* USER CODE BEGIN SVCall_IRQn 0 */
-
-  /* USER CODE END SVCall_IRQn 0 */
-  /* USER CODE BEGIN SVCall_IRQn 1 */
-
-  /* USER CODE END SVCall_IRQn 1 */
-}
-
 /**
   * @brief This function handles Debug monitor.
   */
@@ -170,19 +167,6 @@ void DebugMon_Handler(void)
   /* USER CODE END DebugMonitor_IRQn 1 */
 }
 
-/**
-  * @brief This function handles Pendable request for system service.
-  */
-void PendSV_Handler(void)
-{
-  /* USER CODE BEGIN PendSV_IRQn 0 */
-
-  /* USER CODE END PendSV_IRQn 0 */
-  /* USER CODE BEGIN PendSV_IRQn 1 */
-
-  /* USER CODE END PendSV_IRQn 1 */
-}
-
 /**
   * @brief This function handles System tick timer.
   */
@@ -193,7 +177,13 @@ void SysTick_Handler(void)
   /* USER CODE END SysTick_IRQn 0 */
   HAL_IncTick();
   /* USER CODE BEGIN SysTick_IRQn 1 */
-
+#ifdef USE_FREERTOS
+  if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+    xPortSysTickHandler();
+  }
+#else
+  usb_service_kick();
+#endif
   /* USER CODE END SysTick_IRQn 1 */
 }
 
@@ -224,11 +214,11 @@ void ADC_IRQHandler(void)
 void SDIO_IRQHandler(void)
 {
   /* USER CODE BEGIN SDIO_IRQn 0 */
-
+  uint32_t enter = latency_enter();
   /* USER CODE END SDIO_IRQn 0 */
   HAL_SD_IRQHandler(&hsd);
   /* USER CODE BEGIN SDIO_IRQn 1 */
-
+  latency_exit(LATENCY_SDIO, enter);
   /* USER CODE END SDIO_IRQn 1 */
 }
 
@@ -252,11 +242,12 @@ void TIM5_IRQHandler(void)
 void DMA2_Stream0_IRQHandler(void)
 {
   /* USER CODE BEGIN DMA2_Stream0_IRQn 0 */
-
+  uint32_t enter = latency_enter();
+  latency_event(LATENCY_ADC_DMA, TIM5->CCR1, enter);
   /* USER CODE END DMA2_Stream0_IRQn 0 */
   HAL_DMA_IRQHandler(&hdma_adc1);
   /* USER CODE BEGIN DMA2_Stream0_IRQn 1 */
-
+  latency_exit(LATENCY_ADC_DMA, enter);
   /* USER CODE END DMA2_Stream0_IRQn 1 */
 }
 
@@ -266,11 +257,11 @@ void DMA2_Stream0_IRQHandler(void)
 void DMA2_Stream3_IRQHandler(void)
 {
   /* USER CODE BEGIN DMA2_Stream3_IRQn 0 */
-
+  uint32_t enter = latency_enter();
   /* USER CODE END DMA2_Stream3_IRQn 0 */
   HAL_DMA_IRQHandler(&hdma_sdio_rx);
   /* USER CODE BEGIN DMA2_Stream3_IRQn 1 */
-
+  latency_exit(LATENCY_SD_DMA, enter);
   /* USER CODE END DMA2_Stream3_IRQn 1 */
 }
 
@@ -280,13 +271,16 @@ void DMA2_Stream3_IRQHandler(void)
 void OTG_FS_IRQHandler(void)
 {
   /* USER CODE BEGIN OTG_FS_IRQn 0 */
+  uint32_t enter = latency_enter();
   tud_int_handler(BOARD_TUD_RHPORT);
+  usb_service_kick();
 
   #ifdef DISABLED
   /* USER CODE END OTG_FS_IRQn 0 */
   HAL_PCD_IRQHandler();
   /* USER CODE BEGIN OTG_FS_IRQn 1 */
   #endif /* ifdef DISABLED */
+  latency_exit(LATENCY_USB, enter);
   /* USER CODE END OTG_FS_IRQn 1 */
 }
 
@@ -296,11 +290,11 @@ void OTG_FS_IRQHandler(void)
 void DMA2_Stream6_IRQHandler(void)
 {
   /* USER CODE BEGIN DMA2_Stream6_IRQn 0 */
-
+  uint32_t enter = latency_enter();
   /* USER CODE END DMA2_Stream6_IRQn 0 */
   HAL_DMA_IRQHandler(&hdma_sdio_tx);
   /* USER CODE BEGIN DMA2_Stream6_IRQn 1 */
-
+  latency_exit(LATENCY_SD_DMA, enter);
   /* USER CODE END DMA2_Stream6_IRQn 1 */
 }
 
@@ -0,0 +1,107 @@
+/**
+  ******************************************************************************
+  * @file    stream.c
+  * @brief   Live sample stream to the host over the CDC port.
+  *
+  *          While enabled, every logged-rate sample is converted to physical
+  *          units in the acquisition path and queued in a small ring. The
+  *          command context sends them as unsolicited lines,
+  *
+  *          !S <sample number> <HV V> <HV A> <LV V> <die C>
+  *
+  *          leaving STREAM_TX_RESERVE bytes of the CDC transmit ring to the
+  *          replies. Sample numbers count from boot, so the host sees any
+  *          sample lost to a full ring or a slow port as a gap.
+  ******************************************************************************
+  */
+#include <stdio.h>
+
+#include "stream.h"
+#include "acquisition.h"
+#include "autozero.h"
+#include "command.h"
+#include "thermal.h"
+#include "usb_service.h"
+
+_Static_assert((STREAM_DEPTH & (STREAM_DEPTH - 1)) == 0, "STREAM_DEPTH must be a power of two");
+
+typedef struct {
+  uint32_t number;
+  float voltage;
+  float current;
+  float lv_voltage;
+  float celsius;
+} stream_sample_t;
+
+static stream_sample_t ring[STREAM_DEPTH];
+static volatile uint32_t head, tail;
+static volatile bool enabled;
+static volatile uint32_t dropped;
+static uint32_t number;
+
+void stream_enable(bool on) {
+  if (on && !enabled) {
+    // the acquisition only adds samples; starting over from its side is safe
+    tail = head;
+    dropped = 0;
+  }
+
+  enabled = on;
+}
+
+bool stream_enabled(void) {
+  return enabled;
+}
+
+uint32_t stream_dropped(void) {
+  return dropped;
+}
+
+void stream_feed(const uint16_t sample[LOG_CH_COUNT]) {
+  uint32_t n = number++;
+
+  if (!enabled) {
+    return;
+  }
+
+  uint32_t h = head;
+
+  if (h - tail >= STREAM_DEPTH) {
+    dropped++;
+    return;
+  }
+
+  stream_sample_t *s = &ring[h & (STREAM_DEPTH - 1)];
+  float ref = sample[LOG_CH_5V_REF] ? (float)sample[LOG_CH_5V_REF] : 1.0f;
+
+  s->number = n;
+  s->voltage = (float)sample[LOG_CH_HV_VOLTAGE] * CAL_HV_VOLTAGE_SCALE;
+  s->current = ((float)sample[LOG_CH_HV_CURRENT] / ref - autozero_zero()) * CAL_HV_CURRENT_SPAN;
+  s->lv_voltage = (float)sample[LOG_CH_LV_VOLTAGE] * CAL_LV_VOLTAGE_SCALE;
+  s->celsius = thermal_celsius();
+
+  __DMB();
+  head = h + 1;
+}
+
+void stream_task(void) {
+  while (tail != head) {
+    const stream_sample_t *s = &ring[tail & (STREAM_DEPTH - 1)];
+    char v[16], a[16], lv[16], c[16];
+    char buf[80];
+
+    command_fixed(v, sizeof(v), s->voltage);
+    command_fixed(a, sizeof(a), s->current);
+    command_fixed(lv, sizeof(lv), s->lv_voltage);
+    command_fixed(c, sizeof(c), s->celsius);
+
+    int len = snprintf(buf, sizeof(buf), "!S %lu %s %s %s %s\n", (unsigned long)s->number, v, a, lv, c);
+
+    // the rest waits for the port to drain
+    if (len < 0 || usb_cdc_free() < (uint32_t)len + STREAM_TX_RESERVE || !usb_cdc_send(buf, len)) {
+      return;
+    }
+
+    tail++;
+  }
+}
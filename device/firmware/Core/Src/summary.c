@@ -0,0 +1,221 @@
+/**
+  ******************************************************************************
+  * @file    summary.c
+  * @brief   Multi-resolution min/max/mean index built while logging.
+  *
+  *          Level 0 aggregates raw samples into 1 s buckets; every higher
+  *          level merges a fixed number of buckets of the level below. Each
+  *          level fills its own summary block, which the logger writes inline
+  *          as soon as it is full. On segment close the partial buckets are
+  *          flushed and a directory of all summary blocks ends the file, so a
+  *          viewer can draw an overview from a few kilobytes.
+  ******************************************************************************
+  */
+#include <string.h>
+
+#include "summary.h"
+#include "acquisition.h"
+#include "codec.h"
+
+// the logger drains after every sample block that completes a summary block,
+// so one sample block must not be able to fill the spare buffer as well
+_Static_assert(CODEC_BLOCK_MAX_SAMPLES / ACQ_SAMPLE_RATE + 1 < LOG_SUMMARIES_PER_BLOCK, "summary block overrun");
+
+static const uint16_t periods[LOG_SUMMARY_LEVELS] = LOG_SUMMARY_PERIODS;
+
+typedef struct {
+  log_summary_t cur;            // bucket being accumulated
+  uint32_t sum[LOG_CH_COUNT];
+  uint32_t parts;               // child buckets merged into cur
+  uint32_t bucket;              // bucket number of cur
+  uint32_t fill;                // block being filled
+  bool ready[2];                // block is full and waiting for the logger
+  log_block_t block[2];
+} level_t;
+
+static level_t levels[LOG_SUMMARY_LEVELS];
+
+static uint32_t directory[SUMMARY_MAX_BLOCKS];
+static uint32_t written;
+
+static void level_begin(level_t *lv) {
+  memset(&lv->cur, 0, sizeof(lv->cur));
+  memset(lv->sum, 0, sizeof(lv->sum));
+  memset(lv->cur.min, 0xFF, sizeof(lv->cur.min));
+  lv->parts = 0;
+}
+
+static void level_clear_block(uint32_t l, uint32_t b) {
+  level_t *lv = &levels[l];
+
+  memset(&lv->block[b], 0, sizeof(log_block_t));
+  lv->block[b].hdr.type = LOG_TYPE_SUMMARY;
+  lv->block[b].summary.level = l;
+  lv->block[b].summary.period = periods[l];
+  lv->ready[b] = false;
+}
+
+// close the current bucket of level l and merge it into the level above
+static void level_emit(uint32_t l) {
+  level_t *lv = &levels[l];
+  log_summary_t *cur = &lv->cur;
+
+  if (cur->count == 0) {
+    return;
+  }
+
+  for (uint32_t ch = 0; ch < LOG_CH_COUNT; ch++) {
+    cur->mean[ch] = (lv->sum[ch] + cur->count / 2) / cur->count;
+  }
+
+  // both buffers full only if the logger stopped draining; drop the bucket
+  if (!lv->ready[lv->fill]) {
+    log_block_t *block = &lv->block[lv->fill];
+
+    if (block->hdr.count == 0) {
+      block->summary.first = lv->bucket;
+    }
+
+    block->summary.summary[block->hdr.count++] = *cur;
+
+    if (block->hdr.count == LOG_SUMMARIES_PER_BLOCK) {
+      lv->ready[lv->fill] = true;
+      lv->fill ^= 1;
+    }
+  }
+
+  if (l + 1 < LOG_SUMMARY_LEVELS) {
+    level_t *up = &levels[l + 1];
+
+    if (up->cur.count == 0) {
+      up->cur.block = cur->block;
+    }
+
+    for (uint32_t ch = 0; ch < LOG_CH_COUNT; ch++) {
+      if (cur->min[ch] < up->cur.min[ch]) {
+        up->cur.min[ch] = cur->min[ch];
+      }
+      if (cur->max[ch] > up->cur.max[ch]) {
+        up->cur.max[ch] = cur->max[ch];
+      }
+      up->sum[ch] += lv->sum[ch];
+    }
+
+    up->cur.count += cur->count;
+
+    if (++up->parts == periods[l + 1] / periods[l]) {
+      level_emit(l + 1);
+    }
+  }
+
+  lv->bucket++;
+  level_begin(lv);
+}
+
+void summary_reset(void) {
+  for (uint32_t l = 0; l < LOG_SUMMARY_LEVELS; l++) {
+    levels[l].bucket = 0;
+    levels[l].fill = 0;
+    level_begin(&levels[l]);
+    level_clear_block(l, 0);
+    level_clear_block(l, 1);
+  }
+
+  written = 0;
+}
+
+void summary_feed(const uint16_t (*sample)[LOG_CH_COUNT], uint32_t n, uint32_t index) {
+  level_t *lv = &levels[0];
+  const uint32_t span = periods[0] * ACQ_SAMPLE_RATE;
+
+  for (uint32_t i = 0; i < n; i++) {
+    if (lv->cur.count == 0) {
+      lv->cur.block = index;
+    }
+
+    for (uint32_t ch = 0; ch < LOG_CH_COUNT; ch++) {
+      uint16_t v = sample[i][ch];
+
+      if (v < lv->cur.min[ch]) {
+        lv->cur.min[ch] = v;
+      }
+      if (v > lv->cur.max[ch]) {
+        lv->cur.max[ch] = v;
+      }
+      lv->sum[ch] += v;
+    }
+
+    if (++lv->cur.count == span) {
+      level_emit(0);
+    }
+  }
+}
+
+void summary_flush(void) {
+  for (uint32_t l = 0; l < LOG_SUMMARY_LEVELS; l++) {
+    level_emit(l);
+  }
+
+  for (uint32_t l = 0; l < LOG_SUMMARY_LEVELS; l++) {
+    level_t *lv = &levels[l];
+
+    if (lv->block[lv->fill].hdr.count) {
+      lv->ready[lv->fill] = true;
+    }
+  }
+}
+
+bool summary_full(void) {
+  return written + 2 * LOG_SUMMARY_LEVELS >= SUMMARY_MAX_BLOCKS;
+}
+
+log_block_t *summary_take(void) {
+  for (uint32_t l = 0; l < LOG_SUMMARY_LEVELS; l++) {
+    level_t *lv = &levels[l];
+
+    // the spare buffer holds the older block
+    if (lv->ready[lv->fill ^ 1]) {
+      return &lv->block[lv->fill ^ 1];
+    }
+    if (lv->ready[lv->fill]) {
+      return &lv->block[lv->fill];
+    }
+  }
+
+  return NULL;
+}
+
+void summary_written(log_block_t *block, uint32_t index) {
+  for (uint32_t l = 0; l < LOG_SUMMARY_LEVELS; l++) {
+    for (uint32_t b = 0; b < 2; b++) {
+      if (block == &levels[l].block[b]) {
+        if (written < SUMMARY_MAX_BLOCKS) {
+          directory[written++] = index;
+        }
+        level_clear_block(l, b);
+        return;
+      }
+    }
+  }
+}
+
+uint32_t summary_directory_blocks(void) {
+  uint32_t n = (written + LOG_DIRECTORY_PER_BLOCK - 1) / LOG_DIRECTORY_PER_BLOCK;
+  return n ? n : 1;
+}
+
+void summary_directory(log_block_t *block, uint32_t n) {
+  uint32_t first = n * LOG_DIRECTORY_PER_BLOCK;
+  uint32_t count = written > first ? written - first : 0;
+
+  if (count > LOG_DIRECTORY_PER_BLOCK) {
+    count = LOG_DIRECTORY_PER_BLOCK;
+  }
+
+  memset(block, 0, sizeof(log_block_t));
+  block->hdr.type = LOG_TYPE_DIRECTORY;
+  block->hdr.count = count;
+  block->directory.index = n;
+  block->directory.total = summary_directory_blocks();
+  memcpy(block->directory.block, &directory[first], count * sizeof(uint32_t));
+}
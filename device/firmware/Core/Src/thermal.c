@@ -0,0 +1,121 @@
+/**
+  ******************************************************************************
+  * @file    thermal.c
+  * @brief   Die temperature from the injected sensor conversion, and the load policy on it.
+  *
+  *          The temperature sensor changes far slower than the HV channels,
+  *          so it sits in the injected group rather than the regular scan.
+  *          One conversion is started per DMA half by software and slots in
+  *          between two regular scans; its result is read at the next half.
+  *          The factory TS_CAL points (30 C and 110 C at 3.3 V) turn the code
+  *          into degrees.
+  *
+  *          Approaching the 80 C operating limit, the policy first suspends
+  *          the transient capture and then lowers the conversion rate, each
+  *          level with hysteresis. Every level change is logged as an event.
+  ******************************************************************************
+  */
+#include <string.h>
+
+#include "thermal.h"
+#include "acquisition.h"
+#include "adc.h"
+#include "capture.h"
+#include "logger.h"
+#include "stm32f4xx_ll_adc.h"
+
+// share of a new reading in the smoothed temperature
+#define THERMAL_SMOOTHING     0.05f
+
+static const float thresholds[THERMAL_LEVELS] = {
+  [THERMAL_WARM] = THERMAL_WARM_C,
+  [THERMAL_HOT] = THERMAL_HOT_C,
+};
+
+static bool converting;
+static volatile uint16_t code;
+static volatile float celsius;
+static bool celsius_valid;
+static volatile thermal_level_t level = THERMAL_NORMAL;
+static uint32_t changes;
+
+/* last level change for the log; an older one not taken yet is overwritten */
+static logger_event_t change_event;
+
+static float thermal_convert(uint32_t raw) {
+  int32_t cal1 = *TEMPSENSOR_CAL1_ADDR;
+  int32_t cal2 = *TEMPSENSOR_CAL2_ADDR;
+
+  if (cal2 > cal1 && cal2 != 0xFFFF) {
+    return TEMPSENSOR_CAL1_TEMP +
+           ((int32_t)raw - cal1) * (float)(TEMPSENSOR_CAL2_TEMP - TEMPSENSOR_CAL1_TEMP) / (cal2 - cal1);
+  }
+
+  return 25.0f + ((float)raw * (TEMPSENSOR_CAL_VREFANALOG / 1000.0f) / 4096 - THERMAL_V25) / THERMAL_SLOPE_V_C;
+}
+
+static void thermal_apply(thermal_level_t next, uint64_t time) {
+  capture_suspend(next >= THERMAL_WARM);
+  acquisition_throttle(next >= THERMAL_HOT);
+
+  log_event_t event;
+
+  memset(&event, 0, sizeof(event));
+  event.kind = LOG_EVENT_THERMAL;
+  event.cause = next;
+  event.number = changes++;
+  event.value = celsius;
+  logger_event_post(&change_event, &event, time);
+
+  level = next;
+}
+
+static void thermal_policy(uint64_t time) {
+  thermal_level_t next = level;
+
+  while (next + 1 < THERMAL_LEVELS && celsius >= thresholds[next + 1]) {
+    next++;
+  }
+  while (next > THERMAL_NORMAL && celsius < thresholds[next] - THERMAL_HYSTERESIS_C) {
+    next--;
+  }
+
+  if (next != level) {
+    thermal_apply(next, time);
+  }
+}
+
+void thermal_service(uint64_t time) {
+  if (converting) {
+    if (!__HAL_ADC_GET_FLAG(&hadc1, ADC_FLAG_JEOC)) {
+      return;
+    }
+
+    code = HAL_ADCEx_InjectedGetValue(&hadc1, ADC_INJECTED_RANK_1);
+
+    float c = thermal_convert(code);
+    celsius = celsius_valid ? celsius + (c - celsius) * THERMAL_SMOOTHING : c;
+    celsius_valid = true;
+
+    thermal_policy(time);
+  }
+
+  // no external trigger is set for the injected group, so this starts it right away
+  converting = HAL_ADCEx_InjectedStart(&hadc1) == HAL_OK;
+}
+
+uint16_t thermal_code(void) {
+  return code;
+}
+
+float thermal_celsius(void) {
+  return celsius;
+}
+
+thermal_level_t thermal_level(void) {
+  return level;
+}
+
+bool thermal_take(log_block_t *block) {
+  return logger_event_take(&change_event, block);
+}
@@ -0,0 +1,59 @@
+/**
+  ******************************************************************************
+  * @file    timebase.c
+  * @brief   64-bit sample clock from the free-running TIM5 counter.
+  *
+  *          TIM5 counts the 84 MHz timer clock and its channel 1 captures the
+  *          counter on TRC, which is routed to TIM2 TRGO (ITR0). Every ADC
+  *          trigger therefore latches its own timestamp in hardware, with no
+  *          interrupt latency in it. The 32-bit counter wraps every 51 s; it
+  *          is extended by tracking the last extended value, which is
+  *          refreshed by every sample block long before that.
+  ******************************************************************************
+  */
+#include "timebase.h"
+#include "tim.h"
+
+static uint64_t last;
+
+// extend a counter value taken within +-2^31 ticks of the last one
+static uint64_t timebase_extend(uint32_t value) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  int32_t delta = (int32_t)(value - (uint32_t)last);
+  uint64_t ext = last + (int64_t)delta;
+
+  // captures may be older than a value read since; never step back
+  if (delta > 0) {
+    last = ext;
+  }
+
+  __set_PRIMASK(primask);
+  return ext;
+}
+
+void timebase_start(void) {
+  if (HAL_TIM_IC_Start(&htim5, TIM_CHANNEL_1) != HAL_OK) {
+    Error_Handler();
+  }
+}
+
+uint32_t timebase_hz(void) {
+  // APB1 timers run at twice PCLK1 whenever the APB1 prescaler is not 1
+  uint32_t pclk = HAL_RCC_GetPCLK1Freq();
+  return (RCC->CFGR & RCC_CFGR_PPRE1_2) ? pclk * 2 : pclk;
+}
+
+uint32_t timebase_sample_ticks(void) {
+  // TIM2 shares the APB1 timer clock, so this is exact
+  return (htim2.Init.Prescaler + 1) * (htim2.Init.Period + 1);
+}
+
+uint64_t timebase_now(void) {
+  return timebase_extend(__HAL_TIM_GET_COUNTER(&htim5));
+}
+
+uint64_t timebase_capture(void) {
+  return timebase_extend(HAL_TIM_ReadCapturedValue(&htim5, TIM_CHANNEL_1));
+}
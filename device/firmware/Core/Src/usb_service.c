@@ -0,0 +1,198 @@
+/**
+  ******************************************************************************
+  * @file    usb_service.c
+  * @brief   tinyusb device task run from a PendSV slice instead of the main loop.
+  *
+  *          With OPT_OS_NONE tinyusb only queues events in its interrupt and
+  *          leaves the work to tud_task(). Called from the main loop, that
+  *          work waited behind every SD transfer and segment switch. Here
+  *          tud_task() runs in PendSV, below every hardware interrupt and
+  *          above the main loop, pended by the USB interrupt itself and by
+  *          every SysTick, so the queue is serviced at least once per
+  *          millisecond whatever the logger is doing.
+  *
+  *          All tinyusb calls stay inside the slice. The main loop exchanges
+  *          CDC bytes with it through two single-producer rings, so commands
+  *          still run in main loop context next to the state they touch.
+  *
+  *          The FreeRTOS build has the kernel on PendSV and runs the same
+  *          service as usb_service_task(), woken by tinyusb's own queue or
+  *          the same millisecond period; the rings then connect it to the
+  *          housekeeping task.
+  ******************************************************************************
+  */
+#include "usb_service.h"
+#include "latency.h"
+#include "tusb.h"
+
+_Static_assert((USB_CDC_RX_LEN & (USB_CDC_RX_LEN - 1)) == 0, "USB_CDC_RX_LEN must be a power of two");
+_Static_assert((USB_CDC_TX_LEN & (USB_CDC_TX_LEN - 1)) == 0, "USB_CDC_TX_LEN must be a power of two");
+
+static volatile bool started;
+
+#ifndef USE_FREERTOS
+// TIM5 at the first kick since the last slice, for the latency statistics
+static volatile bool kicked;
+static volatile uint32_t kicked_at;
+#endif
+
+// free-running indices; head is owned by the producer, tail by the consumer
+static char rx[USB_CDC_RX_LEN];
+static volatile uint32_t rx_head, rx_tail;
+
+static char tx[USB_CDC_TX_LEN];
+static volatile uint32_t tx_head, tx_tail;
+
+void usb_service_start(void) {
+  // tinyusb enables its interrupt without touching the priority
+  HAL_NVIC_SetPriority(OTG_FS_IRQn, IRQ_PRIORITY_USB, 0);
+
+  tusb_init();
+  started = true;
+}
+
+void usb_service_kick(void) {
+#ifndef USE_FREERTOS
+  if (!started) {
+    return;
+  }
+
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  if (!kicked) {
+    kicked = true;
+    kicked_at = latency_enter();
+  }
+
+  SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+  __set_PRIMASK(primask);
+#endif
+}
+
+// host to rx ring; what does not fit stays in the tinyusb FIFO and holds off the host
+static void usb_service_rx(void) {
+  uint32_t head = rx_head;
+  uint32_t room = USB_CDC_RX_LEN - (head - rx_tail);
+
+  while (room && tud_cdc_available()) {
+    uint32_t idx = head & (USB_CDC_RX_LEN - 1);
+    uint32_t n = room < USB_CDC_RX_LEN - idx ? room : USB_CDC_RX_LEN - idx;
+
+    n = tud_cdc_read(&rx[idx], n);
+    if (!n) {
+      break;
+    }
+
+    head += n;
+    room -= n;
+  }
+
+  __DMB();
+  rx_head = head;
+}
+
+// tx ring to host, as far as the tinyusb FIFO takes it
+static void usb_service_tx(void) {
+  uint32_t tail = tx_tail;
+  uint32_t head = tx_head;
+
+  if (tail == head) {
+    return;
+  }
+
+  // nobody listening; keep the ring from filling up with stale replies
+  if (!tud_mounted()) {
+    tx_tail = head;
+    return;
+  }
+
+  while (tail != head) {
+    uint32_t idx = tail & (USB_CDC_TX_LEN - 1);
+    uint32_t n = head - tail < USB_CDC_TX_LEN - idx ? head - tail : USB_CDC_TX_LEN - idx;
+
+    n = tud_cdc_write(&tx[idx], n);
+    if (!n) {
+      break;
+    }
+
+    tail += n;
+  }
+
+  tud_cdc_write_flush();
+  tx_tail = tail;
+}
+
+#ifdef USE_FREERTOS
+void usb_service_task(void *arg) {
+  for (;;) {
+    tud_task_ext(USB_SERVICE_INTERVAL_MS, false);
+    usb_service_rx();
+    usb_service_tx();
+  }
+}
+#else
+void usb_service_run(void) {
+  uint32_t enter = latency_enter();
+
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  uint32_t event = kicked_at;
+  kicked = false;
+  __set_PRIMASK(primask);
+
+  latency_event(LATENCY_USB_SERVICE, event, enter);
+
+  tud_task();
+  usb_service_rx();
+  usb_service_tx();
+
+  latency_exit(LATENCY_USB_SERVICE, enter);
+}
+
+void PendSV_Handler(void) {
+  usb_service_run();
+}
+#endif
+
+uint32_t usb_cdc_receive(char *buf, uint32_t len) {
+  uint32_t tail = rx_tail;
+  uint32_t n = 0;
+
+  __DMB();
+
+  while (n < len && tail != rx_head) {
+    buf[n++] = rx[tail++ & (USB_CDC_RX_LEN - 1)];
+  }
+
+  rx_tail = tail;
+
+  if (n) {
+    // room again for what the host may be holding back
+    usb_service_kick();
+  }
+
+  return n;
+}
+
+bool usb_cdc_send(const char *buf, uint32_t len) {
+  uint32_t head = tx_head;
+
+  if (USB_CDC_TX_LEN - (head - tx_tail) < len) {
+    return false;
+  }
+
+  for (uint32_t i = 0; i < len; i++) {
+    tx[head++ & (USB_CDC_TX_LEN - 1)] = buf[i];
+  }
+
+  __DMB();
+  tx_head = head;
+
+  usb_service_kick();
+  return true;
+}
+
+uint32_t usb_cdc_free(void) {
+  return USB_CDC_TX_LEN - (tx_head - tx_tail);
+}
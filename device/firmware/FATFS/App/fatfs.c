@@ -50,5 +50,29 @@ DWORD get_fattime(void)
 }
 
 /* USER CODE BEGIN Application */
+#if _FS_REENTRANT
+/* volume lock of the FreeRTOS build; the CMSIS-OS samples in option/syscall.c are not linked */
+int ff_cre_syncobj(BYTE vol, _SYNC_t *sobj)
+{
+  *sobj = xSemaphoreCreateMutex();
+  return *sobj != NULL;
+}
+
+int ff_del_syncobj(_SYNC_t sobj)
+{
+  vSemaphoreDelete(sobj);
+  return 1;
+}
+
+int ff_req_grant(_SYNC_t sobj)
+{
+  return xSemaphoreTake(sobj, _FS_TIMEOUT) == pdTRUE;
+}
+
+void ff_rel_grant(_SYNC_t sobj)
+{
+  xSemaphoreGive(sobj);
+}
+#endif
 
 /* USER CODE END Application */
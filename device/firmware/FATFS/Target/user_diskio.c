@@ -35,14 +35,101 @@
 /* Includes ------------------------------------------------------------------*/
 #include <string.h>
 #include "ff_gen_drv.h"
+#include "sdio.h"
+
+#ifdef USE_FREERTOS
+#include "FreeRTOS.h"
+#include "task.h"
+#endif
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
+/* SD transfer timeout in ms */
+#define SD_TIMEOUT 1000
+
+/* let lower priority tasks run while the card is busy */
+#ifdef USE_FREERTOS
+#define SD_IDLE() vTaskDelay(1)
+#else
+#define SD_IDLE()
+#endif
 
 /* Private variables ---------------------------------------------------------*/
 /* Disk status */
 static volatile DSTATUS Stat = STA_NOINIT;
 
+/* DMA completion flags set from the SDIO interrupt */
+static volatile uint8_t WriteStatus = 0, ReadStatus = 0, TransferError = 0;
+
+/* Bounce buffer for sectors that are not word aligned (e.g. FATFS.win).
+ * Aligned buffers such as the log queue go to the SDIO DMA untouched. */
+static uint32_t scratch[BLOCKSIZE / 4];
+
+static DRESULT SD_WaitTransfer(volatile uint8_t *done)
+{
+  uint32_t start = HAL_GetTick();
+
+  while (!*done && !TransferError) {
+    if (HAL_GetTick() - start >= SD_TIMEOUT) {
+      return RES_ERROR;
+    }
+    SD_IDLE();
+  }
+
+  if (TransferError) {
+    return RES_ERROR;
+  }
+
+  /* wait until the card finished programming before the next command */
+  while (HAL_SD_GetCardState(&hsd) != HAL_SD_CARD_TRANSFER) {
+    if (HAL_GetTick() - start >= SD_TIMEOUT) {
+      return RES_ERROR;
+    }
+    SD_IDLE();
+  }
+
+  return RES_OK;
+}
+
+static DRESULT SD_ReadDMA(BYTE *buff, DWORD sector, UINT count)
+{
+  ReadStatus = 0;
+  TransferError = 0;
+
+  if (HAL_SD_ReadBlocks_DMA(&hsd, buff, sector, count) != HAL_OK) {
+    return RES_ERROR;
+  }
+
+  return SD_WaitTransfer(&ReadStatus);
+}
+
+static DRESULT SD_WriteDMA(const BYTE *buff, DWORD sector, UINT count)
+{
+  WriteStatus = 0;
+  TransferError = 0;
+
+  if (HAL_SD_WriteBlocks_DMA(&hsd, (uint8_t *)buff, sector, count) != HAL_OK) {
+    return RES_ERROR;
+  }
+
+  return SD_WaitTransfer(&WriteStatus);
+}
+
+void HAL_SD_TxCpltCallback(SD_HandleTypeDef *hsd)
+{
+  WriteStatus = 1;
+}
+
+void HAL_SD_RxCpltCallback(SD_HandleTypeDef *hsd)
+{
+  ReadStatus = 1;
+}
+
+void HAL_SD_ErrorCallback(SD_HandleTypeDef *hsd)
+{
+  TransferError = 1;
+}
+
 /* USER CODE END DECL */
 
 /* Private function prototypes -----------------------------------------------*/
@@ -81,7 +168,11 @@ DSTATUS USER_initialize (
 )
 {
   /* USER CODE BEGIN INIT */
+    /* the card is brought up by MX_SDIO_SD_Init() */
     Stat = STA_NOINIT;
+    if (HAL_SD_GetCardState(&hsd) == HAL_SD_CARD_TRANSFER) {
+      Stat &= ~STA_NOINIT;
+    }
     return Stat;
   /* USER CODE END INIT */
 }
@@ -97,6 +188,9 @@ DSTATUS USER_status (
 {
   /* USER CODE BEGIN STATUS */
     Stat = STA_NOINIT;
+    if (HAL_SD_GetCardState(&hsd) == HAL_SD_CARD_TRANSFER) {
+      Stat &= ~STA_NOINIT;
+    }
     return Stat;
   /* USER CODE END STATUS */
 }
@@ -117,6 +211,16 @@ DRESULT USER_read (
 )
 {
   /* USER CODE BEGIN READ */
+    if (((uint32_t)buff & 3) == 0) {
+      return SD_ReadDMA(buff, sector, count);
+    }
+
+    for (UINT i = 0; i < count; i++) {
+      if (SD_ReadDMA((BYTE *)scratch, sector + i, 1) != RES_OK) {
+        return RES_ERROR;
+      }
+      memcpy(buff + i * BLOCKSIZE, scratch, BLOCKSIZE);
+    }
     return RES_OK;
   /* USER CODE END READ */
 }
@@ -138,7 +242,17 @@ DRESULT USER_write (
 )
 {
   /* USER CODE BEGIN WRITE */
-  /* USER CODE HERE */
+    /* whole-sector writes from aligned memory go straight to the SDIO DMA */
+    if (((uint32_t)buff & 3) == 0) {
+      return SD_WriteDMA(buff, sector, count);
+    }
+
+    for (UINT i = 0; i < count; i++) {
+      memcpy(scratch, buff + i * BLOCKSIZE, BLOCKSIZE);
+      if (SD_WriteDMA((BYTE *)scratch, sector + i, 1) != RES_OK) {
+        return RES_ERROR;
+      }
+    }
     return RES_OK;
   /* USER CODE END WRITE */
 }
@@ -160,6 +274,40 @@ DRESULT USER_ioctl (
 {
   /* USER CODE BEGIN IOCTL */
     DRESULT res = RES_ERROR;
+    HAL_SD_CardInfoTypeDef info;
+
+    if (Stat & STA_NOINIT) {
+      return RES_NOTRDY;
+    }
+
+    switch (cmd) {
+      /* every write already waits for the card to leave the programming state */
+      case CTRL_SYNC:
+        res = RES_OK;
+        break;
+
+      case GET_SECTOR_COUNT:
+        HAL_SD_GetCardInfo(&hsd, &info);
+        *(DWORD *)buff = info.LogBlockNbr;
+        res = RES_OK;
+        break;
+
+      case GET_SECTOR_SIZE:
+        HAL_SD_GetCardInfo(&hsd, &info);
+        *(WORD *)buff = info.LogBlockSize;
+        res = RES_OK;
+        break;
+
+      case GET_BLOCK_SIZE:
+        HAL_SD_GetCardInfo(&hsd, &info);
+        *(DWORD *)buff = info.LogBlockSize / BLOCKSIZE;
+        res = RES_OK;
+        break;
+
+      default:
+        res = RES_PARERR;
+    }
+
     return res;
   /* USER CODE END IOCTL */
 }
@@ -0,0 +1,134 @@
+/**
+  ******************************************************************************
+  * @file    codec_check.c
+  * @brief   Host round trip of the sample codec, built by `make codec-check`.
+  *
+  *          codec.c is built in here as it is, and again with CODEC_CHECK_DSP
+  *          on portable stand-ins for the M4 SIMD instructions, so both ways
+  *          of computing the zigzagged deltas run on the host. Random frames
+  *          of every length and the edge cases (deltas of +-4095 and +-32768,
+  *          all-equal frames, single samples) must decode back exactly, fit
+  *          CODEC_FRAME_MAX when they are 12-bit, and fail to decode when cut
+  *          short. Given a file name, the frames and their samples are
+  *          written there for the Rust decoder (examples/codec_check.rs) and
+  *          for comparing the two builds byte for byte.
+  ******************************************************************************
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codec.h"
+
+#ifdef CODEC_CHECK_DSP
+// halfword lanes without saturation, as SSUB16 and SADD16 compute them
+static inline uint32_t check_ssub16(uint32_t a, uint32_t b) {
+  return ((a - b) & 0xFFFF) | ((a & 0xFFFF0000) - (b & 0xFFFF0000));
+}
+
+static inline uint32_t check_sadd16(uint32_t a, uint32_t b) {
+  return ((a + b) & 0xFFFF) | ((a & 0xFFFF0000) + (b & 0xFFFF0000));
+}
+
+#define __ARM_FEATURE_DSP 1
+#define __SSUB16 check_ssub16
+#define __SADD16 check_sadd16
+#endif
+
+#include "../Core/Src/codec.c"
+
+#define CHECK_FRAMES 200000
+
+typedef uint16_t frame_t[LOG_PACKED_FRAME][LOG_CH_COUNT];
+
+enum {
+  SHAPE_RANDOM16,     // any 16-bit code
+  SHAPE_RANDOM12,     // any ADC code
+  SHAPE_NOISY,        // a slow ramp with a few codes of noise, as logged
+  SHAPE_EQUAL,        // every sample the same
+  SHAPE_EDGE12,       // 0 and 4095 in turn, deltas of +-4095
+  SHAPE_EDGE16,       // codes 0x8000 apart, deltas that wrap at 16 bits
+  SHAPE_COUNT,
+};
+
+// xorshift32, enough for test data
+static uint32_t rng = 0x2545F491;
+
+static uint32_t check_rand(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static void check_fill(frame_t s, uint32_t n, uint32_t shape) {
+  uint32_t start = check_rand() & 0xFFF;
+
+  for (uint32_t i = 0; i < n; i++) {
+    for (uint32_t ch = 0; ch < LOG_CH_COUNT; ch++) {
+      switch (shape) {
+        case SHAPE_RANDOM16: s[i][ch] = check_rand(); break;
+        case SHAPE_RANDOM12: s[i][ch] = check_rand() & 0xFFF; break;
+        case SHAPE_NOISY: s[i][ch] = (start + i * ch + check_rand() % 9 - 4) & 0xFFF; break;
+        case SHAPE_EQUAL: s[i][ch] = start + ch; break;
+        case SHAPE_EDGE12: s[i][ch] = (i + ch) & 1 ? 4095 : 0; break;
+        default: s[i][ch] = (i + ch) & 1 ? start ^ 0x8000 : start; break;
+      }
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  FILE *out = argc > 1 ? fopen(argv[1], "wb") : NULL;
+  static uint8_t buf[LOG_PACKED_FRAME * LOG_CH_COUNT * 2 + CODEC_FRAME_MIN];
+  frame_t s, d;
+
+  if (argc > 1 && !out) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  for (uint32_t k = 0; k < CHECK_FRAMES; k++) {
+    // full frames mostly, and every shorter length as the last frame of a block
+    uint32_t n = k % 4 ? LOG_PACKED_FRAME : 1 + check_rand() % LOG_PACKED_FRAME;
+    uint32_t shape = k % SHAPE_COUNT;
+
+    check_fill(s, n, shape);
+
+    uint32_t len = codec_encode(s, n, buf);
+
+    if (codec_decode(buf, len, d, n) != len || memcmp(s, d, n * sizeof(s[0]))) {
+      printf("frame %u: %u samples of shape %u do not round-trip\n", k, n, shape);
+      return 1;
+    }
+
+    if (shape != SHAPE_RANDOM16 && shape != SHAPE_EDGE16 && len > CODEC_FRAME_MAX) {
+      printf("frame %u: %u bytes, over CODEC_FRAME_MAX\n", k, len);
+      return 1;
+    }
+
+    if (shape == SHAPE_EQUAL && len != CODEC_FRAME_MIN) {
+      printf("frame %u: equal samples took %u bytes\n", k, len);
+      return 1;
+    }
+
+    if (codec_decode(buf, len - 1, d, n) != 0) {
+      printf("frame %u: decodes with its last byte cut\n", k);
+      return 1;
+    }
+
+    if (out) {
+      fwrite(&n, sizeof(n), 1, out);
+      fwrite(&len, sizeof(len), 1, out);
+      fwrite(buf, 1, len, out);
+      fwrite(s, sizeof(s[0]), n, out);
+    }
+  }
+
+  if (out) {
+    fclose(out);
+  }
+
+  printf("%u frames round-trip\n", CHECK_FRAMES);
+  return 0;
+}
@@ -0,0 +1,332 @@
+// Checks the energy and power-limit analysis against a naive reference on
+// synthetic data, then times it.
+//
+//     cargo run --release --example analysis_check -- [segment file]
+//
+// The synthetic session has gaps, recuperation, bursts over the limit of
+// exactly and just over the sustained time and plateaus near the limit. It
+// is fed to the analyzer in chunks of random size and every result is
+// compared with the reference, which works on the whole session at once and
+// recomputes each moving average from scratch. The throughput is then timed
+// over BENCH_SAMPLES samples, and over a real session when one is given.
+
+use std::time::Instant;
+
+#[path = "common/rng.rs"]
+mod rng;
+
+use fsk_energymeter_lib::analysis::{self, Analysis, Analyzer, Extremes, Limits, Rule, Violation, GAP_PERIODS};
+use fsk_energymeter_lib::reader::{Columns, LogFile};
+use rng::Rng;
+
+const RATE: f64 = 100.0;
+const SAMPLES: usize = 2_000_000;
+const BENCH_SAMPLES: usize = 300_000_000;
+
+fn synthetic(n: usize, limit: f32, rng: &mut Rng) -> Columns {
+    let mut c = Columns::default();
+    let mut t = 1.7e9;
+    let mut p = 20_000.0f64;
+    let mut i = 0;
+
+    while c.len() < n {
+        t += 1.0 / RATE;
+        i += 1;
+
+        // a dropped block or a pause in logging
+        if rng.below(40_000) == 0 {
+            t += [0.16, 0.32, 5.0, 600.0][rng.below(4)];
+        }
+
+        p = (p + (rng.unit() - 0.5) * 4000.0).clamp(-40_000.0, 75_000.0);
+
+        let burst = |len: usize, level: f32| vec![level; len];
+        let extra: Vec<f32> = match rng.below(5_000) {
+            // right at the sustained time, and just over it
+            0 => burst(10, limit + 5_000.0),
+            1 => burst(11, limit + 5_000.0),
+            2 => burst(rng.below(80) + 1, limit + rng.unit() as f32 * 20_000.0),
+            // near the limit long enough for the moving average
+            3 => (0..rng.below(200) + 40).map(|_| limit + (rng.unit() as f32 - 0.45) * 3_000.0).collect(),
+            4 => burst(60, limit),
+            _ => vec![p as f32],
+        };
+
+        for (k, power) in extra.into_iter().enumerate() {
+            let time = t + k as f64 / RATE;
+            let voltage = 500.0 + 80.0 * ((i + k) as f64 * 1e-4).sin() as f32 + rng.unit() as f32;
+
+            c.time.push(time);
+            c.voltage.push(voltage);
+            c.current.push(power / voltage);
+            c.power.push(power);
+            c.lv_voltage.push(24.0);
+            c.temperature.push(30.0);
+        }
+
+        t = c.time[c.len() - 1];
+    }
+
+    c
+}
+
+// straight from the definitions, over the whole session at once
+fn reference(c: &Columns, limits: Limits) -> Analysis {
+    let n = c.len();
+    let period = 1.0 / RATE;
+    let gap = period * GAP_PERIODS;
+    let window = (limits.window / period).round() as usize;
+    let mut r = Analysis { samples: n as u64, start: c.time[0], end: c.time[n - 1], ..Analysis::default() };
+    let (mut energy, mut regen, mut charge, mut regen_charge) = (0.0, 0.0, 0.0, 0.0);
+
+    for i in 1..n {
+        let dt = c.time[i] - c.time[i - 1];
+
+        if dt > gap {
+            continue;
+        }
+
+        let e = (c.power[i - 1] as f64 + c.power[i] as f64) / 2.0 * dt;
+        let q = (c.current[i - 1] as f64 + c.current[i] as f64) / 2.0 * dt;
+
+        energy += e;
+        charge += q;
+        regen += (-e).max(0.0);
+        regen_charge += (-q).max(0.0);
+        r.duration += dt;
+    }
+
+    r.energy_kwh = energy / 3.6e6;
+    r.regen_kwh = regen / 3.6e6;
+    r.charge_ah = charge / 3600.0;
+    r.regen_ah = regen_charge / 3600.0;
+
+    for (e, v) in [(&mut r.voltage, &c.voltage), (&mut r.current, &c.current), (&mut r.power, &c.power)] {
+        for i in 0..n {
+            if v[i] < e.min {
+                (e.min, e.min_time) = (v[i], c.time[i]);
+            }
+
+            if v[i] > e.max {
+                (e.max, e.max_time) = (v[i], c.time[i]);
+            }
+        }
+    }
+
+    // start index of the gap-free stretch each sample is in
+    let mut stretch = vec![0; n];
+
+    for i in 1..n {
+        stretch[i] = if c.time[i] - c.time[i - 1] > gap { i } else { stretch[i - 1] };
+    }
+
+    // runs of consecutive samples, within one stretch, where `over` holds
+    let runs = |over: &dyn Fn(usize) -> Option<f32>| {
+        let mut runs: Vec<(usize, usize, f32)> = Vec::new();
+
+        for i in 0..n {
+            if let Some(v) = over(i) {
+                match runs.last_mut() {
+                    Some(run) if run.1 + 1 == i && stretch[run.1] == stretch[i] => {
+                        run.1 = i;
+                        run.2 = run.2.max(v);
+                    }
+                    _ => runs.push((i, i, v)),
+                }
+            }
+        }
+
+        runs
+    };
+
+    for (a, b, peak) in runs(&|i| (c.power[i] > limits.power).then_some(c.power[i])) {
+        if (b - a + 1) as f64 * period > limits.sustained + 1e-9 {
+            r.violations.push(Violation { rule: Rule::Sustained, start: c.time[a], end: c.time[b] + period, peak });
+        }
+    }
+
+    let average = |i: usize| {
+        (i + 1 >= window && stretch[i] + window <= i + 1)
+            .then(|| (c.power[i + 1 - window..=i].iter().map(|&p| p as f64).sum::<f64>() / window as f64) as f32)
+    };
+
+    r.average_max = f32::NEG_INFINITY;
+
+    for i in 0..n {
+        if let Some(a) = average(i).filter(|&a| a > r.average_max) {
+            (r.average_max, r.average_max_time) = (a, c.time[i]);
+        }
+    }
+
+    for (a, b, peak) in runs(&|i| average(i).filter(|&a| a > limits.power)) {
+        r.violations.push(Violation {
+            rule: Rule::Average,
+            start: c.time[a + 1 - window],
+            end: c.time[b] + period,
+            peak,
+        });
+    }
+
+    r
+}
+
+fn close(a: f64, b: f64, tolerance: f64) -> bool {
+    (a - b).abs() <= tolerance * a.abs().max(b.abs()).max(1.0)
+}
+
+fn compare(got: &Analysis, want: &Analysis) -> Result<(), String> {
+    let mut errors = Vec::new();
+    let mut check = |what: &str, g: f64, w: f64, tolerance: f64| {
+        if !close(g, w, tolerance) {
+            errors.push(format!("{}: {} against {}", what, g, w));
+        }
+    };
+
+    check("samples", got.samples as f64, want.samples as f64, 0.0);
+    check("start", got.start, want.start, 0.0);
+    check("end", got.end, want.end, 0.0);
+    check("duration", got.duration, want.duration, 1e-9);
+    check("energy", got.energy_kwh, want.energy_kwh, 1e-9);
+    check("regen", got.regen_kwh, want.regen_kwh, 1e-9);
+    check("charge", got.charge_ah, want.charge_ah, 1e-9);
+    check("regen charge", got.regen_ah, want.regen_ah, 1e-9);
+    check("average max", got.average_max as f64, want.average_max as f64, 1e-6);
+    check("average max time", got.average_max_time, want.average_max_time, 0.0);
+
+    let extremes = [
+        ("voltage", got.voltage, want.voltage),
+        ("current", got.current, want.current),
+        ("power", got.power, want.power),
+    ];
+
+    for (name, g, w) in extremes {
+        if g != w {
+            errors.push(format!("{} extremes: {:?} against {:?}", name, g, w));
+        }
+    }
+
+    // the reference lists sustained violations first
+    let mut violations = got.violations.clone();
+    violations.sort_by_key(|v| v.rule == Rule::Average);
+
+    if violations.len() != want.violations.len() {
+        errors.push(format!("{} violations against {}", violations.len(), want.violations.len()));
+    }
+
+    for (g, w) in violations.iter().zip(&want.violations) {
+        if g.rule != w.rule
+            || !close(g.start, w.start, 1e-12)
+            || !close(g.end, w.end, 1e-12)
+            || !close(g.peak as f64, w.peak as f64, 1e-6)
+        {
+            errors.push(format!("violation {:?} against {:?}", g, w));
+            break;
+        }
+    }
+
+    if errors.is_empty() {
+        Ok(())
+    } else {
+        Err(errors.join("\n"))
+    }
+}
+
+fn slice(c: &Columns, range: std::ops::Range<usize>) -> Columns {
+    Columns {
+        time: c.time[range.clone()].to_vec(),
+        voltage: c.voltage[range.clone()].to_vec(),
+        current: c.current[range.clone()].to_vec(),
+        power: c.power[range.clone()].to_vec(),
+        lv_voltage: c.lv_voltage[range.clone()].to_vec(),
+        temperature: c.temperature[range].to_vec(),
+        bad_blocks: 0,
+    }
+}
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let limits = Limits::default();
+    let mut rng = Rng(0x9e37_79b9_7f4a_7c15);
+    let c = synthetic(SAMPLES, limits.power, &mut rng);
+    let want = reference(&c, limits);
+
+    // one chunk, then chunks of random size down to single samples
+    for max_chunk in [c.len(), 1 << 16, 97, 2] {
+        let mut analyzer = Analyzer::new(limits, RATE);
+        let mut at = 0;
+
+        while at < c.len() {
+            let n = (rng.below(max_chunk) + 1).min(c.len() - at);
+
+            analyzer.feed(&slice(&c, at..at + n));
+            at += n;
+        }
+
+        compare(&analyzer.finish(), &want).map_err(|e| format!("chunks up to {}: {}", max_chunk, e))?;
+    }
+
+    let count = |rule| want.violations.iter().filter(|v| v.rule == rule).count();
+
+    println!(
+        "{} samples match the reference: {:.3} kWh, {:.3} kWh regen, {} sustained and {} average violations",
+        c.len(),
+        want.energy_kwh,
+        want.regen_kwh,
+        count(Rule::Sustained),
+        count(Rule::Average)
+    );
+
+    // the same data over and over, moved on in time
+    let mut chunk = slice(&c, 0..analysis::CHUNK_SAMPLES.min(c.len()));
+    let span = chunk.time[chunk.len() - 1] - chunk.time[0] + 1.0 / RATE;
+    let mut analyzer = Analyzer::new(limits, RATE);
+    let mut busy = 0.0;
+    let mut fed = 0;
+
+    while fed < BENCH_SAMPLES {
+        let begin = Instant::now();
+
+        analyzer.feed(&chunk);
+        busy += begin.elapsed().as_secs_f64();
+        fed += chunk.len();
+
+        for t in &mut chunk.time {
+            *t += span;
+        }
+    }
+
+    let r = analyzer.finish();
+
+    println!(
+        "{} samples analysed in {:.2} s, {:.0} M samples/s, {:.1} kWh",
+        fed,
+        busy,
+        fed as f64 / busy / 1e6,
+        r.energy_kwh
+    );
+
+    if let Some(path) = std::env::args().nth(1) {
+        let log = LogFile::open(&path)?;
+        let info = log.info();
+        let begin = Instant::now();
+        let r = analysis::analyze(&log, info.start, info.end, limits, |p| {
+            eprint!("\r{:>5.1} %", p.samples as f64 * 100.0 / p.total.max(1) as f64);
+        });
+        let secs = begin.elapsed().as_secs_f64();
+        let Extremes { max, .. } = r.power;
+
+        eprintln!();
+        println!(
+            "{}: {} samples in {:.2} s, {:.0} M samples/s; {:.3} kWh, {:.3} Ah, peak {:.1} kW, {} violations",
+            path,
+            r.samples,
+            secs,
+            r.samples as f64 / secs / 1e6,
+            r.energy_kwh,
+            r.charge_ah,
+            max / 1e3,
+            r.violations.len()
+        );
+    }
+
+    Ok(())
+}
@@ -0,0 +1,72 @@
+// First open of a session against a reopen from the decoded cache.
+//
+//     cargo run --release --example cache_bench -- <segment file> [cache dir]
+//
+// The cache directory defaults to one under the system temp directory and is
+// emptied first. Reads of the whole session and a 2000 pixel envelope are
+// timed both ways, and the cached samples are checked against the decoded ones.
+
+use std::time::Instant;
+
+use fsk_energymeter_lib::cache::{Cache, CACHE_LIMIT};
+use fsk_energymeter_lib::downsample;
+use fsk_energymeter_lib::reader::LogFile;
+
+const WIDTH: usize = 2000;
+
+fn ms(since: Instant) -> f64 {
+    since.elapsed().as_secs_f64() * 1e3
+}
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let mut args = std::env::args().skip(1);
+    let path = args.next().ok_or("usage: cache_bench <segment file> [cache dir]")?;
+    let dir = args.next().map_or_else(|| std::env::temp_dir().join("fsk-cache-bench"), Into::into);
+
+    let _ = std::fs::remove_dir_all(&dir);
+    let cache = Cache::new(dir.clone(), CACHE_LIMIT);
+
+    let t = Instant::now();
+    let log = LogFile::open(&path)?;
+    let info = log.info();
+    let open = ms(t);
+
+    let t = Instant::now();
+    let decoded = log.read(info.start, info.end);
+    let read = ms(t);
+
+    let t = Instant::now();
+    let envelope = downsample::envelope(&LogFile::open(&path)?, info.start, info.end, WIDTH).time.len();
+    let env = ms(t);
+
+    println!("first open   {:>8.1} ms, read {:>8.1} ms ({} samples), envelope {:>7.1} ms ({} points)",
+        open, read, decoded.len(), env, envelope);
+
+    let t = Instant::now();
+    log.fill_cache(&cache)?;
+    let bytes: u64 = std::fs::read_dir(&dir)?.map(|e| e.map_or(0, |e| e.metadata().map_or(0, |m| m.len()))).sum();
+    println!("cache build  {:>8.1} ms, {:.1} MB", ms(t), bytes as f64 / 1e6);
+
+    let t = Instant::now();
+    let log = LogFile::open(&path)?;
+    log.use_cache(&cache);
+    let open = ms(t);
+
+    let t = Instant::now();
+    let cached = log.read(info.start, info.end);
+    let read = ms(t);
+
+    let t = Instant::now();
+    let envelope = downsample::envelope(&log, info.start, info.end, WIDTH).time.len();
+    let env = ms(t);
+
+    println!("reopen       {:>8.1} ms, read {:>8.1} ms ({} samples), envelope {:>7.1} ms ({} points)",
+        open, read, cached.len(), env, envelope);
+
+    let same = cached.time == decoded.time
+        && cached.columns() == decoded.columns()
+        && cached.bad_blocks == decoded.bad_blocks;
+    println!("cached samples {} the decoded ones", if same { "match" } else { "DIFFER from" });
+
+    Ok(())
+}
@@ -0,0 +1,55 @@
+// Decodes the frames the firmware codec check wrote and compares them with
+// the samples they were made from.
+//
+//     make -C device/firmware codec-check
+//     cargo run --release --example codec_check -- device/firmware/build/codec.vec
+//
+// The file holds, for each frame, the sample count and encoded length as
+// u32, the encoded bytes and the samples. Every frame has to decode to its
+// samples with exactly its bytes taken, and fail without a panic when any
+// of its bytes are cut off.
+
+use fsk_energymeter_lib::log::{decode_frame, CHANNELS, PACKED_FRAME};
+
+fn u32_at(b: &[u8], at: usize) -> Option<usize> {
+    Some(u32::from_le_bytes(b.get(at..at + 4)?.try_into().unwrap()) as usize)
+}
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let path = std::env::args().nth(1).ok_or("usage: codec_check <frames file>")?;
+    let data = std::fs::read(&path)?;
+    let mut out = [[0u16; CHANNELS]; PACKED_FRAME];
+    let (mut at, mut frames) = (0, 0);
+
+    while at < data.len() {
+        let (n, len) = (u32_at(&data, at).ok_or("cut off")?, u32_at(&data, at + 4).ok_or("cut off")?);
+        let encoded = data.get(at + 8..at + 8 + len).ok_or("cut off")?;
+        let samples = data.get(at + 8 + len..at + 8 + len + n * CHANNELS * 2).ok_or("cut off")?;
+
+        if decode_frame(encoded, &mut out[..n]) != Some(len) {
+            return Err(format!("frame {}: {} samples in {} bytes do not decode", frames, n, len).into());
+        }
+
+        for (i, s) in out[..n].iter().enumerate() {
+            for (ch, &v) in s.iter().enumerate() {
+                let want = u16::from_le_bytes([samples[(i * CHANNELS + ch) * 2], samples[(i * CHANNELS + ch) * 2 + 1]]);
+
+                if v != want {
+                    return Err(format!("frame {}: sample {} channel {} is {}, not {}", frames, i, ch, v, want).into());
+                }
+            }
+        }
+
+        for cut in 0..len {
+            if decode_frame(&encoded[..cut], &mut out[..n]).is_some() {
+                return Err(format!("frame {}: decodes from {} of its {} bytes", frames, cut, len).into());
+            }
+        }
+
+        at += 8 + len + n * CHANNELS * 2;
+        frames += 1;
+    }
+
+    println!("{} frames decode to their samples", frames);
+    Ok(())
+}
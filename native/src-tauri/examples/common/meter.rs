@@ -0,0 +1,186 @@
+// Simulated meter on a pseudo-terminal, standing in for the device in
+// examples/meter_sim.rs and tests/live.rs. Unix only; included with #[path].
+//
+// Answers TIME and STREAM the way the firmware does
+// (device/firmware/Core/Src/command.c) and, while the stream is on, sends !S
+// sample lines: a slowly sagging pack voltage and a current swinging like
+// laps of a track. Sample numbers count at the logged SAMPLE_RATE whatever
+// rate the lines go out at, so a test can stream minutes in seconds.
+
+// not every includer uses every item
+#![allow(dead_code)]
+
+use std::ffi::CStr;
+use std::fs::File;
+use std::io::{self, BufRead, BufReader, Write};
+use std::os::fd::FromRawFd;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Arc, Mutex};
+use std::thread;
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
+
+/// Rate the sample numbers count at, Hz; the device's ACQ_SAMPLE_RATE.
+pub const SAMPLE_RATE: f64 = 100.0;
+
+fn check(r: libc::c_int) -> io::Result<libc::c_int> {
+    if r < 0 {
+        Err(io::Error::last_os_error())
+    } else {
+        Ok(r)
+    }
+}
+
+// master side of a new pty and the slave path; the slave is opened here
+// too, in raw mode, so the line discipline neither echoes nor rewrites
+// what the app sends and the master stays usable between connections
+fn open_pty() -> io::Result<(File, File, String)> {
+    unsafe {
+        let master = check(libc::posix_openpt(libc::O_RDWR | libc::O_NOCTTY))?;
+        check(libc::grantpt(master))?;
+        check(libc::unlockpt(master))?;
+
+        let name = libc::ptsname(master);
+        if name.is_null() {
+            return Err(io::Error::last_os_error());
+        }
+        let path = CStr::from_ptr(name).to_string_lossy().into_owned();
+
+        let slave = check(libc::open(name, libc::O_RDWR | libc::O_NOCTTY))?;
+        let mut tio = std::mem::zeroed::<libc::termios>();
+        check(libc::tcgetattr(slave, &mut tio))?;
+        libc::cfmakeraw(&mut tio);
+        check(libc::tcsetattr(slave, libc::TCSANOW, &tio))?;
+
+        Ok((File::from_raw_fd(master), File::from_raw_fd(slave), path))
+    }
+}
+
+fn now() -> f64 {
+    SystemTime::now().duration_since(UNIX_EPOCH).unwrap_or_default().as_secs_f64()
+}
+
+/// HV voltage, HV current, LV voltage and die temperature of sample `number`,
+/// before they are rounded to the three decimals a line carries.
+pub fn values(number: u32) -> [f64; 4] {
+    let t = number as f64 / SAMPLE_RATE;
+    let current = 180.0 * (t * 0.2).sin().max(-0.3) + 4.0 * (t * 31.0).sin();
+    let voltage = 520.0 - t / 60.0 - current * 0.08;
+    let celsius = 38.0 + 4.0 * (t / 120.0).sin();
+
+    [voltage, current, 24.1, celsius]
+}
+
+struct State {
+    out: Mutex<File>,
+    streaming: AtomicBool,
+    stop: AtomicBool,
+    // device minus host clock, seconds
+    offset: Mutex<f64>,
+    valid: AtomicBool,
+}
+
+impl State {
+    fn send(&self, line: &str) -> io::Result<()> {
+        let mut out = self.out.lock().unwrap();
+        out.write_all(line.as_bytes())?;
+        out.write_all(b"\n")
+    }
+
+    fn command(&self, line: &str) -> io::Result<()> {
+        let mut f = line.split_whitespace();
+
+        let reply = match (f.next(), f.next()) {
+            (Some("TIME"), None) => {
+                let t = now() + *self.offset.lock().unwrap();
+                format!("OK {:.3} {}", t, self.valid.load(Ordering::Relaxed) as u8)
+            }
+            (Some("TIME"), Some(t)) => match t.parse::<f64>() {
+                Ok(t) => {
+                    *self.offset.lock().unwrap() = t - now();
+                    self.valid.store(true, Ordering::Relaxed);
+                    "OK".into()
+                }
+                Err(_) => "ERR time".into(),
+            },
+            (Some("STREAM"), None) => format!("OK {} 0", self.streaming.load(Ordering::Relaxed) as u8),
+            (Some("STREAM"), Some(on @ ("ON" | "OFF"))) => {
+                self.streaming.store(on == "ON", Ordering::Relaxed);
+                "OK".into()
+            }
+            (Some("STREAM"), Some(_)) => "ERR stream".into(),
+            (None, _) => return Ok(()),
+            _ => "ERR unknown".into(),
+        };
+
+        self.send(&reply)
+    }
+}
+
+/// A simulated meter; stops streaming when dropped.
+pub struct Meter {
+    path: String,
+    state: Arc<State>,
+    // held so the master stays usable while nothing else has the slave open
+    _slave: File,
+}
+
+impl Meter {
+    /// Opens a pty and serves it, sending `rate` sample lines a second while
+    /// the stream is on.
+    pub fn start(rate: f64) -> io::Result<Meter> {
+        let (master, slave, path) = open_pty()?;
+        let state = Arc::new(State {
+            out: Mutex::new(master.try_clone()?),
+            streaming: AtomicBool::new(false),
+            stop: AtomicBool::new(false),
+            offset: Mutex::new(0.0),
+            valid: AtomicBool::new(false),
+        });
+
+        let s = state.clone();
+        thread::spawn(move || {
+            for line in BufReader::new(master).lines() {
+                match line {
+                    Ok(line) => s.command(line.trim()).expect("pty write failed"),
+                    Err(e) => panic!("pty read failed: {}", e),
+                }
+            }
+        });
+
+        let s = state.clone();
+        thread::spawn(move || {
+            let start = Instant::now();
+            let mut number: u32 = 0;
+
+            // lines due by now go out together, so high rates do not hang on sleep granularity
+            while !s.stop.load(Ordering::Relaxed) {
+                let due = (start.elapsed().as_secs_f64() * rate) as u64;
+
+                while (number as u64) < due {
+                    number += 1;
+
+                    if s.streaming.load(Ordering::Relaxed) {
+                        let [v, a, lv, c] = values(number);
+                        s.send(&format!("!S {} {:.3} {:.3} {:.3} {:.3}", number, v, a, lv, c))
+                            .expect("pty write failed");
+                    }
+                }
+
+                thread::sleep(Duration::from_millis(1));
+            }
+        });
+
+        Ok(Meter { path, state, _slave: slave })
+    }
+
+    /// Slave side of the pty, to open as the meter's port.
+    pub fn path(&self) -> &str {
+        &self.path
+    }
+}
+
+impl Drop for Meter {
+    fn drop(&mut self) {
+        self.state.stop.store(true, Ordering::Relaxed);
+    }
+}
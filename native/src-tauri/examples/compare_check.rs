@@ -0,0 +1,187 @@
+// Checks power-trace alignment on synthetic data, then times aligning and
+// comparing sessions of a real log.
+//
+//     cargo run --release --example compare_check -- [segment file] [sessions]
+//
+// The synthetic traces are a random walk averaged down to CORRELATE_RATE
+// and the same walk shifted by a known fraction of a bin, with noise and
+// missing stretches. The coarse-to-fine search has to land on the shift an
+// exhaustive search at full rate finds, and within a fifth of a bin of the
+// true shift.
+//
+// Given a segment file, its session is compared with itself `sessions` times
+// (10 by default), each copy starting a few seconds later. Aligning them by
+// correlation should give every copy the reference's zero, and comparing them
+// from the reference's start has to leave each copy's bins before its own
+// start empty.
+
+use std::time::Instant;
+
+#[path = "common/rng.rs"]
+mod rng;
+
+use fsk_energymeter_lib::compare::{self, Align, Session, CORRELATE_RATE};
+use fsk_energymeter_lib::reader::LogFile;
+use rng::Rng;
+
+const TRACE_SECONDS: usize = 3600;
+const MAX_LAG: f64 = 120.0;
+
+// means of 10 samples of a 100 Hz walk, from sample `skip`
+fn bins(walk: &[f32], skip: usize, n: usize, rng: &mut Rng) -> Vec<f32> {
+    (0..n)
+        .map(|i| {
+            let at = skip + i * 10;
+            walk[at..at + 10].iter().sum::<f32>() / 10.0 + rng.signed() * 500.0
+        })
+        .collect()
+}
+
+// every shift at full rate, straight from the definition
+fn exhaustive(r: &[f32], s: &[f32], max_lag: isize) -> isize {
+    let centre = |v: &[f32]| {
+        let valid: Vec<f64> = v.iter().filter(|x| !x.is_nan()).map(|&x| x as f64).collect();
+        let mean = valid.iter().sum::<f64>() / valid.len() as f64;
+        v.iter().map(|&x| if x.is_nan() { 0.0 } else { x as f64 - mean }).collect::<Vec<f64>>()
+    };
+    let (r, s) = (centre(r), centre(s));
+    let min_overlap = (r.len().min(s.len()) as f64 * 0.25).ceil() as isize;
+    let mut best = (f64::NEG_INFINITY, 0isize);
+
+    for k in -max_lag..=max_lag {
+        let pairs: Vec<(f64, f64)> = (0..r.len() as isize)
+            .filter(|&i| i + k >= 0 && i + k < s.len() as isize)
+            .map(|i| (r[i as usize], s[(i + k) as usize]))
+            .collect();
+
+        if (pairs.len() as isize) < min_overlap {
+            continue;
+        }
+
+        let dot: f64 = pairs.iter().map(|(a, b)| a * b).sum();
+        let er: f64 = pairs.iter().map(|(a, _)| a * a).sum();
+        let es: f64 = pairs.iter().map(|(_, b)| b * b).sum();
+        let c = dot / (er * es).sqrt();
+
+        if c > best.0 || (c == best.0 && k.abs() < best.1.abs()) {
+            best = (c, k);
+        }
+    }
+
+    best.1
+}
+
+fn synthetic() -> Result<(), String> {
+    let mut rng = Rng(0x2545_f491_4f6c_dd1d);
+    let n = TRACE_SECONDS * CORRELATE_RATE as usize;
+    let max_lag = (MAX_LAG * CORRELATE_RATE) as usize;
+    let mut walk = Vec::with_capacity((n + 2 * max_lag) * 10 + 10);
+    let mut p = 20_000.0f32;
+
+    while walk.len() < walk.capacity() {
+        p = (p + rng.signed() * 1500.0).clamp(-40_000.0, 80_000.0);
+        walk.push(p);
+    }
+
+    for case in 0..8 {
+        // the second trace starts `shift` samples of the walk after the first
+        let base = max_lag * 10;
+        let shift = (rng.next() % (2 * base as u64 - 20)) as isize - base as isize + 10;
+        let r = bins(&walk, base, n, &mut rng);
+        let mut s = bins(&walk, (base as isize + shift) as usize, n, &mut rng);
+
+        // a stretch of bad blocks
+        let at = (rng.next() % (n as u64 - 600)) as usize;
+        s[at..at + 600].fill(f32::NAN);
+
+        let want = -shift as f64 / 10.0;
+        let (got, score) = compare::best_lag(&r, &s, max_lag).ok_or("no shift found")?;
+        let full = exhaustive(&r, &s, max_lag as isize);
+
+        if got.round() as isize != full && (got - full as f64).abs() > 0.5 {
+            return Err(format!("case {}: shift {:.2}, the exhaustive search finds {}", case, got, full));
+        }
+
+        if (got - want).abs() > 0.2 {
+            return Err(format!("case {}: shift {:.2} against {:.2}", case, got, want));
+        }
+
+        println!("shift {:>8.2} bins, found {:>8.2}, correlation {:.4}", want, got, score);
+    }
+
+    Ok(())
+}
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    synthetic()?;
+
+    let mut args = std::env::args().skip(1);
+    let Some(path) = args.next() else {
+        return Ok(());
+    };
+    let count: usize = args.next().map(|a| a.parse()).transpose()?.unwrap_or(10);
+
+    let begin = Instant::now();
+    let log = LogFile::open(&path)?;
+    let info = log.info();
+    println!("{}: opened in {:.1} ms", path, begin.elapsed().as_secs_f64() * 1e3);
+
+    // copies starting 7.3 s apart, all ending a little before the log does
+    let sessions: Vec<(&LogFile, Session)> = (0..count)
+        .map(|i| {
+            let start = info.start + i as f64 * 7.3;
+            (&log, Session { path: path.clone(), start, end: info.end - 60.0, marker: None })
+        })
+        .collect();
+
+    let begin = Instant::now();
+    let aligned = compare::align(&sessions, 0, Align::Correlate { max_lag: MAX_LAG })?;
+    let align_ms = begin.elapsed().as_secs_f64() * 1e3;
+    let worst = aligned.iter().map(|a| (a.zero - aligned[0].zero).abs()).fold(0.0, f64::max);
+
+    println!("{} sessions aligned in {:.1} ms, zeros at most {:.3} s from the reference's", count, align_ms, worst);
+
+    if worst > 0.05 {
+        return Err(format!("alignment off by {:.3} s", worst).into());
+    }
+
+    // over the range every copy covers, where they all read the same samples
+    let zeros: Vec<f64> = aligned.iter().map(|a| a.zero).collect();
+    let (from, to) = (sessions[count - 1].1.start - zeros[0], info.end - 60.0 - zeros[0]);
+    let begin = Instant::now();
+    let c = compare::compare(&sessions, &zeros, 0, from, to, 2000);
+    let compare_ms = begin.elapsed().as_secs_f64() * 1e3;
+    let worst = c.series.iter().flat_map(|s| &s.energy_diff).fold(0.0f32, |m, &d| m.max(d.abs()));
+
+    println!(
+        "compared over {:.0} s in {:.1} ms, {} bins each; energy differences up to {:.4} kWh of {:.3}",
+        to - from,
+        compare_ms,
+        c.series[0].power.len(),
+        worst,
+        c.series[0].energy.last().copied().unwrap_or(0.0)
+    );
+
+    // and from the reference's start, where each copy's bins before its own are empty
+    let c = compare::compare(&sessions, &zeros, 0, 0.0, to, 2000);
+
+    for (i, (s, (_, session))) in c.series.iter().zip(&sessions).enumerate() {
+        let before = ((session.start - zeros[i]) / c.step).floor() as usize;
+        let empty = |v: &[f32]| v.iter().take_while(|x| x.is_nan()).count();
+
+        if empty(&s.power) != before || empty(&s.energy) != before {
+            return Err(format!(
+                "copy {}: {} bins without power and {} without energy before its start; want {}",
+                i,
+                empty(&s.power),
+                empty(&s.energy),
+                before
+            )
+            .into());
+        }
+    }
+
+    println!("bins before each copy's start are empty");
+
+    Ok(())
+}
@@ -0,0 +1,55 @@
+// Decode throughput of the log reader at 1, 2, 4 and all host threads.
+//
+//     cargo run --release --example decode_bench -- <segment file> [runs]
+//
+// Each run opens the session afresh, so every block CRC is checked again as
+// on a first load; the file itself stays in the OS page cache after the
+// first run, which is not timed.
+
+use std::time::{Duration, Instant};
+
+use fsk_energymeter_lib::reader::LogFile;
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let mut args = std::env::args().skip(1);
+    let path = args.next().ok_or("usage: decode_bench <segment file> [runs]")?;
+    let runs: usize = args.next().map(|r| r.parse()).transpose()?.unwrap_or(3);
+
+    let info = LogFile::open(&path)?.info();
+    let samples = LogFile::open(&path)?.read(info.start, info.end).len();
+
+    println!(
+        "{} segment(s), {:.1} MB, {} samples over {:.1} h",
+        info.segments.len(),
+        info.bytes as f64 / 1e6,
+        samples,
+        (info.end - info.start) / 3600.0
+    );
+
+    let all = std::thread::available_parallelism().map_or(1, |n| n.get());
+    let mut threads: Vec<usize> = [1, 2, 4, all].into_iter().filter(|&n| n <= all).collect();
+    threads.dedup();
+
+    for n in threads {
+        let pool = rayon::ThreadPoolBuilder::new().num_threads(n).build()?;
+        let mut best = Duration::MAX;
+
+        for _ in 0..runs.max(1) {
+            let start = Instant::now();
+            let log = LogFile::open(&path)?;
+            let read = pool.install(|| log.read(info.start, info.end)).len();
+
+            best = best.min(start.elapsed());
+            assert_eq!(read, samples);
+        }
+
+        println!(
+            "{:>3} threads  {:>7.1} ms  {:>6.1} M samples/s",
+            n,
+            best.as_secs_f64() * 1e3,
+            samples as f64 / best.as_secs_f64() / 1e6
+        );
+    }
+
+    Ok(())
+}
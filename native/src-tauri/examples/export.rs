@@ -0,0 +1,66 @@
+// Exports a whole session from the command line, as the app's export does.
+//
+//     cargo run --release --example export -- <segment file> <out.csv | out.csv.gz | out.parquet> [channel ...]
+//
+// Channels are voltage, current, power, lv_voltage and temperature; all of
+// them when none are given. Prints progress, the time taken and the peak
+// memory of the process where the OS reports it.
+
+use std::fs::File;
+use std::io::BufWriter;
+use std::time::Instant;
+
+use fsk_energymeter_lib::export::{self, Channel, Format, Options};
+use fsk_energymeter_lib::reader::LogFile;
+
+fn channel(name: &str) -> Result<Channel, String> {
+    serde_json::from_value(serde_json::Value::String(name.into())).map_err(|_| format!("unknown channel {}", name))
+}
+
+// peak resident set, from /proc on Linux
+fn peak_rss() -> Option<String> {
+    let status = std::fs::read_to_string("/proc/self/status").ok()?;
+    let line = status.lines().find(|l| l.starts_with("VmHWM:"))?;
+
+    Some(line["VmHWM:".len()..].trim().to_string())
+}
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let mut args = std::env::args().skip(1);
+    let usage = "usage: export <segment file> <out.csv | out.csv.gz | out.parquet> [channel ...]";
+    let path = args.next().ok_or(usage)?;
+    let dest = args.next().ok_or(usage)?;
+    let channels = args.map(|a| channel(&a)).collect::<Result<Vec<_>, _>>()?;
+
+    let log = LogFile::open(&path)?;
+    let info = log.info();
+    let opts = Options {
+        format: if dest.ends_with(".parquet") { Format::Parquet } else { Format::Csv },
+        start: info.start,
+        end: info.end,
+        channels,
+        compress: dest.ends_with(".gz"),
+    };
+
+    let begin = Instant::now();
+    let done = export::export(&log, &opts, BufWriter::new(File::create(&dest)?), |p| {
+        eprint!("\r{:>5.1} %", p.samples as f64 * 100.0 / p.total.max(1) as f64);
+    })?;
+    let secs = begin.elapsed().as_secs_f64();
+
+    eprintln!();
+    println!(
+        "{} samples ({} bad blocks) in {:.2} s, {:.1} M samples/s, {} bytes",
+        done.samples,
+        done.bad_blocks,
+        secs,
+        done.samples as f64 / secs / 1e6,
+        std::fs::metadata(&dest)?.len()
+    );
+
+    if let Some(rss) = peak_rss() {
+        println!("peak memory {}", rss);
+    }
+
+    Ok(())
+}
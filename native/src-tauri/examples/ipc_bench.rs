@@ -0,0 +1,76 @@
+// JSON against binary transfer of a 1M-point sample series.
+//
+//     cargo run --release --example ipc_bench -- [points]
+//
+// Encoding is what the command spends before the bytes go over the IPC
+// bridge; decoding stands in for what the webview then does with them,
+// JSON.parse for the text and typed-array views for the binary layout.
+
+use std::time::{Duration, Instant};
+
+use fsk_energymeter_lib::ipc;
+use fsk_energymeter_lib::reader::Columns;
+
+fn series(n: usize) -> Columns {
+    let mut c = Columns::default();
+
+    for i in 0..n {
+        let t = i as f64 / 100.0;
+        let v = 400.0 + 50.0 * (t / 300.0).sin() as f32;
+        let a = 200.0 * (t / 30.0).sin() as f32;
+
+        c.time.push(1.7e9 + t);
+        c.voltage.push(v);
+        c.current.push(a);
+        c.power.push(v * a);
+        c.lv_voltage.push(24.0);
+        c.temperature.push(35.0);
+    }
+
+    c
+}
+
+fn best<T, F: FnMut() -> T>(runs: usize, mut f: F) -> (Duration, T) {
+    let mut best = Duration::MAX;
+    let mut out = None;
+
+    for _ in 0..runs {
+        let start = Instant::now();
+        out = Some(f());
+        best = best.min(start.elapsed());
+    }
+
+    (best, out.unwrap())
+}
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let n: usize = std::env::args().nth(1).map(|a| a.parse()).transpose()?.unwrap_or(1_000_000);
+    let c = series(n);
+
+    let (json_enc, json) = best(3, || serde_json::to_vec(&c).unwrap());
+    let (json_dec, _) = best(3, || serde_json::from_slice::<serde_json::Value>(&json).unwrap());
+    let (bin_enc, bin) = best(3, || ipc::encode_samples(&c));
+    let (bin_dec, _) = best(3, || {
+        // the page only wraps the buffer; read every value so the work is not skipped
+        let floats = &std::hint::black_box(&bin)[16 + n * 8..];
+        let values = floats.chunks_exact(4).map(|b| f32::from_le_bytes(b.try_into().unwrap()));
+
+        std::hint::black_box(values.fold(0.0f32, |a, v| a.max(v)))
+    });
+
+    let report = |name: &str, bytes: usize, enc: Duration, dec: Duration| {
+        println!(
+            "{:<7} {:>8.1} MB  encode {:>7.1} ms  decode {:>7.1} ms",
+            name,
+            bytes as f64 / 1e6,
+            enc.as_secs_f64() * 1e3,
+            dec.as_secs_f64() * 1e3
+        );
+    };
+
+    println!("{} points", n);
+    report("json", json.len(), json_enc, json_dec);
+    report("binary", bin.len(), bin_enc, bin_dec);
+
+    Ok(())
+}
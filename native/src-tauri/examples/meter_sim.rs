@@ -0,0 +1,28 @@
+// Simulated meter on a pseudo-terminal, for working on the live view
+// without hardware; tests/live.rs runs the same simulator against Live.
+//
+//     cargo run --example meter_sim
+//
+// Prints the pty path to connect the app to and serves it at the logged
+// rate, 100 sample lines a second while the stream is on; see
+// common/meter.rs.
+
+#[cfg(unix)]
+#[path = "common/meter.rs"]
+mod meter;
+
+#[cfg(unix)]
+fn main() -> std::io::Result<()> {
+    let meter = meter::Meter::start(meter::SAMPLE_RATE)?;
+
+    println!("meter on {}", meter.path());
+
+    loop {
+        std::thread::park();
+    }
+}
+
+#[cfg(not(unix))]
+fn main() {
+    eprintln!("meter_sim needs a unix pseudo-terminal");
+}
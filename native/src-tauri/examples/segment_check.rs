@@ -0,0 +1,154 @@
+// Checks that the reader ends a segment left open by a power loss where its
+// log ends, and not at the end of the preallocated file.
+//
+//     cargo run --release --example segment_check
+//
+// The segment is LIVE blocks of samples with zero events in between and a
+// run of dropped blocks, written over an older log of the same shape whose
+// blocks fill the rest of the SEGMENT_SIZE file. The older log started a
+// few samples later, so its blocks carry on the sequence numbers but not
+// the times. It is opened without an index, with a record of an earlier
+// sync, with a closed record and with a record of another segment, and has
+// to end after block LIVE each time with all samples read back.
+
+use fsk_energymeter_lib::log::{self, BLOCK_SIZE, SEGMENT_SIZE};
+use fsk_energymeter_lib::reader::LogFile;
+
+const TICK_HZ: u32 = 100_000;
+const SAMPLE_TICKS: u32 = TICK_HZ / 100;
+const LIVE: usize = 3000;
+const DROPPED: (usize, u32) = (1700, 5);
+
+fn block(kind: u8, count: u16, seq: u32, flags: u32, time: u64, payload: &[u8]) -> [u8; BLOCK_SIZE] {
+    let mut b = [0u8; BLOCK_SIZE];
+
+    b[0..4].copy_from_slice(&log::BLOCK_MAGIC.to_le_bytes());
+    b[4] = kind;
+    b[5] = log::FORMAT_VERSION;
+    b[6..8].copy_from_slice(&count.to_le_bytes());
+    b[8..12].copy_from_slice(&seq.to_le_bytes());
+    b[12..16].copy_from_slice(&flags.to_le_bytes());
+    b[16..24].copy_from_slice(&time.to_le_bytes());
+    b[24..24 + payload.len()].copy_from_slice(payload);
+
+    let crc = log::stm32_crc(&b[..BLOCK_SIZE - 4]);
+    b[BLOCK_SIZE - 4..].copy_from_slice(&crc.to_le_bytes());
+    b
+}
+
+// a session 1 segment 0 log starting at `time`, `blocks` blocks long
+fn session(time: u64, blocks: usize) -> Vec<u8> {
+    let mut p = [0u8; 52];
+
+    p[0..2].copy_from_slice(&1u16.to_le_bytes());
+    p[4..8].copy_from_slice(&1_700_000_000u32.to_le_bytes());
+    p[8..10].copy_from_slice(&100u16.to_le_bytes());
+    p[10..12].copy_from_slice(&(log::SAMPLES_PER_BLOCK as u16).to_le_bytes());
+    p[12..14].copy_from_slice(&(log::CHANNELS as u16).to_le_bytes());
+
+    for (at, v) in [(16, 0.006f32), (20, 0.2), (24, 0.5), (28, 1500.0)] {
+        p[at..at + 4].copy_from_slice(&v.to_le_bytes());
+    }
+
+    p[32..36].copy_from_slice(&TICK_HZ.to_le_bytes());
+    p[36..40].copy_from_slice(&SAMPLE_TICKS.to_le_bytes());
+
+    let mut out = block(log::TYPE_SESSION, 1, 0, 0, time, &p).to_vec();
+    let (mut seq, mut time) = (0u32, time);
+    let samples = [0u8; log::SAMPLES_PER_BLOCK * log::CHANNELS * 2];
+    let step = log::SAMPLES_PER_BLOCK as u64 * SAMPLE_TICKS as u64;
+
+    while out.len() < blocks * BLOCK_SIZE {
+        let i = out.len() / BLOCK_SIZE;
+        let mut flags = 0;
+
+        if i == DROPPED.0 {
+            seq += DROPPED.1;
+            time += DROPPED.1 as u64 * step;
+
+            // the event is written before the sample block it took the number of
+            let event = log::EVENT_ZERO.to_le_bytes();
+            out.extend(block(log::TYPE_EVENT, 1, seq, 0, time, &event));
+            flags = log::FLAG_OVERRUN;
+        } else if i % 500 == 0 {
+            out.extend(block(log::TYPE_EVENT, 1, seq, 0, time, &log::EVENT_ZERO.to_le_bytes()));
+        }
+
+        out.extend(block(log::TYPE_SAMPLE, log::SAMPLES_PER_BLOCK as u16, seq, flags, time, &samples));
+        seq += 1;
+        time += step;
+    }
+
+    out.truncate(blocks * BLOCK_SIZE);
+    out
+}
+
+fn entry(blocks: usize, flags: u32, first_seq: u32) -> Vec<u8> {
+    let mut b = [0u8; log::INDEX_SIZE];
+
+    b[0..4].copy_from_slice(&log::INDEX_MAGIC.to_le_bytes());
+    b[4..6].copy_from_slice(&1u16.to_le_bytes());
+    b[8..12].copy_from_slice(&first_seq.to_le_bytes());
+    b[12..16].copy_from_slice(&(blocks as u32).to_le_bytes());
+    b[36..40].copy_from_slice(&flags.to_le_bytes());
+
+    let crc = log::stm32_crc(&b[..log::INDEX_SIZE - 4]);
+    b[log::INDEX_SIZE - 4..].copy_from_slice(&crc.to_le_bytes());
+    b.to_vec()
+}
+
+fn write(path: &std::path::Path, data: &[u8]) -> std::io::Result<std::path::PathBuf> {
+    std::fs::write(path, data)?;
+    Ok(path.to_path_buf())
+}
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let dir = std::env::temp_dir().join(format!("segment_check.{}", std::process::id()));
+    let path = dir.join("LOG00001_000.BIN");
+    let index = dir.join(log::INDEX_FILE);
+
+    std::fs::create_dir_all(&dir)?;
+
+    let mut file = session(1_000_000 + 3 * SAMPLE_TICKS as u64, SEGMENT_SIZE / BLOCK_SIZE);
+    let live = session(1_000_000, LIVE);
+    let want = LogFile::open(write(&dir.join("LOG00002_000.BIN"), &live)?)?;
+    let want = want.read(want.info().start, want.info().end);
+
+    file[..live.len()].copy_from_slice(&live);
+    write(&path, &file)?;
+
+    let cases = [
+        ("no index", None),
+        ("an earlier sync", Some(entry(LIVE / 3, 0, 0))),
+        ("a closed record", Some(entry(LIVE, log::INDEX_CLOSED, 0))),
+        ("another segment's record", Some(entry(LIVE / 3, log::INDEX_CLOSED, 7))),
+    ];
+
+    for (name, record) in cases {
+        match record {
+            Some(r) => std::fs::write(&index, r)?,
+            None => drop(std::fs::remove_file(&index)),
+        }
+
+        let log = LogFile::open(&path)?;
+        let seg = &log.segments()[0];
+        let got = log.read(log.info().start, log.info().end);
+
+        if seg.blocks() != LIVE || got.len() != want.len() || got.time != want.time {
+            return Err(format!(
+                "{}: {} blocks, {} samples; want {} blocks, {} samples",
+                name,
+                seg.blocks(),
+                got.len(),
+                LIVE,
+                want.len()
+            )
+            .into());
+        }
+
+        println!("{}: ends after block {} of {}, {} samples", name, seg.blocks(), SEGMENT_SIZE / BLOCK_SIZE, got.len());
+    }
+
+    std::fs::remove_dir_all(&dir)?;
+    Ok(())
+}
@@ -0,0 +1,437 @@
+// Energy and power-limit analysis over a range of a logged session.
+//
+// One pass over the samples, chunk by chunk as LogFile::chunks decodes them
+// (the next chunk decodes while this one is analysed). Energy and charge are
+// integrated by the trapezoid rule between neighbouring samples and the
+// extremes of each channel are kept; those loops run over independent lanes
+// so the compiler vectorises them, block by block while the block is in
+// cache. An interval longer than GAP_PERIODS sample periods is a gap, left by
+// bad blocks or a pause in logging, and counts for nothing.
+//
+// The power limit of the FSG/FSK rules (EV 2.2) is checked both ways the
+// rules define a violation: power above the limit for longer than
+// `sustained`, and the moving average of power over `window` above the limit.
+// Each violation is an interval, reported with the highest power or average
+// in it. Both tests start over after a gap.
+
+use serde::{Deserialize, Serialize};
+
+use crate::downsample::min_max;
+use crate::reader::{Columns, LogFile};
+
+/// Samples decoded and analysed at a time; progress is reported after each.
+pub const CHUNK_SAMPLES: usize = 1 << 20;
+
+/// Intervals longer than this many sample periods are gaps.
+pub const GAP_PERIODS: f64 = 1.5;
+
+const LANES: usize = 8;
+
+// samples every pass takes in turn, small enough for them to stay in cache
+const BLOCK: usize = 8192;
+
+/// The power limit and how it is tested, by default as in the FSG rules.
+#[derive(Debug, Clone, Copy, Deserialize, Serialize)]
+#[serde(default)]
+pub struct Limits {
+    /// W
+    pub power: f32,
+    /// seconds power may stay above the limit
+    pub sustained: f64,
+    /// seconds the moving average spans
+    pub window: f64,
+}
+
+impl Default for Limits {
+    fn default() -> Self {
+        Limits { power: 80_000.0, sustained: 0.1, window: 0.5 }
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize)]
+#[serde(rename_all = "lowercase")]
+pub enum Rule {
+    /// above the limit for longer than Limits::sustained
+    Sustained,
+    /// moving average above the limit
+    Average,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Serialize)]
+pub struct Violation {
+    pub rule: Rule,
+    /// from the first sample (or window) over the limit to the end of the last, seconds since 1970
+    pub start: f64,
+    pub end: f64,
+    /// highest power, or average, in the interval
+    pub peak: f32,
+}
+
+/// Lowest and highest value of a channel and when they occurred; the first
+/// occurrence when a value repeats.
+#[derive(Debug, Clone, Copy, PartialEq, Serialize)]
+pub struct Extremes {
+    pub min: f32,
+    pub min_time: f64,
+    pub max: f32,
+    pub max_time: f64,
+}
+
+impl Default for Extremes {
+    fn default() -> Self {
+        Extremes { min: f32::INFINITY, min_time: 0.0, max: f32::NEG_INFINITY, max_time: 0.0 }
+    }
+}
+
+impl Extremes {
+    // the times are looked for only when the block holds a new extreme,
+    // which after the first few blocks it seldom does
+    fn add(&mut self, v: &[f32], time: &[f64]) {
+        let (lo, hi) = min_max(v);
+
+        if lo < self.min {
+            (self.min, self.min_time) = (lo, time[v.iter().position(|&x| x == lo).unwrap()]);
+        }
+
+        if hi > self.max {
+            (self.max, self.max_time) = (hi, time[v.iter().position(|&x| x == hi).unwrap()]);
+        }
+    }
+}
+
+#[derive(Debug, Clone, Default, Serialize)]
+pub struct Analysis {
+    /// times of the first and last sample analysed, seconds since 1970
+    pub start: f64,
+    pub end: f64,
+    pub samples: u64,
+    /// blocks left out for a bad CRC
+    pub bad_blocks: u32,
+    /// seconds covered by samples, gaps left out
+    pub duration: f64,
+    /// energy drawn from the accumulator less energy put back, kWh
+    pub energy_kwh: f64,
+    /// energy put back by recuperation, kWh
+    pub regen_kwh: f64,
+    /// charge drawn less charge put back, Ah
+    pub charge_ah: f64,
+    pub regen_ah: f64,
+    pub voltage: Extremes,
+    pub current: Extremes,
+    pub power: Extremes,
+    /// highest moving average of power, W, and the end of its window
+    pub average_max: f32,
+    pub average_max_time: f64,
+    pub violations: Vec<Violation>,
+}
+
+#[derive(Debug, Clone, Serialize)]
+pub struct Progress {
+    /// samples analysed so far
+    pub samples: u64,
+    /// samples in the range, counting blocks that may turn out bad
+    pub total: u64,
+    /// the analysis of the samples so far; violations still open are left out
+    pub analysis: Analysis,
+}
+
+// trapezoid integrals of `a` and `b` over `time`, each as (net, negative
+// part), and the time covered, gaps longer than `gap` left out
+fn integrate(time: &[f64], a: &[f32], b: &[f32], gap: f64) -> ([f64; 2], [f64; 2], f64) {
+    let mut acc = [[0.0f64; LANES]; 5];
+    let n = time.len().saturating_sub(1);
+    let body = n / LANES * LANES;
+
+    let step = |acc: &mut [[f64; LANES]; 5], l: usize, t: [f64; 2], a: [f32; 2], b: [f32; 2]| {
+        let dt = t[1] - t[0];
+        let dt = if dt <= gap { dt } else { 0.0 };
+        let ea = (a[0] as f64 + a[1] as f64) * 0.5 * dt;
+        let eb = (b[0] as f64 + b[1] as f64) * 0.5 * dt;
+
+        acc[0][l] += ea;
+        acc[1][l] += ea.min(0.0);
+        acc[2][l] += eb;
+        acc[3][l] += eb.min(0.0);
+        acc[4][l] += dt;
+    };
+
+    // fixed-size windows, so the lanes compile without bounds checks
+    for o in (0..body).step_by(LANES) {
+        let t: &[f64; LANES + 1] = time[o..=o + LANES].try_into().unwrap();
+        let x: &[f32; LANES + 1] = a[o..=o + LANES].try_into().unwrap();
+        let y: &[f32; LANES + 1] = b[o..=o + LANES].try_into().unwrap();
+
+        for l in 0..LANES {
+            step(&mut acc, l, [t[l], t[l + 1]], [x[l], x[l + 1]], [y[l], y[l + 1]]);
+        }
+    }
+
+    for i in body..n {
+        step(&mut acc, 0, [time[i], time[i + 1]], [a[i], a[i + 1]], [b[i], b[i + 1]]);
+    }
+
+    let sum = |k: usize| acc[k].iter().sum::<f64>();
+    ([sum(0), sum(1)], [sum(2), sum(3)], sum(4))
+}
+
+// a stretch over the limit still going
+#[derive(Debug, Clone, Copy)]
+struct Run {
+    start: f64,
+    last: f64,
+    samples: usize,
+    peak: f32,
+}
+
+/// Analysis fed one chunk of consecutive samples at a time.
+pub struct Analyzer {
+    limits: Limits,
+    period: f64,
+    gap: f64,
+    // samples the moving average spans
+    window: usize,
+    result: Analysis,
+    // energy and charge in J and C while integrating, with their negative parts
+    energy: [f64; 2],
+    charge: [f64; 2],
+    // the sample before the current block: time, current, power
+    last: Option<(f64, f32, f32)>,
+    // up to window - 1 powers before the current block, since the last gap
+    tail: Vec<f32>,
+    // scratch for the moving averages of a block
+    powers: Vec<f32>,
+    sums: Vec<f64>,
+    averages: Vec<f32>,
+    over: Option<Run>,
+    average_over: Option<Run>,
+}
+
+impl Analyzer {
+    pub fn new(limits: Limits, sample_rate: f64) -> Analyzer {
+        let period = 1.0 / sample_rate;
+
+        Analyzer {
+            limits,
+            period,
+            gap: period * GAP_PERIODS,
+            window: ((limits.window / period).round() as usize).max(1),
+            result: Analysis { average_max: f32::NEG_INFINITY, ..Analysis::default() },
+            energy: [0.0; 2],
+            charge: [0.0; 2],
+            last: None,
+            tail: Vec::new(),
+            powers: Vec::new(),
+            sums: Vec::new(),
+            averages: Vec::new(),
+            over: None,
+            average_over: None,
+        }
+    }
+
+    fn close(&mut self, rule: Rule) {
+        let run = match rule {
+            Rule::Sustained => self.over.take(),
+            Rule::Average => self.average_over.take(),
+        };
+        let Some(run) = run else {
+            return;
+        };
+
+        // the rule says longer than `sustained`, so a run exactly that long passes
+        let long = run.samples as f64 * self.period > self.limits.sustained + self.period * 1e-6;
+
+        if rule == Rule::Average || long {
+            self.result.violations.push(Violation {
+                rule,
+                start: run.start,
+                end: run.last + self.period,
+                peak: run.peak,
+            });
+        }
+    }
+
+    fn restart(&mut self) {
+        self.close(Rule::Sustained);
+        self.close(Rule::Average);
+        self.tail.clear();
+    }
+
+    fn extend(run: &mut Option<Run>, start: f64, t: f64, value: f32) {
+        let run = run.get_or_insert(Run { start, last: t, samples: 0, peak: value });
+
+        run.last = t;
+        run.samples += 1;
+        run.peak = run.peak.max(value);
+    }
+
+    fn integrate(&mut self, time: &[f64], current: &[f32], power: &[f32]) {
+        let (e, q, dt) = integrate(time, power, current, self.gap);
+
+        self.energy[0] += e[0];
+        self.energy[1] += e[1];
+        self.charge[0] += q[0];
+        self.charge[1] += q[1];
+        self.result.duration += dt;
+    }
+
+    // the rule tests over samples with no gap between them or before them.
+    // Runs are only followed sample by sample where one is open or the
+    // samples reach over the limit, which they seldom do
+    fn rules(&mut self, time: &[f64], power: &[f32]) {
+        let limit = self.limits.power;
+        let n = self.window;
+
+        if self.over.is_some() || min_max(power).1 > limit {
+            for (&t, &p) in time.iter().zip(power) {
+                if p > limit {
+                    Self::extend(&mut self.over, t, t, p);
+                } else if self.over.is_some() {
+                    self.close(Rule::Sustained);
+                }
+            }
+        }
+
+        // the average of each window ending in these samples, from prefix
+        // sums over the tail before them; they restart every block, so they
+        // neither drift nor lose precision over a long log
+        self.powers.clear();
+        self.powers.extend_from_slice(&self.tail);
+        self.powers.extend_from_slice(power);
+
+        let mut sum = 0.0;
+
+        self.sums.clear();
+        self.sums.push(0.0);
+        self.sums.extend(self.powers.iter().map(|&p| {
+            sum += p as f64;
+            sum
+        }));
+
+        // window ends from powers[n - 1], at time[n - 1 - tail]
+        let count = self.powers.len().saturating_sub(n - 1);
+        let skip = n - 1 - self.tail.len();
+
+        self.averages.clear();
+        self.averages.extend(
+            self.sums[n.min(self.sums.len())..]
+                .iter()
+                .zip(&self.sums[..count])
+                .map(|(b, a)| ((b - a) / n as f64) as f32),
+        );
+        self.tail.clear();
+        self.tail.extend_from_slice(&self.powers[self.powers.len().saturating_sub(n - 1)..]);
+
+        if count == 0 {
+            return;
+        }
+
+        let (_, max) = min_max(&self.averages);
+
+        if max > self.result.average_max {
+            let at = self.averages.iter().position(|&a| a == max).unwrap();
+
+            (self.result.average_max, self.result.average_max_time) = (max, time[skip + at]);
+        }
+
+        if self.average_over.is_some() || max > limit {
+            let span = (n - 1) as f64 * self.period;
+
+            for k in 0..count {
+                let (t, average) = (time[skip + k], self.averages[k]);
+
+                if average > limit {
+                    Self::extend(&mut self.average_over, t - span, t, average);
+                } else if self.average_over.is_some() {
+                    self.close(Rule::Average);
+                }
+            }
+        }
+    }
+
+    /// Takes the next samples, which follow the last chunk fed in time.
+    pub fn feed(&mut self, c: &Columns) {
+        let r = &mut self.result;
+
+        r.bad_blocks += c.bad_blocks;
+
+        if c.is_empty() {
+            return;
+        }
+
+        if r.samples == 0 {
+            r.start = c.time[0];
+        }
+
+        r.samples += c.len() as u64;
+        r.end = c.time[c.len() - 1];
+
+        // every pass over a block while it is still in cache
+        for a in (0..c.len()).step_by(BLOCK) {
+            let b = (a + BLOCK).min(c.len());
+            let (time, current, power) = (&c.time[a..b], &c.current[a..b], &c.power[a..b]);
+            let r = &mut self.result;
+
+            r.voltage.add(&c.voltage[a..b], time);
+            r.current.add(current, time);
+            r.power.add(power, time);
+
+            // the interval from the last block, then the ones within this block
+            if let Some((t, i, p)) = self.last {
+                self.integrate(&[t, time[0]], &[i, current[0]], &[p, power[0]]);
+            }
+
+            self.integrate(time, current, power);
+
+            // the rules start over at each gap
+            let mut prev = self.last.map_or(time[0], |(t, _, _)| t);
+            let mut from = 0;
+
+            for (k, &t) in time.iter().enumerate() {
+                if t - prev > self.gap {
+                    self.rules(&time[from..k], &power[from..k]);
+                    self.restart();
+                    from = k;
+                }
+
+                prev = t;
+            }
+
+            self.rules(&time[from..], &power[from..]);
+            self.last = Some((time[b - a - 1], current[b - a - 1], power[b - a - 1]));
+        }
+
+        let r = &mut self.result;
+
+        r.energy_kwh = self.energy[0] / 3.6e6;
+        r.regen_kwh = -self.energy[1] / 3.6e6;
+        r.charge_ah = self.charge[0] / 3600.0;
+        r.regen_ah = -self.charge[1] / 3600.0;
+    }
+
+    /// The analysis of the samples so far, leaving out violations still open.
+    pub fn result(&self) -> &Analysis {
+        &self.result
+    }
+
+    /// The analysis of everything fed, closing the violations still open.
+    pub fn finish(mut self) -> Analysis {
+        self.restart();
+        self.result
+    }
+}
+
+/// Analyses the samples of `log` from `start` to `end`, wall-clock seconds
+/// since 1970, calling `progress` with the partial result after every chunk.
+pub fn analyze<P: FnMut(&Progress)>(log: &LogFile, start: f64, end: f64, limits: Limits, mut progress: P) -> Analysis {
+    let chunks = log.chunks(start, end, CHUNK_SAMPLES);
+    let total = chunks.total() as u64;
+    let mut analyzer = Analyzer::new(limits, log.info().sample_rate as f64);
+
+    let _ = chunks.prefetch(|chunk| {
+        analyzer.feed(&chunk);
+        progress(&Progress { samples: analyzer.result.samples, total, analysis: analyzer.result.clone() });
+        Ok::<_, ()>(())
+    });
+
+    analyzer.finish()
+}
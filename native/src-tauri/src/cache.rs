@@ -0,0 +1,363 @@
+// On-disk cache of decoded segments, so a session reopens without decoding.
+//
+// A segment decodes to one entry file: the columns as LogFile::read gives
+// them, the time of each bad block, and a min/max pyramid over fixed sample
+// counts for the charts. The entry is laid out so the mapped file is used in
+// place; entries are in the host's byte order and never leave the machine.
+//
+// An entry is named by a key that opening can afford: CACHE_VERSION, the
+// file's length and modification time, its session block, the CRC of every
+// KEY_STRIDE-th block and its last KEY_TAIL blocks. A copy that keeps the
+// length and time and differs only in blocks the key skips still meets the
+// entry, so the entry also holds a hash of the CRCs of all the segment's
+// blocks, which the background fill checks once the segment is open; an
+// entry that fails is dropped and the segment is read from its file.
+//
+// The directory is held under a size limit by deleting the least recently
+// used entries first; loading an entry bumps its modification time.
+
+use std::fs::{self, File};
+use std::io::{self, BufWriter, Write};
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::time::{SystemTime, UNIX_EPOCH};
+
+use memmap2::Mmap;
+use rayon::prelude::*;
+
+use crate::downsample::min_max;
+use crate::log::BLOCK_SIZE;
+use crate::reader::{Columns, Segment};
+
+/// Bump with any change to decoding or to the entry layout.
+pub const CACHE_VERSION: u32 = 2;
+
+/// Default size the cache directory is held to.
+pub const CACHE_LIMIT: u64 = 2 << 30;
+
+/// Samples a level 0 pyramid bucket covers; each level up is PYRAMID_FACTOR times coarser.
+pub const PYRAMID_BASE: usize = 64;
+pub const PYRAMID_FACTOR: usize = 16;
+pub const PYRAMID_LEVELS: usize = 4;
+
+const MAGIC: [u8; 4] = *b"FSKC";
+const HEADER: usize = 64;
+const EXTENSION: &str = "col";
+
+// the key reads a page in eight of the log
+const KEY_STRIDE: usize = 64;
+const KEY_TAIL: usize = 16;
+
+// voltage, current, power, LV voltage, temperature
+const COLUMNS: usize = 5;
+
+/// Channel ranges over one pyramid bucket, in `Columns` order.
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct MinMax {
+    pub min: [f32; COLUMNS],
+    pub max: [f32; COLUMNS],
+}
+
+/// Samples a bucket of pyramid level `level` covers.
+pub const fn bucket_samples(level: usize) -> usize {
+    PYRAMID_BASE * PYRAMID_FACTOR.pow(level as u32)
+}
+
+fn fnv(h: u64, bytes: &[u8]) -> u64 {
+    bytes.iter().fold(h, |h, &b| (h ^ b as u64).wrapping_mul(0x100_0000_01b3))
+}
+
+/// Name of the entry for `seg`, without reading more than a fraction of it.
+pub fn key(seg: &Segment) -> u64 {
+    let n = seg.blocks();
+    let mut h = fnv(0xcbf2_9ce4_8422_2325, &CACHE_VERSION.to_le_bytes());
+    let meta = fs::metadata(seg.path()).ok();
+    let modified = meta.as_ref().and_then(|m| m.modified().ok()).and_then(|t| t.duration_since(UNIX_EPOCH).ok());
+
+    h = fnv(h, &(n as u64).to_le_bytes());
+    h = fnv(h, &meta.map_or(0, |m| m.len()).to_le_bytes());
+    h = fnv(h, &modified.map_or(0, |t| t.as_nanos()).to_le_bytes());
+    h = fnv(h, seg.raw(0));
+
+    for i in (KEY_STRIDE..n).step_by(KEY_STRIDE) {
+        h = fnv(h, &seg.raw(i)[BLOCK_SIZE - 4..]);
+    }
+
+    for i in n.saturating_sub(KEY_TAIL).max(1)..n {
+        h = fnv(h, seg.raw(i));
+    }
+
+    h
+}
+
+/// Hash of the CRCs of all the blocks of `seg`, which reads all of it.
+pub fn crcs(seg: &Segment) -> u64 {
+    (0..seg.blocks()).fold(0xcbf2_9ce4_8422_2325, |h, i| fnv(h, &seg.raw(i)[BLOCK_SIZE - 4..]))
+}
+
+// byte offsets of the parts of an entry of `n` samples and `bad` bad blocks
+struct Layout {
+    columns: usize,
+    bad: usize,
+    levels: [usize; PYRAMID_LEVELS],
+    size: usize,
+}
+
+impl Layout {
+    fn new(n: usize, bad: usize) -> Layout {
+        let columns = HEADER + n * 8;
+        let bad_at = (columns + n * 4 * COLUMNS).next_multiple_of(8);
+        let mut levels = [0; PYRAMID_LEVELS];
+        let mut at = bad_at + bad * 8;
+
+        for (l, level) in levels.iter_mut().enumerate() {
+            *level = at;
+            at += n.div_ceil(bucket_samples(l)) * size_of::<MinMax>();
+        }
+
+        Layout { columns, bad: bad_at, levels, size: at }
+    }
+}
+
+/// A mapped cache entry.
+pub struct Decoded {
+    map: Mmap,
+    samples: usize,
+    bad: usize,
+    layout: Layout,
+}
+
+impl Decoded {
+    fn open(path: &Path, key: u64) -> Option<Decoded> {
+        let map = unsafe { Mmap::map(&File::open(path).ok()?).ok()? };
+        let word = |at: usize| map.get(at..at + 8).map(|b| u64::from_ne_bytes(b.try_into().unwrap()));
+
+        if map.get(..4)? != MAGIC || map.get(4..8)? != CACHE_VERSION.to_ne_bytes() || word(8)? != key {
+            return None;
+        }
+
+        let (samples, bad) = (word(16)? as usize, word(24)? as usize);
+
+        if samples > map.len() || bad > map.len() {
+            return None;
+        }
+
+        let layout = Layout::new(samples, bad);
+
+        // the columns are used in place, so the map has to be aligned for f64
+        if map.len() != layout.size || map.as_ptr() as usize % 8 != 0 {
+            return None;
+        }
+
+        Some(Decoded { map, samples, bad, layout })
+    }
+
+    fn slice<T>(&self, at: usize, n: usize) -> &[T] {
+        // in bounds and aligned: checked against the layout in open
+        unsafe { std::slice::from_raw_parts(self.map.as_ptr().add(at) as *const T, n) }
+    }
+
+    pub fn len(&self) -> usize {
+        self.samples
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.samples == 0
+    }
+
+    /// `crcs` of the segment the entry was made from.
+    pub fn crcs(&self) -> u64 {
+        u64::from_ne_bytes(self.map[32..40].try_into().unwrap())
+    }
+
+    /// Seconds since 1970.
+    pub fn time(&self) -> &[f64] {
+        self.slice(HEADER, self.samples)
+    }
+
+    /// Column `k` in `Columns` order: voltage, current, power, LV voltage, temperature.
+    pub fn column(&self, k: usize) -> &[f32] {
+        self.slice(self.layout.columns + k * self.samples * 4, self.samples)
+    }
+
+    /// Time of the first sample of each block left out for a bad CRC.
+    pub fn bad_times(&self) -> &[f64] {
+        self.slice(self.layout.bad, self.bad)
+    }
+
+    /// Buckets of pyramid level `level`, bucket `i` over samples from `i * bucket_samples(level)`.
+    pub fn level(&self, level: usize) -> &[MinMax] {
+        self.slice(self.layout.levels[level], self.samples.div_ceil(bucket_samples(level)))
+    }
+
+    /// Appends the samples from `start` to `end`, wall-clock seconds since 1970, to `out`.
+    pub fn read(&self, start: f64, end: f64, out: &mut Columns) {
+        let time = self.time();
+        let (a, b) = (time.partition_point(|&t| t < start), time.partition_point(|&t| t < end));
+        let bad = self.bad_times();
+
+        out.time.extend_from_slice(&time[a..b]);
+
+        for (k, col) in out.columns_mut().into_iter().enumerate() {
+            col.extend_from_slice(&self.column(k)[a..b]);
+        }
+
+        out.bad_blocks += (bad.partition_point(|&t| t < end) - bad.partition_point(|&t| t < start)) as u32;
+    }
+}
+
+fn bytes<T: Copy>(v: &[T]) -> &[u8] {
+    unsafe { std::slice::from_raw_parts(v.as_ptr() as *const u8, std::mem::size_of_val(v)) }
+}
+
+fn pyramid(c: &Columns) -> Vec<Vec<MinMax>> {
+    let columns = c.columns();
+    let base: Vec<MinMax> = (0..c.len().div_ceil(PYRAMID_BASE))
+        .into_par_iter()
+        .map(|i| {
+            let range = i * PYRAMID_BASE..((i + 1) * PYRAMID_BASE).min(c.len());
+            let mut m = MinMax { min: [0.0; COLUMNS], max: [0.0; COLUMNS] };
+
+            for (k, col) in columns.iter().enumerate() {
+                (m.min[k], m.max[k]) = min_max(&col[range.clone()]);
+            }
+
+            m
+        })
+        .collect();
+    let mut levels = vec![base];
+
+    while levels.len() < PYRAMID_LEVELS {
+        let up = levels[levels.len() - 1]
+            .chunks(PYRAMID_FACTOR)
+            .map(|group| {
+                group.iter().skip(1).fold(group[0], |mut m, g| {
+                    for k in 0..COLUMNS {
+                        m.min[k] = m.min[k].min(g.min[k]);
+                        m.max[k] = m.max[k].max(g.max[k]);
+                    }
+                    m
+                })
+            })
+            .collect();
+
+        levels.push(up);
+    }
+
+    levels
+}
+
+/// The cache directory and the size it is held to.
+#[derive(Debug, Clone)]
+pub struct Cache {
+    dir: PathBuf,
+    limit: u64,
+}
+
+// tells apart temporary files of builds running at once
+static BUILDS: AtomicU32 = AtomicU32::new(0);
+
+impl Cache {
+    pub fn new(dir: PathBuf, limit: u64) -> Cache {
+        Cache { dir, limit }
+    }
+
+    fn path(&self, key: u64) -> PathBuf {
+        self.dir.join(format!("{:016x}.{}", key, EXTENSION))
+    }
+
+    /// The entry for `seg`, if there is a good one.
+    pub fn load(&self, seg: &Segment) -> Option<Decoded> {
+        let key = key(seg);
+        let path = self.path(key);
+        let decoded = Decoded::open(&path, key)?;
+
+        // recency for eviction; a read-only cache still serves
+        let _ = File::options().write(true).open(&path).and_then(|f| f.set_modified(SystemTime::now()));
+        Some(decoded)
+    }
+
+    /// Writes the entry for `seg` from its full decode and the times of its
+    /// bad blocks, evicts down to the limit and maps the result.
+    pub fn store(&self, seg: &Segment, c: &Columns, bad: &[f64]) -> io::Result<Decoded> {
+        let key = key(seg);
+        let path = self.path(key);
+        let tmp = self.dir.join(format!("{:016x}.{}.{}.tmp", key, std::process::id(), BUILDS.fetch_add(1, Ordering::Relaxed)));
+        let layout = Layout::new(c.len(), bad.len());
+
+        fs::create_dir_all(&self.dir)?;
+
+        let mut out = BufWriter::new(File::create(&tmp)?);
+        let mut header = [0u8; HEADER];
+
+        header[..4].copy_from_slice(&MAGIC);
+        header[4..8].copy_from_slice(&CACHE_VERSION.to_ne_bytes());
+        header[8..16].copy_from_slice(&key.to_ne_bytes());
+        header[16..24].copy_from_slice(&(c.len() as u64).to_ne_bytes());
+        header[24..32].copy_from_slice(&(bad.len() as u64).to_ne_bytes());
+        header[32..40].copy_from_slice(&crcs(seg).to_ne_bytes());
+
+        out.write_all(&header)?;
+        out.write_all(bytes(&c.time))?;
+
+        for col in c.columns() {
+            out.write_all(bytes(col))?;
+        }
+
+        out.write_all(&[0; 8][..layout.bad - (layout.columns + c.len() * 4 * COLUMNS)])?;
+        out.write_all(bytes(bad))?;
+
+        for level in pyramid(c) {
+            out.write_all(bytes(&level))?;
+        }
+
+        out.into_inner().map_err(|e| e.into_error())?.sync_all()?;
+        fs::rename(&tmp, &path).inspect_err(|_| drop(fs::remove_file(&tmp)))?;
+
+        let decoded = Decoded::open(&path, key)
+            .ok_or_else(|| io::Error::new(io::ErrorKind::InvalidData, "cache entry unreadable"))?;
+
+        // a failed eviction only leaves the cache large
+        let _ = self.evict();
+        Ok(decoded)
+    }
+
+    /// Deletes the entry for `seg`, once it turned out stale.
+    pub fn discard(&self, seg: &Segment) -> io::Result<()> {
+        fs::remove_file(self.path(key(seg)))
+    }
+
+    /// Deletes the least recently used entries until the directory fits the limit.
+    pub fn evict(&self) -> io::Result<()> {
+        let mut entries = Vec::new();
+        let mut total = 0;
+
+        for e in fs::read_dir(&self.dir)? {
+            let e = e?;
+            let path = e.path();
+
+            if path.extension().and_then(|x| x.to_str()) == Some(EXTENSION) {
+                let meta = e.metadata()?;
+
+                total += meta.len();
+                entries.push((meta.modified()?, meta.len(), path));
+            }
+        }
+
+        entries.sort();
+
+        for (_, len, path) in entries {
+            if total <= self.limit {
+                break;
+            }
+
+            // an entry mapped elsewhere may refuse to go on some systems; it goes next time
+            if fs::remove_file(&path).is_ok() {
+                total -= len;
+            }
+        }
+
+        Ok(())
+    }
+}
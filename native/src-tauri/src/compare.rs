@@ -0,0 +1,407 @@
+// Sessions overlaid on a common time axis, for comparing stints and setups.
+//
+// A session is a range of an open log; the LogFile, its maps and its cache
+// entries are shared with everything else reading it. Aligning a session
+// picks the wall-clock time that becomes its zero: its start, a marker the
+// user placed (a lap line, a driver change), the first time power rises over
+// a threshold, or the shift of its power trace against the reference
+// session's that correlates best. The meter records no distance or lap
+// signal, so laps come in as markers.
+//
+// Correlation works on power averaged to CORRELATE_RATE and searches coarse
+// to fine: every shift within the allowed lag at 1/COARSE_FACTOR of that
+// rate, then around the best at the full rate, with the peak interpolated
+// between shifts. Shifts are scored in parallel.
+//
+// The comparison bins every session over the same aligned window, clipped to
+// the session's range: means of voltage, current and power, the energy used
+// since the window start or the session start if that is later, and the
+// differences of power and energy to the reference session. Sessions are
+// binned in parallel, each reading its range READ_SECONDS at a time through
+// LogFile::read, which serves cached segments from the cache.
+
+use std::io;
+
+use rayon::prelude::*;
+use serde::{Deserialize, Serialize};
+
+use crate::analysis::GAP_PERIODS;
+use crate::reader::LogFile;
+
+/// Power trace rate for correlation, Hz.
+pub const CORRELATE_RATE: f64 = 10.0;
+
+/// Most bins a comparison returns.
+pub const POINTS_MAX: usize = 16384;
+
+// the coarse search runs at CORRELATE_RATE / COARSE_FACTOR, and the fine one
+// over FINE_SPAN shifts either side of the coarse best
+const COARSE_FACTOR: usize = 10;
+const FINE_SPAN: isize = 2 * COARSE_FACTOR as isize;
+
+// overlap a shift needs, of the shorter trace
+const MIN_OVERLAP: f64 = 0.25;
+
+// seconds of a session read at a time, 10 MB at 100 Hz
+const READ_SECONDS: f64 = 3600.0;
+
+const LANES: usize = 16;
+
+/// A range of an open log to compare.
+#[derive(Debug, Clone, Deserialize)]
+pub struct Session {
+    pub path: String,
+    /// wall-clock range, seconds since 1970
+    pub start: f64,
+    pub end: f64,
+    /// wall-clock time to align on, for Align::Marker
+    #[serde(default)]
+    pub marker: Option<f64>,
+}
+
+#[derive(Debug, Clone, Copy, Deserialize)]
+#[serde(tag = "mode", rename_all = "lowercase")]
+pub enum Align {
+    /// session starts
+    Start,
+    /// each session's marker
+    Marker,
+    /// the first time power rises over `power`, W
+    Threshold { power: f32 },
+    /// the shift of the power trace against the reference's that correlates
+    /// best, up to `max_lag` seconds either way; the reference keeps its
+    /// marker, or its start
+    Correlate { max_lag: f64 },
+}
+
+#[derive(Debug, Clone, Copy, Serialize)]
+pub struct Alignment {
+    /// wall-clock time that becomes the session's zero
+    pub zero: f64,
+    /// normalised correlation with the reference at that shift, for Align::Correlate
+    pub score: Option<f32>,
+}
+
+/// One session binned over the aligned window; NaN in bins without samples
+/// and, energy too, in bins outside the session.
+#[derive(Debug, Clone, Default)]
+pub struct Series {
+    pub voltage: Vec<f32>,
+    pub current: Vec<f32>,
+    pub power: Vec<f32>,
+    /// kWh used from the window or session start to the end of each bin
+    pub energy: Vec<f32>,
+    /// less the reference's
+    pub power_diff: Vec<f32>,
+    pub energy_diff: Vec<f32>,
+}
+
+#[derive(Debug, Clone, Default)]
+pub struct Comparison {
+    /// aligned time of the start of the first bin, and the bin width, seconds
+    pub from: f64,
+    pub step: f64,
+    pub reference: usize,
+    /// in the order of the sessions
+    pub series: Vec<Series>,
+}
+
+fn invalid(msg: String) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidInput, msg)
+}
+
+// `f` with the samples of `log` from `start` to `end`, READ_SECONDS at a time
+fn scan<F: FnMut(&[f64], &[f32], &[f32], &[f32]) -> bool>(log: &LogFile, start: f64, end: f64, mut f: F) {
+    let mut a = start;
+
+    while a < end {
+        let b = (a + READ_SECONDS).min(end);
+        let c = log.read(a, b);
+
+        if !f(&c.time, &c.voltage, &c.current, &c.power) {
+            return;
+        }
+
+        a = b;
+    }
+}
+
+// sums over `n` bins of `width` seconds from `origin`, wall-clock, of the
+// samples from `start` to `end`
+struct Bins {
+    // bins that overlap that range; the others stay empty
+    covered: std::ops::Range<usize>,
+    count: Vec<u32>,
+    sums: [Vec<f64>; 3],
+    // J, by the trapezoid rule, each interval in the bin of its later sample
+    energy: Vec<f64>,
+}
+
+impl Bins {
+    fn new(log: &LogFile, origin: f64, width: f64, n: usize, start: f64, end: f64) -> Bins {
+        let (a, b) = (origin.max(start), (origin + width * n as f64).min(end));
+        let covered =
+            if a < b { ((a - origin) / width) as usize..(((b - origin) / width).ceil() as usize).min(n) } else { 0..0 };
+        let mut bins =
+            Bins { covered, count: vec![0; n], sums: std::array::from_fn(|_| vec![0.0; n]), energy: vec![0.0; n] };
+        let gap = GAP_PERIODS / log.info().sample_rate.max(1) as f64;
+        let mut last: Option<(f64, f32)> = None;
+
+        scan(log, a, b, |time, voltage, current, power| {
+            for i in 0..time.len() {
+                // the last bin ends where the read does; rounding may put its last sample past it
+                let k = (((time[i] - origin) / width) as usize).clamp(bins.covered.start, bins.covered.end - 1);
+
+                bins.count[k] += 1;
+                bins.sums[0][k] += voltage[i] as f64;
+                bins.sums[1][k] += current[i] as f64;
+                bins.sums[2][k] += power[i] as f64;
+
+                if let Some((t, p)) = last.filter(|&(t, _)| time[i] - t <= gap) {
+                    bins.energy[k] += (p as f64 + power[i] as f64) * 0.5 * (time[i] - t);
+                }
+
+                last = Some((time[i], power[i]));
+            }
+
+            true
+        });
+
+        bins
+    }
+
+    fn mean(&self, channel: usize) -> Vec<f32> {
+        self.sums[channel]
+            .iter()
+            .zip(&self.count)
+            .map(|(&s, &c)| if c > 0 { (s / c as f64) as f32 } else { f32::NAN })
+            .collect()
+    }
+
+    // kWh from the first covered bin to the end of each, NaN outside them
+    fn used(&self) -> Vec<f32> {
+        let mut used = 0.0;
+
+        self.energy
+            .iter()
+            .enumerate()
+            .map(|(k, e)| {
+                if !self.covered.contains(&k) {
+                    return f32::NAN;
+                }
+
+                used += e;
+                (used / 3.6e6) as f32
+            })
+            .collect()
+    }
+}
+
+/// Mean power of each 1 / CORRELATE_RATE from `start` to `end`, NaN where there are no samples.
+pub fn power_trace(log: &LogFile, start: f64, end: f64) -> Vec<f32> {
+    let n = ((end - start) * CORRELATE_RATE).ceil().max(0.0) as usize;
+
+    if n == 0 {
+        return Vec::new();
+    }
+
+    Bins::new(log, start, 1.0 / CORRELATE_RATE, n, start, end).mean(2)
+}
+
+// less the mean, with missing values at zero so they add nothing
+fn centred(v: &[f32]) -> Vec<f32> {
+    let (sum, n) = v.iter().filter(|x| !x.is_nan()).fold((0.0f64, 0usize), |(s, n), &x| (s + x as f64, n + 1));
+    let mean = (sum / n.max(1) as f64) as f32;
+
+    v.iter().map(|&x| if x.is_nan() { 0.0 } else { x - mean }).collect()
+}
+
+fn decimate(v: &[f32], factor: usize) -> Vec<f32> {
+    v.chunks(factor).map(|c| c.iter().sum::<f32>() / c.len() as f32).collect()
+}
+
+fn dot(a: &[f32], b: &[f32]) -> f64 {
+    let mut acc = [0.0f32; LANES];
+    let (ca, cb) = (a.chunks_exact(LANES), b.chunks_exact(LANES));
+    let tail: f32 = ca.remainder().iter().zip(cb.remainder()).map(|(x, y)| x * y).sum();
+
+    for (x, y) in ca.zip(cb) {
+        for l in 0..LANES {
+            acc[l] += x[l] * y[l];
+        }
+    }
+
+    acc.iter().map(|&x| x as f64).sum::<f64>() + tail as f64
+}
+
+// prefix sums of squares, for the energy of any overlap
+fn squares(v: &[f32]) -> Vec<f64> {
+    let mut sum = 0.0;
+
+    std::iter::once(0.0)
+        .chain(v.iter().map(|&x| {
+            sum += x as f64 * x as f64;
+            sum
+        }))
+        .collect()
+}
+
+// centred traces with their prefix sums of squares
+struct Trace {
+    v: Vec<f32>,
+    squares: Vec<f64>,
+}
+
+impl Trace {
+    fn new(v: Vec<f32>) -> Trace {
+        Trace { squares: squares(&v), v }
+    }
+}
+
+// normalised correlation of r[i] with s[i + k] over their overlap
+fn ncc(r: &Trace, s: &Trace, k: isize, min_overlap: usize) -> Option<f32> {
+    let i0 = (-k).max(0) as usize;
+    let i1 = (r.v.len() as isize).min(s.v.len() as isize - k);
+
+    if i1 - (i0 as isize) < min_overlap as isize {
+        return None;
+    }
+
+    let i1 = i1 as usize;
+    let (j0, j1) = ((i0 as isize + k) as usize, (i1 as isize + k) as usize);
+    let energy = (r.squares[i1] - r.squares[i0]) * (s.squares[j1] - s.squares[j0]);
+
+    (energy > 0.0).then(|| (dot(&r.v[i0..i1], &s.v[j0..j1]) / energy.sqrt()) as f32)
+}
+
+// the best shift in `lags`; ties go to the smaller shift so the result does
+// not depend on the order the pool scores them in
+fn search(r: &Trace, s: &Trace, lags: std::ops::RangeInclusive<isize>) -> Option<(isize, f32)> {
+    let min_overlap = ((r.v.len().min(s.v.len()) as f64 * MIN_OVERLAP).ceil() as usize).max(2);
+
+    lags.into_par_iter()
+        .filter_map(|k| ncc(r, s, k, min_overlap).map(|c| (k, c)))
+        .max_by(|a, b| a.1.total_cmp(&b.1).then(b.0.abs().cmp(&a.0.abs())).then(b.0.cmp(&a.0)))
+}
+
+/// The shift `k` at which `s[i + k]` correlates best with `r[i]`, within
+/// `max_lag` either way, in samples and interpolated between them, with the
+/// normalised correlation there. NaN marks missing values. None when no
+/// shift overlaps enough of both.
+pub fn best_lag(r: &[f32], s: &[f32], max_lag: usize) -> Option<(f64, f32)> {
+    let (r, s) = (centred(r), centred(s));
+    let max_lag = max_lag as isize;
+    let coarse_lag = max_lag / COARSE_FACTOR as isize;
+    let (rc, sc) = (Trace::new(decimate(&r, COARSE_FACTOR)), Trace::new(decimate(&s, COARSE_FACTOR)));
+    let (r, s) = (Trace::new(r), Trace::new(s));
+
+    let (k, _) = search(&rc, &sc, -coarse_lag..=coarse_lag)?;
+    let k = k * COARSE_FACTOR as isize;
+    let (k, score) = search(&r, &s, (k - FINE_SPAN).max(-max_lag)..=(k + FINE_SPAN).min(max_lag))?;
+
+    // vertex of the parabola through the peak and its neighbours
+    let min_overlap = 2;
+    let offset = match (ncc(&r, &s, k - 1, min_overlap), ncc(&r, &s, k + 1, min_overlap)) {
+        (Some(a), Some(b)) if a - 2.0 * score + b < 0.0 => (0.5 * (a - b) / (a - 2.0 * score + b)).clamp(-0.5, 0.5),
+        _ => 0.0,
+    };
+
+    Some((k as f64 + offset as f64, score))
+}
+
+fn first_over(log: &LogFile, start: f64, end: f64, limit: f32) -> Option<f64> {
+    let mut found = None;
+
+    scan(log, start, end, |time, _, _, power| {
+        found = power.iter().position(|&p| p > limit).map(|i| time[i]);
+        found.is_none()
+    });
+
+    found
+}
+
+/// The zero of each of `sessions`, reading them in parallel.
+pub fn align(sessions: &[(&LogFile, Session)], reference: usize, how: Align) -> io::Result<Vec<Alignment>> {
+    let plain = |zero| Alignment { zero, score: None };
+
+    match how {
+        Align::Start => Ok(sessions.iter().map(|(_, s)| plain(s.start)).collect()),
+        Align::Marker => sessions
+            .iter()
+            .map(|(_, s)| s.marker.map(plain).ok_or_else(|| invalid(format!("{} has no marker", s.path))))
+            .collect(),
+        Align::Threshold { power } => sessions
+            .par_iter()
+            .map(|(log, s)| {
+                first_over(log, s.start, s.end, power)
+                    .map(plain)
+                    .ok_or_else(|| invalid(format!("power never exceeds {} W in {}", power, s.path)))
+            })
+            .collect(),
+        Align::Correlate { max_lag } => {
+            let (log, r) = sessions.get(reference).ok_or_else(|| invalid(format!("no session {}", reference)))?;
+            let zero = r.marker.unwrap_or(r.start);
+            let trace = power_trace(log, r.start, r.end);
+            let max_lag = (max_lag * CORRELATE_RATE).round().max(0.0) as usize;
+
+            sessions
+                .par_iter()
+                .enumerate()
+                .map(|(i, (log, s))| {
+                    if i == reference {
+                        return Ok(Alignment { zero, score: Some(1.0) });
+                    }
+
+                    let (k, score) = best_lag(&trace, &power_trace(log, s.start, s.end), max_lag)
+                        .ok_or_else(|| invalid(format!("{} overlaps too little of the reference", s.path)))?;
+
+                    Ok(Alignment { zero: s.start + k / CORRELATE_RATE + (zero - r.start), score: Some(score) })
+                })
+                .collect()
+        }
+    }
+}
+
+/// Bins each of `sessions` over `points` bins of aligned time from `from` to
+/// `to`, each from its zero in `zeros`, in parallel. A session's samples
+/// outside its range are left out, and its bins outside it are NaN.
+pub fn compare(
+    sessions: &[(&LogFile, Session)],
+    zeros: &[f64],
+    reference: usize,
+    from: f64,
+    to: f64,
+    points: usize,
+) -> Comparison {
+    let n = points.clamp(1, POINTS_MAX);
+    let step = (to - from).max(0.0) / n as f64;
+
+    if step <= 0.0 || reference >= sessions.len() {
+        return Comparison { from, step, reference, ..Comparison::default() };
+    }
+
+    let mut series: Vec<Series> = sessions
+        .par_iter()
+        .zip(zeros)
+        .map(|((log, s), zero)| {
+            let bins = Bins::new(log, zero + from, step, n, s.start, s.end);
+
+            Series {
+                voltage: bins.mean(0),
+                current: bins.mean(1),
+                power: bins.mean(2),
+                energy: bins.used(),
+                ..Series::default()
+            }
+        })
+        .collect();
+
+    let (power, energy) = (series[reference].power.clone(), series[reference].energy.clone());
+
+    for s in &mut series {
+        s.power_diff = s.power.iter().zip(&power).map(|(a, b)| a - b).collect();
+        s.energy_diff = s.energy.iter().zip(&energy).map(|(a, b)| a - b).collect();
+    }
+
+    Comparison { from, step, reference, series }
+}
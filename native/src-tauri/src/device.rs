@@ -0,0 +1,123 @@
+// Connection to the meter over its USB CDC port.
+// Command lines are described in device/firmware/Core/Src/command.c.
+
+use std::io::{self, Read, Write};
+use std::sync::Mutex;
+use std::time::{Duration, SystemTime, UNIX_EPOCH};
+
+use serde::Serialize;
+
+const TIMEOUT: Duration = Duration::from_millis(500);
+const LINE_MAX: usize = 128;
+
+pub struct Device {
+    port: Box<dyn serialport::SerialPort>,
+    name: String,
+}
+
+#[derive(Debug, Clone, Serialize)]
+pub struct DeviceTime {
+    /// device RTC, seconds since 1970
+    pub time: f64,
+    /// the RTC was set by a host and kept running since
+    pub valid: bool,
+    /// device minus host clock in seconds, ignoring the USB round trip
+    pub offset: f64,
+}
+
+fn host_time() -> Duration {
+    SystemTime::now().duration_since(UNIX_EPOCH).unwrap_or_default()
+}
+
+fn invalid(msg: String) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, msg)
+}
+
+impl Device {
+    pub fn open(name: &str) -> io::Result<Self> {
+        // the baud rate means nothing to a CDC ACM port but is required
+        let port = serialport::new(name, 115_200).timeout(TIMEOUT).open()?;
+        Ok(Device { port, name: name.to_string() })
+    }
+
+    pub fn name(&self) -> &str {
+        &self.name
+    }
+
+    /// Next line from the device, reply or notification; times out after TIMEOUT.
+    pub fn read_line(&mut self) -> io::Result<String> {
+        let mut line = Vec::new();
+        let mut byte = [0u8; 1];
+
+        loop {
+            self.port.read_exact(&mut byte)?;
+
+            match byte[0] {
+                b'\n' => break,
+                b'\r' => {}
+                b => line.push(b),
+            }
+
+            if line.len() > LINE_MAX {
+                return Err(invalid("reply line too long".into()));
+            }
+        }
+
+        String::from_utf8(line).map_err(|e| invalid(e.to_string()))
+    }
+
+    /// Sends one command line and returns the reply after "OK".
+    pub fn command(&mut self, cmd: &str) -> io::Result<String> {
+        self.port.write_all(cmd.as_bytes())?;
+        self.port.write_all(b"\n")?;
+        self.port.flush()?;
+
+        // notifications can come in ahead of the reply
+        let reply = loop {
+            let line = self.read_line()?;
+
+            if !line.starts_with('!') {
+                break line;
+            }
+        };
+
+        match reply.strip_prefix("OK") {
+            Some(rest) => Ok(rest.trim().to_string()),
+            None => Err(invalid(format!("{}: {}", cmd, reply))),
+        }
+    }
+
+    pub fn time(&mut self) -> io::Result<DeviceTime> {
+        let reply = self.command("TIME")?;
+        let host = host_time().as_secs_f64();
+        let mut fields = reply.split_whitespace();
+
+        let time: f64 = fields
+            .next()
+            .and_then(|t| t.parse().ok())
+            .ok_or_else(|| invalid(format!("bad TIME reply: {}", reply)))?;
+        let valid = fields.next() == Some("1");
+
+        Ok(DeviceTime { time, valid, offset: time - host })
+    }
+
+    /// Sets the device RTC from the host clock.
+    pub fn sync_time(&mut self) -> io::Result<DeviceTime> {
+        let now = host_time();
+        self.command(&format!("TIME {}.{:03}", now.as_secs(), now.subsec_millis()))?;
+        self.time()
+    }
+}
+
+/// Serial ports that look like the meter's CDC interface.
+pub fn list() -> io::Result<Vec<String>> {
+    Ok(serialport::available_ports()?
+        .into_iter()
+        .filter(|p| matches!(p.port_type, serialport::SerialPortType::UsbPort(_)))
+        .map(|p| p.port_name)
+        .collect())
+}
+
+/// The connected device, shared by the Tauri commands.
+#[derive(Default)]
+pub struct DeviceState(pub Mutex<Option<Device>>);
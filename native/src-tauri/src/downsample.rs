@@ -0,0 +1,260 @@
+// Min/max downsampling of a log for charts.
+//
+// A chart of `width` pixels needs at most one min and one max per channel
+// and pixel, whatever the time range. Where a pixel spans at least one
+// bucket of a segment's min/max pyramid in the decoded cache, or else of
+// its summary index, the envelope is built from those buckets alone and no
+// sample is read; hour-long views cost a few thousand buckets. Zoomed in
+// further, or on a segment with neither, the samples are read and scanned
+// per pixel.
+
+use serde::Serialize;
+
+use crate::cache::{bucket_samples, Decoded, PYRAMID_LEVELS};
+use crate::log::{self, Summary, SUMMARY_PERIODS};
+use crate::reader::{temperature_c, Columns, LogFile, Segment};
+
+/// Widest chart served, in pixels.
+pub const WIDTH_MAX: usize = 8192;
+
+/// Lower and upper edge of a channel, one entry per point.
+#[derive(Debug, Clone, Default, Serialize)]
+pub struct Band {
+    pub min: Vec<f32>,
+    pub max: Vec<f32>,
+}
+
+/// Downsampled channels, physical units as in `Columns`.
+#[derive(Debug, Clone, Default, Serialize)]
+pub struct Envelope {
+    /// start of each point, seconds since 1970; pixels without samples are left out
+    pub time: Vec<f64>,
+    pub voltage: Band,
+    pub current: Band,
+    pub power: Band,
+    pub lv_voltage: Band,
+    pub temperature: Band,
+    /// seconds of log one point covers at most; the sample period when
+    /// points are single samples
+    pub resolution: f64,
+    /// period of the segment summaries the envelope was built from, 0 if none
+    pub summary_period: u16,
+}
+
+// voltage, current, power, LV voltage, temperature
+const BANDS: usize = 5;
+
+#[derive(Clone, Copy)]
+struct Bucket {
+    min: [f32; BANDS],
+    max: [f32; BANDS],
+}
+
+impl Bucket {
+    const EMPTY: Bucket = Bucket { min: [f32::INFINITY; BANDS], max: [f32::NEG_INFINITY; BANDS] };
+
+    fn is_empty(&self) -> bool {
+        self.min[0] > self.max[0]
+    }
+
+    fn add(&mut self, min: [f32; BANDS], max: [f32; BANDS]) {
+        for b in 0..BANDS {
+            self.min[b] = self.min[b].min(min[b]);
+            self.max[b] = self.max[b].max(max[b]);
+        }
+    }
+}
+
+/// Smallest and largest value of `v`. Kept to compares and selects over
+/// sixteen lanes, one pass per bound, which the compiler turns into packed
+/// SIMD min/max; both bounds in one loop come out as shuffles instead.
+pub fn min_max(v: &[f32]) -> (f32, f32) {
+    let mut lo = [f32::INFINITY; 16];
+    let mut hi = [f32::NEG_INFINITY; 16];
+    let chunks = v.chunks_exact(16);
+    let rest = chunks.remainder();
+
+    for c in chunks.clone() {
+        for i in 0..16 {
+            lo[i] = if c[i] < lo[i] { c[i] } else { lo[i] };
+        }
+    }
+
+    for c in chunks {
+        for i in 0..16 {
+            hi[i] = if c[i] > hi[i] { c[i] } else { hi[i] };
+        }
+    }
+
+    let lo = lo.iter().chain(rest).fold(f32::INFINITY, |a, &x| if x < a { x } else { a });
+    let hi = hi.iter().chain(rest).fold(f32::NEG_INFINITY, |a, &x| if x > a { x } else { a });
+
+    (lo, hi)
+}
+
+// physical range of one summary bucket; the current is taken against the
+// mean 5V reference and the zero in effect at the bucket's first block, at
+// either end of its temperature range, and the power range is the widest the
+// voltage and current ranges allow
+fn summary_range(seg: &Segment, s: &Summary) -> ([f32; BANDS], [f32; BANDS]) {
+    let c = &seg.session().calib;
+    let r = s.mean[log::CH_5V_REF].max(1) as f32;
+    let (t0, t1) = (temperature_c(s.min[log::CH_TEMPERATURE]), temperature_c(s.max[log::CH_TEMPERATURE]));
+    let zeros = [seg.zero_at(s.block as usize, t0), seg.zero_at(s.block as usize, t1)];
+    let amps = |code: u16, zero: f32| (code as f32 / r - zero) * c.hv_current_span;
+    let volts = |code: u16| code as f32 * c.hv_voltage_scale;
+
+    let (v0, v1) = (volts(s.min[log::CH_HV_VOLTAGE]), volts(s.max[log::CH_HV_VOLTAGE]));
+    let (i0, i1) = (s.min[log::CH_HV_CURRENT], s.max[log::CH_HV_CURRENT]);
+    let (a0, a1) = min_max(&[amps(i0, zeros[0]), amps(i0, zeros[1]), amps(i1, zeros[0]), amps(i1, zeros[1])]);
+    let corners = [v0 * a0, v0 * a1, v1 * a0, v1 * a1];
+    let (p0, p1) = min_max(&corners);
+
+    (
+        [v0, a0, p0, s.min[log::CH_LV_VOLTAGE] as f32 * c.lv_voltage_scale, t0],
+        [v1, a1, p1, s.max[log::CH_LV_VOLTAGE] as f32 * c.lv_voltage_scale, t1],
+    )
+}
+
+// summary level to build a pixel of `pixel` seconds from: the coarsest one that fits in it
+fn summary_level(pixel: f64) -> Option<usize> {
+    (0..SUMMARY_PERIODS.len()).rev().find(|&l| SUMMARY_PERIODS[l] as f64 <= pixel)
+}
+
+// what a segment's part of an envelope is built from
+#[derive(Debug, Clone, Copy, PartialEq)]
+enum Source {
+    Pyramid(usize),
+    Summary(usize),
+    Samples,
+}
+
+fn source(seg: &Segment, pixel: f64) -> Source {
+    let rate = seg.session().sample_rate.max(1) as f64;
+    let pyramid = (0..PYRAMID_LEVELS).rev().find(|&l| bucket_samples(l) as f64 / rate <= pixel);
+
+    match (seg.decoded(), pyramid, summary_level(pixel)) {
+        (Some(_), Some(l), _) => Source::Pyramid(l),
+        (_, _, Some(l)) if seg.summary().is_some() => Source::Summary(l),
+        _ => Source::Samples,
+    }
+}
+
+fn add_pyramid(d: &Decoded, level: usize, start: f64, end: f64, pixel: f64, buckets: &mut [Bucket]) {
+    let size = bucket_samples(level);
+    let time = d.time();
+    let first = time.partition_point(|&t| t < start) / size;
+    let last = time.partition_point(|&t| t < end).div_ceil(size);
+
+    for (k, m) in d.level(level)[first..last].iter().enumerate() {
+        let t = time[(first + k) * size].max(start);
+        let i = (((t - start) / pixel) as usize).min(buckets.len() - 1);
+
+        buckets[i].add(m.min, m.max);
+    }
+}
+
+fn add_summary(seg: &Segment, level: usize, start: f64, end: f64, pixel: f64, buckets: &mut [Bucket]) {
+    let session = seg.session();
+    let summary = &seg.summary().unwrap()[level];
+    // buckets are counted in samples from the first one of the segment
+    let bucket_ticks = summary.period as u64 * session.sample_rate as u64 * session.sample_ticks as u64;
+    let first = seg.span().0;
+
+    for (k, s) in summary.buckets.iter().enumerate() {
+        let t = session.wall_time(first + k as u64 * bucket_ticks);
+
+        if s.count == 0 || t < start || t >= end {
+            continue;
+        }
+
+        let (min, max) = summary_range(seg, s);
+        let i = (((t - start) / pixel) as usize).min(buckets.len() - 1);
+
+        buckets[i].add(min, max);
+    }
+}
+
+fn add_samples(c: &Columns, start: f64, pixel: f64, buckets: &mut [Bucket]) {
+    let columns = [&c.voltage, &c.current, &c.power, &c.lv_voltage, &c.temperature];
+    let mut a = 0;
+
+    while a < c.len() {
+        let i = (((c.time[a] - start) / pixel) as usize).min(buckets.len() - 1);
+        let edge = start + (i + 1) as f64 * pixel;
+        let b = a + c.time[a..].partition_point(|&t| t < edge).max(1);
+        let mut min = [0.0; BANDS];
+        let mut max = [0.0; BANDS];
+
+        for (k, col) in columns.iter().enumerate() {
+            (min[k], max[k]) = min_max(&col[a..b]);
+        }
+
+        buckets[i].add(min, max);
+        a = b;
+    }
+}
+
+fn push(out: &mut Envelope, t: f64, b: &Bucket) {
+    let bands = [&mut out.voltage, &mut out.current, &mut out.power, &mut out.lv_voltage, &mut out.temperature];
+
+    out.time.push(t);
+
+    for (k, band) in bands.into_iter().enumerate() {
+        band.min.push(b.min[k]);
+        band.max.push(b.max[k]);
+    }
+}
+
+/// At most `width` points covering `start` to `end`, wall-clock seconds since 1970.
+pub fn envelope(log: &LogFile, start: f64, end: f64, width: usize) -> Envelope {
+    let width = width.clamp(1, WIDTH_MAX);
+    let pixel = (end - start).max(0.0) / width as f64;
+    let sources: Vec<Source> = log.segments().iter().map(|seg| source(seg, pixel)).collect();
+    let mut out = Envelope::default();
+
+    if pixel <= 0.0 {
+        return out;
+    }
+
+    // the segments without buckets to use are read in full
+    let samples = log.read_segments(start, end, |seg| source(seg, pixel) == Source::Samples);
+    let sample_period = log.segments().first().map_or(0.0, |s| 1.0 / s.session().sample_rate.max(1) as f64);
+
+    if sources.iter().all(|&s| s == Source::Samples) && samples.len() <= width {
+        for i in 0..samples.len() {
+            let p = [samples.voltage[i], samples.current[i], samples.power[i], samples.lv_voltage[i], samples.temperature[i]];
+
+            push(&mut out, samples.time[i], &Bucket { min: p, max: p });
+        }
+
+        out.resolution = sample_period;
+        return out;
+    }
+
+    let mut buckets = vec![Bucket::EMPTY; width];
+
+    for (seg, &src) in log.segments().iter().zip(&sources) {
+        match src {
+            Source::Pyramid(l) => add_pyramid(seg.decoded().unwrap(), l, start, end, pixel, &mut buckets),
+            Source::Summary(l) => add_summary(seg, l, start, end, pixel, &mut buckets),
+            Source::Samples => {}
+        }
+    }
+
+    add_samples(&samples, start, pixel, &mut buckets);
+
+    for (i, b) in buckets.iter().enumerate().filter(|(_, b)| !b.is_empty()) {
+        push(&mut out, start + i as f64 * pixel, b);
+    }
+
+    out.resolution = pixel;
+    out.summary_period = sources
+        .iter()
+        .find_map(|s| match s {
+            Source::Summary(l) => Some(SUMMARY_PERIODS[*l]),
+            _ => None,
+        })
+        .unwrap_or(0);
+    out
+}
@@ -0,0 +1,269 @@
+// Export of a logged session to CSV or Parquet, for pandas, MATLAB and
+// spreadsheets.
+//
+// The range is read in chunks of CHUNK_SAMPLES (LogFile::chunks). The next
+// chunk is decoded on the rayon pool while the caller's thread encodes and
+// writes the one before (Chunks::prefetch), so memory holds a few chunks
+// however long the export. CSV rows are formatted in parallel slices and can be
+// gzipped. Parquet gets one zstd-compressed row group per chunk.
+//
+// CSV time is seconds since 1970 (pandas: to_datetime(unit="s"), MATLAB:
+// datetime(t, "ConvertFrom", "posixtime")); Parquet time is a UTC
+// microsecond timestamp, which both read as dates directly.
+
+use std::io::{self, Write};
+use std::sync::Arc;
+
+use arrow_array::{ArrayRef, Float32Array, RecordBatch, TimestampMicrosecondArray};
+use arrow_schema::{DataType, Field, Schema, SchemaRef, TimeUnit};
+use flate2::write::GzEncoder;
+use parquet::arrow::ArrowWriter;
+use parquet::basic::{Compression, ZstdLevel};
+use parquet::file::properties::WriterProperties;
+use rayon::prelude::*;
+use serde::{Deserialize, Serialize};
+
+use crate::reader::{Columns, LogFile};
+
+/// Samples decoded and written at a time, 44 minutes at 100 Hz and 7 MB.
+pub const CHUNK_SAMPLES: usize = 1 << 18;
+
+// CSV rows one formatting task takes
+const CSV_ROWS_PER_TASK: usize = 16384;
+
+const ZSTD_LEVEL: i32 = 3;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Deserialize)]
+#[serde(rename_all = "lowercase")]
+pub enum Format {
+    Csv,
+    Parquet,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Deserialize)]
+#[serde(rename_all = "snake_case")]
+pub enum Channel {
+    Voltage,
+    Current,
+    Power,
+    LvVoltage,
+    Temperature,
+}
+
+impl Channel {
+    pub const ALL: [Channel; 5] =
+        [Channel::Voltage, Channel::Current, Channel::Power, Channel::LvVoltage, Channel::Temperature];
+
+    /// Column name, with the unit.
+    pub fn name(self) -> &'static str {
+        match self {
+            Channel::Voltage => "voltage_v",
+            Channel::Current => "current_a",
+            Channel::Power => "power_w",
+            Channel::LvVoltage => "lv_voltage_v",
+            Channel::Temperature => "temperature_c",
+        }
+    }
+
+    fn column(self, c: &Columns) -> &[f32] {
+        match self {
+            Channel::Voltage => &c.voltage,
+            Channel::Current => &c.current,
+            Channel::Power => &c.power,
+            Channel::LvVoltage => &c.lv_voltage,
+            Channel::Temperature => &c.temperature,
+        }
+    }
+}
+
+#[derive(Debug, Clone, Deserialize)]
+pub struct Options {
+    pub format: Format,
+    /// wall-clock range, seconds since 1970
+    pub start: f64,
+    pub end: f64,
+    /// columns after the time, in this order; all of them when empty
+    #[serde(default)]
+    pub channels: Vec<Channel>,
+    /// gzip a CSV export; Parquet is always compressed
+    #[serde(default)]
+    pub compress: bool,
+}
+
+#[derive(Debug, Clone, Copy, Default, Serialize)]
+pub struct Progress {
+    /// samples written so far
+    pub samples: u64,
+    /// samples in the range, counting blocks that may turn out bad
+    pub total: u64,
+    /// blocks left out for a bad CRC so far
+    pub bad_blocks: u32,
+}
+
+// CSV output, plain or gzipped
+enum Text<W: Write> {
+    Plain(W),
+    Gzip(GzEncoder<W>),
+}
+
+impl<W: Write> Write for Text<W> {
+    fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+        match self {
+            Text::Plain(w) => w.write(buf),
+            Text::Gzip(w) => w.write(buf),
+        }
+    }
+
+    fn flush(&mut self) -> io::Result<()> {
+        match self {
+            Text::Plain(w) => w.flush(),
+            Text::Gzip(w) => w.flush(),
+        }
+    }
+}
+
+impl<W: Write> Text<W> {
+    // flush alone leaves the gzip trailer out
+    fn finish(self) -> io::Result<()> {
+        match self {
+            Text::Plain(mut w) => w.flush(),
+            Text::Gzip(w) => w.finish()?.flush(),
+        }
+    }
+}
+
+trait Sink {
+    fn write(&mut self, c: &Columns) -> io::Result<()>;
+    fn finish(self: Box<Self>) -> io::Result<()>;
+}
+
+struct Csv<W: Write> {
+    out: Text<W>,
+    channels: Vec<Channel>,
+}
+
+impl<W: Write> Csv<W> {
+    fn new(mut out: Text<W>, channels: Vec<Channel>) -> io::Result<Self> {
+        let names: Vec<&str> = channels.iter().map(|c| c.name()).collect();
+
+        writeln!(out, "time_s,{}", names.join(","))?;
+        Ok(Csv { out, channels })
+    }
+}
+
+fn csv_rows(channels: &[Channel], c: &Columns, range: std::ops::Range<usize>) -> Vec<u8> {
+    let mut text = Vec::with_capacity(range.len() * (14 + 10 * channels.len()));
+
+    for i in range {
+        // ms is finer than the sample period; f32 Display is the shortest exact form
+        write!(text, "{:.3}", c.time[i]).unwrap();
+
+        for ch in channels {
+            write!(text, ",{}", ch.column(c)[i]).unwrap();
+        }
+
+        text.push(b'\n');
+    }
+
+    text
+}
+
+impl<W: Write> Sink for Csv<W> {
+    fn write(&mut self, c: &Columns) -> io::Result<()> {
+        let channels = &self.channels;
+        let starts: Vec<usize> = (0..c.len()).step_by(CSV_ROWS_PER_TASK).collect();
+        let parts: Vec<Vec<u8>> =
+            starts.into_par_iter().map(|a| csv_rows(channels, c, a..(a + CSV_ROWS_PER_TASK).min(c.len()))).collect();
+
+        for part in parts {
+            self.out.write_all(&part)?;
+        }
+
+        Ok(())
+    }
+
+    fn finish(self: Box<Self>) -> io::Result<()> {
+        self.out.finish()
+    }
+}
+
+struct Parquet<W: Write + Send> {
+    writer: ArrowWriter<W>,
+    schema: SchemaRef,
+    channels: Vec<Channel>,
+}
+
+fn parquet_error<E: std::error::Error + Send + Sync + 'static>(e: E) -> io::Error {
+    io::Error::other(e)
+}
+
+impl<W: Write + Send> Parquet<W> {
+    fn new(out: W, channels: Vec<Channel>) -> io::Result<Self> {
+        let mut fields = vec![Field::new("time", DataType::Timestamp(TimeUnit::Microsecond, Some("UTC".into())), false)];
+
+        fields.extend(channels.iter().map(|c| Field::new(c.name(), DataType::Float32, false)));
+
+        let schema = Arc::new(Schema::new(fields));
+        let props = WriterProperties::builder()
+            .set_compression(Compression::ZSTD(ZstdLevel::try_new(ZSTD_LEVEL).map_err(parquet_error)?))
+            .set_max_row_group_size(CHUNK_SAMPLES)
+            .build();
+        let writer = ArrowWriter::try_new(out, schema.clone(), Some(props)).map_err(parquet_error)?;
+
+        Ok(Parquet { writer, schema, channels })
+    }
+}
+
+impl<W: Write + Send> Sink for Parquet<W> {
+    fn write(&mut self, c: &Columns) -> io::Result<()> {
+        let time: Vec<i64> = c.time.iter().map(|&t| (t * 1e6).round() as i64).collect();
+        let mut columns: Vec<ArrayRef> = vec![Arc::new(TimestampMicrosecondArray::from(time).with_timezone("UTC"))];
+
+        columns.extend(self.channels.iter().map(|ch| Arc::new(Float32Array::from(ch.column(c).to_vec())) as ArrayRef));
+
+        let batch = RecordBatch::try_new(self.schema.clone(), columns).map_err(parquet_error)?;
+
+        self.writer.write(&batch).map_err(parquet_error)?;
+        // one row group per chunk; the writer would otherwise buffer up to the limit
+        self.writer.flush().map_err(parquet_error)
+    }
+
+    fn finish(self: Box<Self>) -> io::Result<()> {
+        self.writer.close().map_err(parquet_error)?;
+        Ok(())
+    }
+}
+
+/// Writes the samples `opts` selects from `log` to `out`, calling `progress`
+/// after every chunk. Returns the final progress.
+pub fn export<W, P>(log: &LogFile, opts: &Options, out: W, mut progress: P) -> io::Result<Progress>
+where
+    W: Write + Send,
+    P: FnMut(Progress),
+{
+    let channels = if opts.channels.is_empty() { Channel::ALL.to_vec() } else { opts.channels.clone() };
+    let chunks = log.chunks(opts.start, opts.end, CHUNK_SAMPLES);
+    let mut done = Progress { total: chunks.total() as u64, ..Progress::default() };
+
+    let mut sink: Box<dyn Sink + '_> = match (opts.format, opts.compress) {
+        (Format::Csv, false) => Box::new(Csv::new(Text::Plain(out), channels)?),
+        (Format::Csv, true) => {
+            Box::new(Csv::new(Text::Gzip(GzEncoder::new(out, flate2::Compression::default())), channels)?)
+        }
+        (Format::Parquet, _) => Box::new(Parquet::new(out, channels)?),
+    };
+
+    progress(done);
+
+    chunks.prefetch(|chunk| {
+        sink.write(&chunk)?;
+
+        done.samples += chunk.len() as u64;
+        done.bad_blocks += chunk.bad_blocks;
+        progress(done);
+        Ok::<_, io::Error>(())
+    })?;
+
+    sink.finish()?;
+    Ok(done)
+}
@@ -0,0 +1,125 @@
+// Binary encoding of chart series for the webview.
+// Mirrors src/series.js; keep both in sync.
+//
+// A command returning these bytes as a raw response reaches the webview as
+// an ArrayBuffer. Every array starts at an offset aligned to its element
+// size, so the page takes Float64Array / Float32Array views on the buffer
+// instead of parsing text. All values are little-endian.
+//
+// Samples (SERIES_SAMPLES):
+//     u32 kind, u32 n, u32 bad_blocks, u32 reserved
+//     f64 time[n]
+//     f32 voltage[n], current[n], power[n], lv_voltage[n], temperature[n]
+//
+// Envelope (SERIES_ENVELOPE):
+//     u32 kind, u32 n, f64 resolution, u16 summary_period, u16 reserved[3]
+//     f64 time[n]
+//     f32 min[n], max[n] of voltage, current, power, lv_voltage, temperature
+//
+// Live (SERIES_LIVE), samples as above with the cursor for the next call:
+//     u32 kind, u32 n, u64 next
+//     f64 time[n]
+//     f32 voltage[n], current[n], power[n], lv_voltage[n], temperature[n]
+//
+// Comparison (SERIES_COMPARISON), bin i of every session at aligned time
+// from + (i + 0.5) * step:
+//     u32 kind, u32 sessions, u32 n, u32 reference, f64 from, f64 step
+//     per session: f32 voltage[n], current[n], power[n], energy[n], power_diff[n], energy_diff[n]
+
+use crate::compare::Comparison;
+use crate::downsample::Envelope;
+use crate::reader::Columns;
+
+pub const SERIES_SAMPLES: u32 = 1;
+pub const SERIES_ENVELOPE: u32 = 2;
+pub const SERIES_LIVE: u32 = 3;
+pub const SERIES_COMPARISON: u32 = 4;
+
+const SAMPLES_HEADER: usize = 16;
+const ENVELOPE_HEADER: usize = 24;
+const COMPARISON_HEADER: usize = 32;
+
+fn put_f64(out: &mut Vec<u8>, v: &[f64]) {
+    for x in v {
+        out.extend_from_slice(&x.to_le_bytes());
+    }
+}
+
+fn put_f32(out: &mut Vec<u8>, v: &[f32]) {
+    for x in v {
+        out.extend_from_slice(&x.to_le_bytes());
+    }
+}
+
+fn put_columns(out: &mut Vec<u8>, c: &Columns) {
+    put_f64(out, &c.time);
+
+    for col in [&c.voltage, &c.current, &c.power, &c.lv_voltage, &c.temperature] {
+        put_f32(out, col);
+    }
+}
+
+pub fn encode_samples(c: &Columns) -> Vec<u8> {
+    let n = c.len();
+    let mut out = Vec::with_capacity(SAMPLES_HEADER + n * (8 + 5 * 4));
+
+    out.extend_from_slice(&SERIES_SAMPLES.to_le_bytes());
+    out.extend_from_slice(&(n as u32).to_le_bytes());
+    out.extend_from_slice(&c.bad_blocks.to_le_bytes());
+    out.extend_from_slice(&0u32.to_le_bytes());
+
+    put_columns(&mut out, c);
+    out
+}
+
+pub fn encode_live(c: &Columns, next: u64) -> Vec<u8> {
+    let n = c.len();
+    let mut out = Vec::with_capacity(SAMPLES_HEADER + n * (8 + 5 * 4));
+
+    out.extend_from_slice(&SERIES_LIVE.to_le_bytes());
+    out.extend_from_slice(&(n as u32).to_le_bytes());
+    out.extend_from_slice(&next.to_le_bytes());
+
+    put_columns(&mut out, c);
+    out
+}
+
+pub fn encode_envelope(e: &Envelope) -> Vec<u8> {
+    let n = e.time.len();
+    let mut out = Vec::with_capacity(ENVELOPE_HEADER + n * (8 + 10 * 4));
+
+    out.extend_from_slice(&SERIES_ENVELOPE.to_le_bytes());
+    out.extend_from_slice(&(n as u32).to_le_bytes());
+    out.extend_from_slice(&e.resolution.to_le_bytes());
+    out.extend_from_slice(&e.summary_period.to_le_bytes());
+    out.extend_from_slice(&[0u8; 6]);
+
+    put_f64(&mut out, &e.time);
+
+    for band in [&e.voltage, &e.current, &e.power, &e.lv_voltage, &e.temperature] {
+        put_f32(&mut out, &band.min);
+        put_f32(&mut out, &band.max);
+    }
+
+    out
+}
+
+pub fn encode_comparison(c: &Comparison) -> Vec<u8> {
+    let n = c.series.first().map_or(0, |s| s.power.len());
+    let mut out = Vec::with_capacity(COMPARISON_HEADER + c.series.len() * n * 6 * 4);
+
+    out.extend_from_slice(&SERIES_COMPARISON.to_le_bytes());
+    out.extend_from_slice(&(c.series.len() as u32).to_le_bytes());
+    out.extend_from_slice(&(n as u32).to_le_bytes());
+    out.extend_from_slice(&(c.reference as u32).to_le_bytes());
+    out.extend_from_slice(&c.from.to_le_bytes());
+    out.extend_from_slice(&c.step.to_le_bytes());
+
+    for s in &c.series {
+        for col in [&s.voltage, &s.current, &s.power, &s.energy, &s.power_diff, &s.energy_diff] {
+            put_f32(&mut out, col);
+        }
+    }
+
+    out
+}
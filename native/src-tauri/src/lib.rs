@@ -1,14 +1,314 @@
-// Learn more about Tauri commands at https://tauri.app/v1/guides/features/command
+pub mod analysis;
+pub mod cache;
+pub mod compare;
+pub mod device;
+pub mod downsample;
+pub mod export;
+pub mod ipc;
+pub mod live;
+pub mod log;
+pub mod reader;
+
+use std::fs::File;
+use std::io::BufWriter;
+use std::sync::Arc;
+
+use tauri::ipc::Response;
+use tauri::{Emitter, Manager};
+
+use cache::Cache;
+
+use device::{Device, DeviceState, DeviceTime};
+use live::{Live, LiveState};
+use reader::{LogFile, LogInfo, LogState};
+
+/// Summary index of a closed segment file, one entry per resolution
+#[tauri::command]
+fn summary_index(path: String) -> Result<Vec<log::SummaryLevel>, String> {
+    log::read_summary_file(path).map_err(|e| e.to_string())
+}
+
+/// Sessions listed in the SESSIONS.IDX file of the card or folder `dir`,
+/// without opening any log
+#[tauri::command]
+fn list_sessions(dir: String) -> Result<Vec<log::SessionEntry>, String> {
+    log::read_index(std::path::Path::new(&dir).join(log::INDEX_FILE))
+        .map(|entries| log::sessions(&entries))
+        .map_err(|e| e.to_string())
+}
+
+/// Maps every segment of the session `path` belongs to; cheap at any size.
+/// In the background, the decoded cache entries found are checked and
+/// segments without one are decoded into it, for the next time.
+#[tauri::command]
+fn open_log(
+    path: String,
+    state: tauri::State<'_, LogState>,
+    cache: tauri::State<'_, Cache>,
+) -> Result<LogInfo, String> {
+    let log = Arc::new(LogFile::open(&path).map_err(|e| e.to_string())?);
+    let info = log.info();
+
+    log.use_cache(&cache);
+
+    let (filled, cache) = (log.clone(), cache.inner().clone());
+
+    // without a cache the log still reads, only slower
+    std::thread::spawn(move || drop(filled.fill_cache(&cache)));
+
+    state.0.lock().unwrap().insert(path, log);
+    Ok(info)
+}
+
+#[tauri::command]
+fn close_log(path: String, state: tauri::State<'_, LogState>) {
+    state.0.lock().unwrap().remove(&path);
+}
+
+/// Samples of an opened log between two wall-clock times, seconds since 1970,
+/// as an ArrayBuffer (see ipc.rs).
+#[tauri::command]
+async fn log_samples(path: String, start: f64, end: f64, state: tauri::State<'_, LogState>) -> Result<Response, String> {
+    let log = state.get(&path).ok_or_else(|| format!("{} is not open", path))?;
+
+    tauri::async_runtime::spawn_blocking(move || Response::new(ipc::encode_samples(&log.read(start, end))))
+        .await
+        .map_err(|e| e.to_string())
+}
+
+/// Min/max of each channel over at most `width` points between two
+/// wall-clock times, for a chart that wide, as an ArrayBuffer (see ipc.rs).
+#[tauri::command]
+async fn log_envelope(
+    path: String,
+    start: f64,
+    end: f64,
+    width: usize,
+    state: tauri::State<'_, LogState>,
+) -> Result<Response, String> {
+    let log = state.get(&path).ok_or_else(|| format!("{} is not open", path))?;
+
+    tauri::async_runtime::spawn_blocking(move || {
+        Response::new(ipc::encode_envelope(&downsample::envelope(&log, start, end, width)))
+    })
+    .await
+    .map_err(|e| e.to_string())
+}
+
+/// Writes samples of an opened log to `dest` as CSV or Parquet, reporting
+/// "export-progress" events as it goes; see export.rs.
+#[tauri::command]
+async fn export_log(
+    app: tauri::AppHandle,
+    path: String,
+    dest: String,
+    options: export::Options,
+    state: tauri::State<'_, LogState>,
+) -> Result<export::Progress, String> {
+    let log = state.get(&path).ok_or_else(|| format!("{} is not open", path))?;
+
+    tauri::async_runtime::spawn_blocking(move || {
+        let out = BufWriter::new(File::create(&dest)?);
+
+        export::export(&log, &options, out, |p| {
+            let _ = app.emit("export-progress", p);
+        })
+    })
+    .await
+    .map_err(|e| e.to_string())?
+    .map_err(|e| e.to_string())
+}
+
+/// Energy, extremes and power-limit violations of an opened log between two
+/// wall-clock times, FSG limits unless `limits` says otherwise. Partial
+/// results come as "analysis-progress" events while it runs; see analysis.rs.
+#[tauri::command]
+async fn analyze_log(
+    app: tauri::AppHandle,
+    path: String,
+    start: f64,
+    end: f64,
+    limits: Option<analysis::Limits>,
+    state: tauri::State<'_, LogState>,
+) -> Result<analysis::Analysis, String> {
+    let log = state.get(&path).ok_or_else(|| format!("{} is not open", path))?;
+
+    tauri::async_runtime::spawn_blocking(move || {
+        analysis::analyze(&log, start, end, limits.unwrap_or_default(), |p| {
+            let _ = app.emit("analysis-progress", p);
+        })
+    })
+    .await
+    .map_err(|e| e.to_string())
+}
+
+// the open logs of `paths`, in order
+fn open_logs(paths: impl Iterator<Item = String>, state: &LogState) -> Result<Vec<Arc<LogFile>>, String> {
+    paths.map(|p| state.get(&p).ok_or_else(|| format!("{} is not open", p))).collect()
+}
+
+/// The wall-clock time each of several ranges of open logs is aligned on;
+/// see compare.rs.
+#[tauri::command]
+async fn align_sessions(
+    sessions: Vec<compare::Session>,
+    reference: usize,
+    align: compare::Align,
+    state: tauri::State<'_, LogState>,
+) -> Result<Vec<compare::Alignment>, String> {
+    let logs = open_logs(sessions.iter().map(|s| s.path.clone()), &state)?;
+
+    tauri::async_runtime::spawn_blocking(move || {
+        let pairs: Vec<_> = logs.iter().map(|l| &**l).zip(sessions).collect();
+        compare::align(&pairs, reference, align)
+    })
+    .await
+    .map_err(|e| e.to_string())?
+    .map_err(|e| e.to_string())
+}
+
+/// Ranges of open logs binned over `points` bins of aligned time from `from`
+/// to `to`, each from its `zero`, with the differences to the reference, as
+/// an ArrayBuffer (see ipc.rs).
 #[tauri::command]
-fn greet(name: &str) -> String {
-    format!("Hello, {}! You've been greeted from Rust!", name)
+async fn compare_sessions(
+    sessions: Vec<compare::Session>,
+    zeros: Vec<f64>,
+    reference: usize,
+    from: f64,
+    to: f64,
+    points: usize,
+    state: tauri::State<'_, LogState>,
+) -> Result<Response, String> {
+    if sessions.len() != zeros.len() {
+        return Err(format!("{} sessions but {} zeros", sessions.len(), zeros.len()));
+    }
+
+    let logs = open_logs(sessions.iter().map(|s| s.path.clone()), &state)?;
+
+    tauri::async_runtime::spawn_blocking(move || {
+        let pairs: Vec<_> = logs.iter().map(|l| &**l).zip(sessions).collect();
+        Response::new(ipc::encode_comparison(&compare::compare(&pairs, &zeros, reference, from, to, points)))
+    })
+    .await
+    .map_err(|e| e.to_string())
+}
+
+#[tauri::command]
+fn list_devices() -> Result<Vec<String>, String> {
+    device::list().map_err(|e| e.to_string())
+}
+
+/// Opens the meter on `port` and sets its clock from the host right away,
+/// so every session logged after a connection has a trustworthy start time.
+#[tauri::command]
+fn connect_device(port: String, state: tauri::State<'_, DeviceState>) -> Result<DeviceTime, String> {
+    let mut dev = Device::open(&port).map_err(|e| e.to_string())?;
+    let time = dev.sync_time().map_err(|e| e.to_string())?;
+
+    *state.0.lock().unwrap() = Some(dev);
+    Ok(time)
+}
+
+#[tauri::command]
+fn disconnect_device(state: tauri::State<'_, DeviceState>, live: tauri::State<'_, LiveState>) {
+    if let Some(l) = live.0.lock().unwrap().take() {
+        drop(l.stop());
+    }
+
+    *state.0.lock().unwrap() = None;
+}
+
+#[tauri::command]
+fn device_time(state: tauri::State<'_, DeviceState>) -> Result<DeviceTime, String> {
+    match state.0.lock().unwrap().as_mut() {
+        Some(dev) => dev.time().map_err(|e| e.to_string()),
+        None => Err("no device connected".into()),
+    }
+}
+
+/// Starts streaming samples from the connected device. The reader thread
+/// holds the port until live_stop, so device commands fail meanwhile.
+#[tauri::command]
+fn live_start(state: tauri::State<'_, DeviceState>, live: tauri::State<'_, LiveState>) -> Result<(), String> {
+    let mut running = live.0.lock().unwrap();
+
+    if running.is_some() {
+        return Ok(());
+    }
+
+    let dev = state.0.lock().unwrap().take().ok_or("no device connected")?;
+
+    match Live::start(dev) {
+        Ok(l) => {
+            *running = Some(l);
+            Ok(())
+        }
+        Err((dev, e)) => {
+            *state.0.lock().unwrap() = Some(dev);
+            Err(e.to_string())
+        }
+    }
+}
+
+/// Stops streaming and hands the port back to the device commands.
+#[tauri::command]
+fn live_stop(state: tauri::State<'_, DeviceState>, live: tauri::State<'_, LiveState>) -> Result<(), String> {
+    let Some(l) = live.0.lock().unwrap().take() else {
+        return Ok(());
+    };
+    let (dev, result) = l.stop();
+
+    *state.0.lock().unwrap() = Some(dev);
+    result.map_err(|e| e.to_string())
+}
+
+/// Samples streamed since the cursor `after`, as an ArrayBuffer carrying the
+/// next cursor (see ipc.rs). Meant to be polled once per display frame.
+#[tauri::command]
+fn live_snapshot(after: u64, live: tauri::State<'_, LiveState>) -> Result<Response, String> {
+    match live.0.lock().unwrap().as_ref() {
+        Some(l) if l.failed() => Err("live stream ended".into()),
+        Some(l) => {
+            let (c, next) = live::snapshot(l.ring(), after);
+            Ok(Response::new(ipc::encode_live(&c, next)))
+        }
+        None => Err("not streaming".into()),
+    }
 }
 
 #[cfg_attr(mobile, tauri::mobile_entry_point)]
 pub fn run() {
     tauri::Builder::default()
         .plugin(tauri_plugin_shell::init())
-        .invoke_handler(tauri::generate_handler![greet])
+        .setup(|app| {
+            let dir = app.path().app_cache_dir()?.join("decoded");
+
+            app.manage(Cache::new(dir, cache::CACHE_LIMIT));
+            Ok(())
+        })
+        .manage(DeviceState::default())
+        .manage(LogState::default())
+        .manage(LiveState::default())
+        .invoke_handler(tauri::generate_handler![
+            summary_index,
+            list_sessions,
+            open_log,
+            close_log,
+            log_samples,
+            log_envelope,
+            export_log,
+            analyze_log,
+            align_sessions,
+            compare_sessions,
+            list_devices,
+            connect_device,
+            disconnect_device,
+            device_time,
+            live_start,
+            live_stop,
+            live_snapshot
+        ])
         .run(tauri::generate_context!())
         .expect("error while running tauri application");
 }
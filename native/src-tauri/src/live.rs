@@ -0,0 +1,206 @@
+// Live samples from the meter's !S stream (see device/firmware/Core/Src/stream.c).
+//
+// While streaming, a reader thread owns the device: it parses the sample
+// lines into a fixed ring and hands the device back when stopped. The ring
+// overwrites its oldest samples, so memory stays the same however long a pit
+// session streams. Each slot carries its own sequence number, seqlock style,
+// so neither side ever waits: the thread writes at full rate and the page
+// takes whatever is new once per display frame.
+
+use std::io;
+use std::sync::atomic::{fence, AtomicBool, AtomicU32, AtomicU64, Ordering};
+use std::sync::{Arc, Mutex};
+use std::thread::{self, JoinHandle};
+
+use crate::device::Device;
+use crate::reader::Columns;
+
+/// Samples kept, 11 minutes at the logged rate.
+pub const RING_LEN: usize = 1 << 16;
+
+/// Rate of the streamed samples, Hz; the device's ACQ_SAMPLE_RATE.
+pub const SAMPLE_RATE: f64 = 100.0;
+
+#[derive(Debug, Clone, Copy, Default, PartialEq)]
+pub struct LiveSample {
+    /// sample number since device boot
+    pub number: u32,
+    pub voltage: f32,
+    pub current: f32,
+    pub lv_voltage: f32,
+    pub temperature: f32,
+}
+
+impl LiveSample {
+    /// Parses a "!S <number> <V> <A> <LV> <C>" line.
+    pub fn parse(line: &str) -> Option<LiveSample> {
+        let mut f = line.strip_prefix("!S ")?.split_whitespace();
+        let s = LiveSample {
+            number: f.next()?.parse().ok()?,
+            voltage: f.next()?.parse().ok()?,
+            current: f.next()?.parse().ok()?,
+            lv_voltage: f.next()?.parse().ok()?,
+            temperature: f.next()?.parse().ok()?,
+        };
+
+        f.next().is_none().then_some(s)
+    }
+}
+
+struct Slot {
+    /// 2 * write index + 1 while being written, + 2 once written
+    seq: AtomicU64,
+    data: [AtomicU32; 5],
+}
+
+/// Single-producer ring of the last RING_LEN samples.
+pub struct Ring {
+    slots: Box<[Slot]>,
+    written: AtomicU64,
+}
+
+impl Default for Ring {
+    fn default() -> Self {
+        let slots = (0..RING_LEN)
+            .map(|_| Slot { seq: AtomicU64::new(0), data: std::array::from_fn(|_| AtomicU32::new(0)) })
+            .collect();
+
+        Ring { slots, written: AtomicU64::new(0) }
+    }
+}
+
+impl Ring {
+    /// Samples written since the ring was made.
+    pub fn written(&self) -> u64 {
+        self.written.load(Ordering::Acquire)
+    }
+
+    /// Adds a sample, overwriting the oldest; one thread only.
+    pub fn push(&self, s: &LiveSample) {
+        let w = self.written.load(Ordering::Relaxed);
+        let slot = &self.slots[w as usize % RING_LEN];
+        let words = [s.number, s.voltage.to_bits(), s.current.to_bits(), s.lv_voltage.to_bits(), s.temperature.to_bits()];
+
+        slot.seq.store(2 * w + 1, Ordering::Relaxed);
+        fence(Ordering::Release);
+
+        for (d, v) in slot.data.iter().zip(words) {
+            d.store(v, Ordering::Relaxed);
+        }
+
+        slot.seq.store(2 * w + 2, Ordering::Release);
+        self.written.store(w + 1, Ordering::Release);
+    }
+
+    /// Appends the samples written after the first `after`, oldest first, to
+    /// `out` and returns the count to pass next time. Samples overwritten
+    /// before they were read are skipped.
+    pub fn read(&self, after: u64, out: &mut Vec<LiveSample>) -> u64 {
+        let end = self.written();
+        let start = after.max(end.saturating_sub(RING_LEN as u64));
+
+        for w in start..end {
+            let slot = &self.slots[w as usize % RING_LEN];
+            let seq = slot.seq.load(Ordering::Acquire);
+            let words: [u32; 5] = std::array::from_fn(|i| slot.data[i].load(Ordering::Relaxed));
+
+            fence(Ordering::Acquire);
+
+            // overwritten while or since being read; so is everything before it
+            if seq != 2 * w + 2 || slot.seq.load(Ordering::Relaxed) != seq {
+                out.clear();
+                continue;
+            }
+
+            out.push(LiveSample {
+                number: words[0],
+                voltage: f32::from_bits(words[1]),
+                current: f32::from_bits(words[2]),
+                lv_voltage: f32::from_bits(words[3]),
+                temperature: f32::from_bits(words[4]),
+            });
+        }
+
+        end
+    }
+}
+
+/// A running stream and the thread reading it.
+pub struct Live {
+    ring: Arc<Ring>,
+    stop: Arc<AtomicBool>,
+    thread: JoinHandle<(Device, io::Result<()>)>,
+}
+
+impl Live {
+    /// Turns the stream on and starts reading it; the device comes back on failure.
+    pub fn start(mut dev: Device) -> Result<Live, (Device, io::Error)> {
+        if let Err(e) = dev.command("STREAM ON") {
+            return Err((dev, e));
+        }
+
+        let ring = Arc::new(Ring::default());
+        let stop = Arc::new(AtomicBool::new(false));
+        let (r, s) = (ring.clone(), stop.clone());
+
+        let thread = thread::spawn(move || {
+            while !s.load(Ordering::Relaxed) {
+                match dev.read_line() {
+                    Ok(line) => {
+                        if let Some(sample) = LiveSample::parse(&line) {
+                            r.push(&sample);
+                        }
+                    }
+                    // the read timeout only bounds how long a stop takes
+                    Err(e) if e.kind() == io::ErrorKind::TimedOut => {}
+                    Err(e) => return (dev, Err(e)),
+                }
+            }
+
+            let off = dev.command("STREAM OFF").map(|_| ());
+            (dev, off)
+        });
+
+        Ok(Live { ring, stop, thread })
+    }
+
+    pub fn ring(&self) -> &Ring {
+        &self.ring
+    }
+
+    /// Whether the reader thread has ended on a port error.
+    pub fn failed(&self) -> bool {
+        self.thread.is_finished() && !self.stop.load(Ordering::Relaxed)
+    }
+
+    /// Turns the stream off and gives the device back, with the error that
+    /// ended the stream if any.
+    pub fn stop(self) -> (Device, io::Result<()>) {
+        self.stop.store(true, Ordering::Relaxed);
+        self.thread.join().expect("live reader thread panicked")
+    }
+}
+
+/// New samples since `after` in columns, time in seconds since device boot,
+/// and the count to pass next time. Samples dropped on the device or
+/// overwritten in the ring show as gaps in time.
+pub fn snapshot(ring: &Ring, after: u64) -> (Columns, u64) {
+    let mut samples = Vec::new();
+    let next = ring.read(after, &mut samples);
+    let mut c = Columns::default();
+
+    for s in &samples {
+        c.time.push(s.number as f64 / SAMPLE_RATE);
+        c.voltage.push(s.voltage);
+        c.current.push(s.current);
+        c.power.push(s.voltage * s.current);
+        c.lv_voltage.push(s.lv_voltage);
+        c.temperature.push(s.temperature);
+    }
+
+    (c, next)
+}
+
+/// The running stream, shared by the Tauri commands.
+#[derive(Default)]
+pub struct LiveState(pub Mutex<Option<Live>>);
@@ -0,0 +1,682 @@
+// Reference decoder for the on-card log format.
+// Mirrors device/firmware/Core/Inc/log.h; keep both in sync.
+
+use std::fs::File;
+use std::io::{self, Read, Seek, SeekFrom};
+use std::path::Path;
+
+use serde::Serialize;
+
+pub const BLOCK_SIZE: usize = 512;
+pub const BLOCK_MAGIC: u32 = 0x4C4D_45AA;
+pub const FORMAT_VERSION: u8 = 2;
+
+pub const HEADER_SIZE: usize = 24;
+pub const PAYLOAD_SIZE: usize = BLOCK_SIZE - HEADER_SIZE - 4;
+
+pub const TYPE_SAMPLE: u8 = 1;
+pub const TYPE_SESSION: u8 = 2;
+pub const TYPE_SUMMARY: u8 = 3;
+pub const TYPE_DIRECTORY: u8 = 4;
+pub const TYPE_PACKED: u8 = 5;
+pub const TYPE_EVENT: u8 = 6;
+pub const TYPE_CAPTURE: u8 = 7;
+
+pub const FLAG_OVERRUN: u32 = 1 << 0;
+
+pub const SESSION_TIME_SET: u32 = 1 << 0;
+pub const SESSION_DRIFT: u32 = 1 << 1;
+
+pub const EVENT_CAPTURE: u16 = 1;
+pub const EVENT_ALARM: u16 = 2;
+pub const EVENT_ALARM_CLEAR: u16 = 3;
+pub const EVENT_ZERO: u16 = 4;
+pub const EVENT_THERMAL: u16 = 5;
+
+pub const TRIGGER_CURRENT: u16 = 1 << 0;
+pub const TRIGGER_VOLTAGE: u16 = 1 << 1;
+pub const TRIGGER_DPDT: u16 = 1 << 2;
+pub const TRIGGER_MANUAL: u16 = 1 << 3;
+
+pub const CH_LV_VOLTAGE: usize = 0;
+pub const CH_5V_REF: usize = 1;
+pub const CH_HV_CURRENT: usize = 2;
+pub const CH_HV_VOLTAGE: usize = 3;
+pub const CH_TEMPERATURE: usize = 4;
+pub const CHANNELS: usize = 5;
+pub const SAMPLES_PER_BLOCK: usize = 48;
+pub const PACKED_FRAME: usize = SAMPLES_PER_BLOCK;
+
+/// Preallocated length of a segment file, LOG_SEGMENT_SIZE in logger.h. A
+/// segment the device closed or recovered is cut back below it unless it
+/// filled up.
+pub const SEGMENT_SIZE: usize = 32 << 20;
+
+pub const INDEX_FILE: &str = "SESSIONS.IDX";
+pub const INDEX_MAGIC: u32 = 0x5844_4945;
+pub const INDEX_SIZE: usize = 64;
+pub const INDEX_CLOSED: u32 = 1 << 0;
+pub const INDEX_RECOVERED: u32 = 1 << 1;
+
+pub const SUMMARY_PERIODS: [u16; 3] = [1, 10, 60];
+pub const SUMMARIES_PER_BLOCK: usize = 13;
+pub const DIRECTORY_PER_BLOCK: usize = 120;
+
+const SUMMARY_SIZE: usize = 36;
+const CODEC_CH_HEADER: usize = 5;
+
+fn u16_at(b: &[u8], off: usize) -> u16 {
+    u16::from_le_bytes([b[off], b[off + 1]])
+}
+
+fn u32_at(b: &[u8], off: usize) -> u32 {
+    u32::from_le_bytes(b[off..off + 4].try_into().unwrap())
+}
+
+fn f32_at(b: &[u8], off: usize) -> f32 {
+    f32::from_bits(u32_at(b, off))
+}
+
+/// STM32 hardware CRC32: polynomial 0x04C11DB7, initial value 0xFFFFFFFF,
+/// fed one little-endian word at a time MSB first, no reflection or final xor.
+pub fn stm32_crc(data: &[u8]) -> u32 {
+    let mut crc = 0xFFFF_FFFFu32;
+
+    for word in data.chunks_exact(4) {
+        crc ^= u32::from_le_bytes(word.try_into().unwrap());
+
+        for _ in 0..32 {
+            crc = if crc & 0x8000_0000 != 0 { (crc << 1) ^ 0x04C1_1DB7 } else { crc << 1 };
+        }
+    }
+
+    crc
+}
+
+/// Decodes one packed frame of `out.len()` samples (see codec.c) and returns
+/// the bytes it took, or `None` if it runs past `src`.
+///
+/// Each channel is unpacked through a zero-padded copy so every delta is a
+/// fixed-position 64-bit load, shift and mask with no bit-level branching;
+/// the unpack and the prefix sum then vectorise cleanly.
+pub fn decode_frame(src: &[u8], out: &mut [[u16; CHANNELS]]) -> Option<usize> {
+    let n = out.len();
+    let mut pos = 0;
+    let mut padded = [0u8; (PACKED_FRAME * 16).div_ceil(8) + 8];
+    let mut delta = [0u16; PACKED_FRAME];
+
+    if n > PACKED_FRAME {
+        return None;
+    }
+    if n == 0 {
+        return Some(0);
+    }
+
+    for ch in 0..CHANNELS {
+        let h = src.get(pos..pos + CODEC_CH_HEADER)?;
+        let first = u16_at(h, 0);
+        let base = u16_at(h, 2);
+        let width = h[4] as usize;
+
+        if width > 16 {
+            return None;
+        }
+
+        pos += CODEC_CH_HEADER;
+
+        let bytes = ((n - 1) * width).div_ceil(8);
+        padded[..bytes].copy_from_slice(src.get(pos..pos + bytes)?);
+        padded[bytes..].fill(0);
+        pos += bytes;
+
+        let mask = (1u64 << width) - 1;
+
+        for (i, d) in delta[..n - 1].iter_mut().enumerate() {
+            let bit = i * width;
+            let word = u64::from_le_bytes(padded[bit / 8..bit / 8 + 8].try_into().unwrap());
+            let z = ((word >> (bit % 8)) & mask) as u16;
+            let z = z.wrapping_add(base);
+            *d = (z >> 1) ^ (z & 1).wrapping_neg();
+        }
+
+        let mut value = first;
+        out[0][ch] = value;
+
+        for i in 1..n {
+            value = value.wrapping_add(delta[i - 1]);
+            out[i][ch] = value;
+        }
+    }
+
+    Some(pos)
+}
+
+/// Decodes the frames of a packed block payload.
+pub fn decode_packed(payload: &[u8], count: usize) -> Option<Vec<[u16; CHANNELS]>> {
+    let mut samples = vec![[0u16; CHANNELS]; count];
+    let mut pos = 0;
+
+    for frame in samples.chunks_mut(PACKED_FRAME) {
+        pos += decode_frame(&payload[pos..], frame)?;
+    }
+
+    Some(samples)
+}
+
+#[derive(Debug, Clone, Copy, Serialize)]
+pub struct Header {
+    pub kind: u8,
+    pub version: u8,
+    pub count: u16,
+    pub seq: u32,
+    pub flags: u32,
+    /// TIM5 ticks since boot at the first sample
+    pub time: u64,
+}
+
+#[derive(Debug, Clone, Copy, Serialize)]
+pub struct Calib {
+    pub lv_voltage_scale: f32,
+    pub hv_voltage_scale: f32,
+    pub hv_current_zero: f32,
+    pub hv_current_span: f32,
+}
+
+#[derive(Debug, Clone, Serialize)]
+pub struct Session {
+    pub session: u16,
+    pub segment: u16,
+    pub start: u32,
+    pub start_ms: u16,
+    pub sample_rate: u16,
+    pub samples_per_block: u16,
+    pub channels: u16,
+    pub calib: Calib,
+    pub tick_hz: u32,
+    /// ticks between samples; a sample is the mean over its period from its time
+    pub sample_ticks: u32,
+    pub flags: u32,
+    /// measured RTC clock error, valid with SESSION_DRIFT
+    pub lsi_ppm: f32,
+    /// correction the device applied to its RTC for it
+    pub trim_ppm: f32,
+    /// TIM5 tick at which `start` was read
+    pub start_tick: u64,
+}
+
+impl Session {
+    /// Wall-clock time of a block header time, seconds since 1970.
+    pub fn wall_time(&self, time: u64) -> f64 {
+        self.start as f64
+            + self.start_ms as f64 / 1000.0
+            + (time as i64 - self.start_tick as i64) as f64 / self.tick_hz as f64
+    }
+
+    /// Wall-clock time of sample `i` of a block starting at `time`.
+    pub fn sample_time(&self, time: u64, i: usize) -> f64 {
+        self.wall_time(time + i as u64 * self.sample_ticks as u64)
+    }
+}
+
+#[derive(Debug, Clone, Copy, Serialize)]
+pub struct Summary {
+    pub min: [u16; CHANNELS],
+    pub max: [u16; CHANNELS],
+    pub mean: [u16; CHANNELS],
+    pub count: u16,
+    /// segment block index of the sample block holding the first sample
+    pub block: u32,
+}
+
+#[derive(Debug, Clone, Serialize)]
+pub struct SummaryBlock {
+    pub level: u8,
+    pub period: u16,
+    pub first: u32,
+    pub summary: Vec<Summary>,
+}
+
+#[derive(Debug, Clone, Serialize)]
+pub struct Directory {
+    pub index: u16,
+    pub total: u16,
+    pub block: Vec<u32>,
+}
+
+/// Something that happened at the block time; a capture event is followed
+/// by the capture blocks of its window.
+#[derive(Debug, Clone, Copy, Serialize)]
+pub struct Event {
+    /// EVENT_*
+    pub kind: u16,
+    /// capture: TRIGGER_* bits that fired; alarm: rule number;
+    /// thermal: level entered (0 normal, 1 capture suspended, 2 rate lowered)
+    pub cause: u16,
+    pub number: u32,
+    /// capture: TIM5 ticks between capture samples
+    pub sample_ticks: u32,
+    /// capture: samples before the trigger sample
+    pub pre: u16,
+    /// capture: samples from the trigger sample on
+    pub post: u16,
+    pub current_a: f32,
+    pub voltage_v: f32,
+    pub power_w: f32,
+    pub dpdt_w_s: f32,
+    /// alarm: the value the rule watches; zero: the measured ratio;
+    /// thermal: die temperature, C
+    pub value: f32,
+    /// zero: filtered HV current zero ratio at `temperature`
+    pub zero: f32,
+    /// zero: its change per C
+    pub tempco: f32,
+    /// zero: mean die temperature over the idle window, C
+    pub temperature: f32,
+}
+
+impl Event {
+    /// HV current zero ratio at die temperature `t` in C, for zero events.
+    pub fn zero_at(&self, t: f32) -> f32 {
+        self.zero + self.tempco * (t - self.temperature)
+    }
+}
+
+#[derive(Debug, Clone)]
+pub enum Payload {
+    /// raw and packed sample blocks alike
+    Sample(Vec<[u16; CHANNELS]>),
+    Session(Session),
+    Summary(SummaryBlock),
+    Directory(Directory),
+    Event(Event),
+    /// samples at the capture rate, spaced by the event's sample_ticks
+    Capture(Vec<[u16; CHANNELS]>),
+    Unknown,
+}
+
+#[derive(Debug, Clone)]
+pub struct Block {
+    pub header: Header,
+    pub payload: Payload,
+}
+
+#[derive(Debug, PartialEq, Eq)]
+pub enum BlockError {
+    Magic,
+    Crc,
+    Version(u8),
+    Packing,
+}
+
+impl std::fmt::Display for BlockError {
+    fn fmt(&self, f: &mut std::fmt::Formatter) -> std::fmt::Result {
+        match self {
+            BlockError::Magic => write!(f, "bad block magic"),
+            BlockError::Crc => write!(f, "block CRC mismatch"),
+            BlockError::Version(v) => write!(f, "unsupported format version {}", v),
+            BlockError::Packing => write!(f, "corrupt packed samples"),
+        }
+    }
+}
+
+impl std::error::Error for BlockError {}
+
+pub fn parse_header(b: &[u8]) -> Result<Header, BlockError> {
+    if u32_at(b, 0) != BLOCK_MAGIC {
+        return Err(BlockError::Magic);
+    }
+
+    let header = Header {
+        kind: b[4],
+        version: b[5],
+        count: u16_at(b, 6),
+        seq: u32_at(b, 8),
+        flags: u32_at(b, 12),
+        time: u32_at(b, 16) as u64 | (u32_at(b, 20) as u64) << 32,
+    };
+
+    if header.version != FORMAT_VERSION {
+        return Err(BlockError::Version(header.version));
+    }
+
+    Ok(header)
+}
+
+fn parse_summary(b: &[u8]) -> Summary {
+    let mut s = Summary { min: [0; CHANNELS], max: [0; CHANNELS], mean: [0; CHANNELS], count: 0, block: 0 };
+
+    for ch in 0..CHANNELS {
+        s.min[ch] = u16_at(b, ch * 2);
+        s.max[ch] = u16_at(b, (CHANNELS + ch) * 2);
+        s.mean[ch] = u16_at(b, (2 * CHANNELS + ch) * 2);
+    }
+
+    s.count = u16_at(b, 3 * CHANNELS * 2);
+    s.block = u32_at(b, 32);
+    s
+}
+
+/// Whether the CRC of a 512-byte block matches its contents.
+pub fn block_crc_ok(b: &[u8; BLOCK_SIZE]) -> bool {
+    stm32_crc(&b[..BLOCK_SIZE - 4]) == u32_at(b, BLOCK_SIZE - 4)
+}
+
+/// Validates and decodes one 512-byte block.
+pub fn parse_block(b: &[u8; BLOCK_SIZE]) -> Result<Block, BlockError> {
+    parse_header(b)?;
+
+    if !block_crc_ok(b) {
+        return Err(BlockError::Crc);
+    }
+
+    parse_block_unchecked(b)
+}
+
+/// Decodes one 512-byte block whose CRC the caller has checked already.
+pub fn parse_block_unchecked(b: &[u8; BLOCK_SIZE]) -> Result<Block, BlockError> {
+    let header = parse_header(b)?;
+    let p = &b[HEADER_SIZE..HEADER_SIZE + PAYLOAD_SIZE];
+
+    let payload = match header.kind {
+        TYPE_SAMPLE => {
+            let n = (header.count as usize).min(SAMPLES_PER_BLOCK);
+            Payload::Sample(
+                (0..n)
+                    .map(|i| std::array::from_fn(|ch| u16_at(p, (i * CHANNELS + ch) * 2)))
+                    .collect(),
+            )
+        }
+        TYPE_PACKED => match decode_packed(p, header.count as usize) {
+            Some(samples) => Payload::Sample(samples),
+            None => return Err(BlockError::Packing),
+        },
+        TYPE_SESSION => Payload::Session(Session {
+            session: u16_at(p, 0),
+            segment: u16_at(p, 2),
+            start: u32_at(p, 4),
+            sample_rate: u16_at(p, 8),
+            samples_per_block: u16_at(p, 10),
+            channels: u16_at(p, 12),
+            start_ms: u16_at(p, 14),
+            calib: Calib {
+                lv_voltage_scale: f32_at(p, 16),
+                hv_voltage_scale: f32_at(p, 20),
+                hv_current_zero: f32_at(p, 24),
+                hv_current_span: f32_at(p, 28),
+            },
+            tick_hz: u32_at(p, 32),
+            sample_ticks: u32_at(p, 36),
+            flags: u32_at(p, 40),
+            lsi_ppm: f32_at(p, 44),
+            trim_ppm: f32_at(p, 48),
+            start_tick: header.time,
+        }),
+        TYPE_SUMMARY => {
+            let n = (header.count as usize).min(SUMMARIES_PER_BLOCK);
+            Payload::Summary(SummaryBlock {
+                level: p[0],
+                period: u16_at(p, 2),
+                first: u32_at(p, 4),
+                summary: (0..n).map(|i| parse_summary(&p[8 + i * SUMMARY_SIZE..])).collect(),
+            })
+        }
+        TYPE_DIRECTORY => {
+            let n = (header.count as usize).min(DIRECTORY_PER_BLOCK);
+            Payload::Directory(Directory {
+                index: u16_at(p, 0),
+                total: u16_at(p, 2),
+                block: (0..n).map(|i| u32_at(p, 4 + i * 4)).collect(),
+            })
+        }
+        TYPE_EVENT => Payload::Event(Event {
+            kind: u16_at(p, 0),
+            cause: u16_at(p, 2),
+            number: u32_at(p, 4),
+            sample_ticks: u32_at(p, 8),
+            pre: u16_at(p, 12),
+            post: u16_at(p, 14),
+            current_a: f32_at(p, 16),
+            voltage_v: f32_at(p, 20),
+            power_w: f32_at(p, 24),
+            dpdt_w_s: f32_at(p, 28),
+            value: f32_at(p, 32),
+            zero: f32_at(p, 36),
+            tempco: f32_at(p, 40),
+            temperature: f32_at(p, 44),
+        }),
+        TYPE_CAPTURE => match decode_packed(p, header.count as usize) {
+            Some(samples) => Payload::Capture(samples),
+            None => return Err(BlockError::Packing),
+        },
+        _ => Payload::Unknown,
+    };
+
+    Ok(Block { header, payload })
+}
+
+/// Follows the blocks of a segment to find where its log ends. A segment
+/// the device never closed keeps its preallocated length, and past the last
+/// block written it holds whatever the card held before, often blocks of
+/// older logs that parse as well as any. A sample block belongs when its
+/// sequence number carries on from the block before it and its time from
+/// the sample block before it. Other blocks have no time to check and take
+/// the number of the next sample block, so they belong only if a sample
+/// block after them does. A session block never belongs, as only the first
+/// block of a segment is one; it is also the only block that carries a
+/// session number.
+#[derive(Debug, Clone)]
+pub struct Continuity {
+    seq: u32,
+    /// sequence number of the last sample block and one period past its samples
+    sample: Option<(u32, u64)>,
+    sample_ticks: u64,
+}
+
+impl Continuity {
+    /// Starts after a block numbered `seq`, with the sequence number and end
+    /// tick of the last sample block up to it if there is one.
+    pub fn new(seq: u32, sample: Option<(u32, u64)>, sample_ticks: u32) -> Self {
+        Continuity { seq, sample, sample_ticks: sample_ticks as u64 }
+    }
+
+    /// Whether `h` can come next, taking it in if so: `Some(true)` for a
+    /// sample block, which vouches for the blocks before it, and
+    /// `Some(false)` for any other block, which waits for one.
+    pub fn follow(&mut self, h: &Header) -> Option<bool> {
+        let step = h.seq.wrapping_sub(self.seq);
+        let overrun = h.flags & FLAG_OVERRUN != 0;
+
+        // sequence numbers go back only in another log
+        if h.kind == TYPE_SESSION || step >= 1 << 31 {
+            return None;
+        }
+
+        if h.kind != TYPE_SAMPLE && h.kind != TYPE_PACKED {
+            self.seq = h.seq;
+            return Some(false);
+        }
+
+        if step > 1 && !overrun {
+            return None;
+        }
+
+        if let Some((seq, end)) = self.sample {
+            // block times are exact to well within a sample period, and
+            // leave a gap only for the blocks dropped before an overrun
+            let ok = if h.seq.wrapping_sub(seq) > 1 {
+                overrun && h.time + self.sample_ticks >= end
+            } else {
+                h.time.abs_diff(end) <= self.sample_ticks
+            };
+
+            if !ok {
+                return None;
+            }
+        }
+
+        self.seq = h.seq;
+        self.sample = Some((h.seq, h.time + h.count as u64 * self.sample_ticks));
+        Some(true)
+    }
+}
+
+/// One resolution of the summary index, buckets in time order.
+#[derive(Debug, Clone, Serialize)]
+pub struct SummaryLevel {
+    pub period: u16,
+    pub buckets: Vec<Summary>,
+}
+
+fn read_block<R: Read + Seek>(r: &mut R, index: u64) -> io::Result<Block> {
+    let mut buf = [0u8; BLOCK_SIZE];
+
+    r.seek(SeekFrom::Start(index * BLOCK_SIZE as u64))?;
+    r.read_exact(&mut buf)?;
+
+    parse_block(&buf).map_err(|e| io::Error::new(io::ErrorKind::InvalidData, e))
+}
+
+/// Reads the summary index of a closed segment through its trailer, touching
+/// only the directory and summary blocks. Segments that were not closed
+/// cleanly have no trailer and return `InvalidData`.
+pub fn read_summary_index<R: Read + Seek>(r: &mut R) -> io::Result<Vec<SummaryLevel>> {
+    let blocks = r.seek(SeekFrom::End(0))? / BLOCK_SIZE as u64;
+
+    if blocks == 0 {
+        return Err(io::Error::new(io::ErrorKind::InvalidData, "empty segment"));
+    }
+
+    let last = match read_block(r, blocks - 1)?.payload {
+        Payload::Directory(d) => d,
+        _ => return Err(io::Error::new(io::ErrorKind::InvalidData, "segment has no summary trailer")),
+    };
+
+    let total = last.total as u64;
+
+    if total == 0 || total > blocks {
+        return Err(io::Error::new(io::ErrorKind::InvalidData, "bad summary trailer"));
+    }
+
+    let mut entries = Vec::new();
+
+    for i in 0..total - 1 {
+        match read_block(r, blocks - total + i)?.payload {
+            Payload::Directory(d) => entries.extend(d.block),
+            _ => return Err(io::Error::new(io::ErrorKind::InvalidData, "bad summary trailer")),
+        }
+    }
+
+    entries.extend(last.block);
+
+    let mut levels: Vec<SummaryLevel> =
+        SUMMARY_PERIODS.iter().map(|&period| SummaryLevel { period, buckets: Vec::new() }).collect();
+
+    for index in entries {
+        if let Payload::Summary(s) = read_block(r, index as u64)?.payload {
+            if let Some(level) = levels.get_mut(s.level as usize) {
+                level.buckets.extend(s.summary);
+            }
+        }
+    }
+
+    Ok(levels)
+}
+
+pub fn read_summary_file<P: AsRef<Path>>(path: P) -> io::Result<Vec<SummaryLevel>> {
+    read_summary_index(&mut File::open(path)?)
+}
+
+/// One SESSIONS.IDX record: a segment file and its totals.
+#[derive(Debug, Clone, Copy, Serialize)]
+pub struct IndexEntry {
+    pub session: u16,
+    pub segment: u16,
+    /// sequence number of the segment's session block
+    pub first_seq: u32,
+    /// blocks in the segment file, session block included, as of the last
+    /// update; the blocks past it in a segment that was never closed are
+    /// not part of the log
+    pub blocks: u32,
+    /// RTC time at segment start, seconds since 1970
+    pub start: u32,
+    pub duration_ms: u32,
+    pub energy_wh: f32,
+    pub charge_ah: f32,
+    pub peak_power_w: f32,
+    /// INDEX_*
+    pub flags: u32,
+}
+
+/// Decodes one index record, `None` if its magic or CRC is off.
+pub fn parse_index_entry(b: &[u8; INDEX_SIZE]) -> Option<IndexEntry> {
+    if u32_at(b, 0) != INDEX_MAGIC || stm32_crc(&b[..INDEX_SIZE - 4]) != u32_at(b, INDEX_SIZE - 4) {
+        return None;
+    }
+
+    Some(IndexEntry {
+        session: u16_at(b, 4),
+        segment: u16_at(b, 6),
+        first_seq: u32_at(b, 8),
+        blocks: u32_at(b, 12),
+        start: u32_at(b, 16),
+        duration_ms: u32_at(b, 20),
+        energy_wh: f32_at(b, 24),
+        charge_ah: f32_at(b, 28),
+        peak_power_w: f32_at(b, 32),
+        flags: u32_at(b, 36),
+    })
+}
+
+/// The records of a SESSIONS.IDX file in file order, leaving out those a
+/// power loss tore.
+pub fn read_index<P: AsRef<Path>>(path: P) -> io::Result<Vec<IndexEntry>> {
+    let data = std::fs::read(path)?;
+
+    Ok(data.chunks_exact(INDEX_SIZE).filter_map(|r| parse_index_entry(r.try_into().unwrap())).collect())
+}
+
+/// A session as the index lists it, totals over its segments.
+#[derive(Debug, Clone, Serialize)]
+pub struct SessionEntry {
+    pub session: u16,
+    pub start: u32,
+    pub duration_ms: u64,
+    pub energy_wh: f32,
+    pub charge_ah: f32,
+    pub peak_power_w: f32,
+    /// every segment was closed cleanly
+    pub closed: bool,
+    pub segments: Vec<IndexEntry>,
+}
+
+/// Groups index records into sessions, in the order they were logged. A
+/// session number seen again after others starts a new session, as it
+/// does once the numbers wrap.
+pub fn sessions(entries: &[IndexEntry]) -> Vec<SessionEntry> {
+    let mut out: Vec<SessionEntry> = Vec::new();
+
+    for e in entries {
+        match out.last_mut() {
+            Some(s) if s.session == e.session => {
+                s.duration_ms += e.duration_ms as u64;
+                s.energy_wh += e.energy_wh;
+                s.charge_ah += e.charge_ah;
+                s.peak_power_w = s.peak_power_w.max(e.peak_power_w);
+                s.closed &= e.flags & INDEX_CLOSED != 0;
+                s.segments.push(*e);
+            }
+            _ => out.push(SessionEntry {
+                session: e.session,
+                start: e.start,
+                duration_ms: e.duration_ms as u64,
+                energy_wh: e.energy_wh,
+                charge_ah: e.charge_ah,
+                peak_power_w: e.peak_power_w,
+                closed: e.flags & INDEX_CLOSED != 0,
+                segments: vec![*e],
+            }),
+        }
+    }
+
+    out
+}
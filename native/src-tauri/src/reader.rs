@@ -0,0 +1,805 @@
+// Memory-mapped reader for the segment files of a logged session.
+//
+// Opening maps the files and parses only the session block at the head of
+// each, so it costs the same for any file size. A segment the device never
+// closed is still at its preallocated length with stale card data past the
+// log; its headers are followed from the last block SESSIONS.IDX counts to
+// find where the log ends. Sample blocks are found by a binary search on
+// block header times, and a block's CRC is checked the first time it is
+// decoded. The zero updates are collected in one pass over the headers when
+// the segment is first read; past that, the pages of the file that are never
+// asked for are never read. Blocks are independent, so a read decodes them
+// on all cores. Segments with an entry in the decoded cache (cache.rs) are
+// read from it instead.
+
+use std::collections::HashMap;
+use std::fs::{self, File};
+use std::io;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicBool, AtomicU8, Ordering};
+use std::sync::{mpsc, Arc, Mutex, OnceLock};
+use std::thread;
+
+use memmap2::Mmap;
+use rayon::prelude::*;
+use serde::Serialize;
+
+use crate::cache::{self, Cache, Decoded};
+use crate::log::{
+    self, Block, BlockError, Continuity, Event, Header, IndexEntry, Payload, Session, SummaryLevel, BLOCK_SIZE,
+};
+
+const CRC_UNCHECKED: u8 = 0;
+const CRC_GOOD: u8 = 1;
+const CRC_BAD: u8 = 2;
+
+// sample blocks one decode task takes; enough to outweigh the task overhead,
+// few enough that the pool can even out blocks of differing cost
+const BLOCKS_PER_TASK: usize = 64;
+
+// typical STM32F4 temperature sensor curve; the log carries the raw code
+const TEMP_V25: f32 = 0.76;
+const TEMP_SLOPE_V_C: f32 = 0.0025;
+const ADC_VREF: f32 = 3.3;
+
+fn invalid(msg: String) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, msg)
+}
+
+fn is_sample(h: &Header) -> bool {
+    h.kind == log::TYPE_SAMPLE || h.kind == log::TYPE_PACKED
+}
+
+/// Die temperature in C from a temperature channel code.
+pub fn temperature_c(code: u16) -> f32 {
+    25.0 + (code as f32 * ADC_VREF / 4096.0 - TEMP_V25) / TEMP_SLOPE_V_C
+}
+
+// HV current zero ratio at die temperature `t` in C: from the zero update
+// `zero` on, it follows the update's tempco; before any, it is the session's
+fn zero_at(zero: Option<&Event>, session: &Session, t: f32) -> f32 {
+    zero.map_or(session.calib.hv_current_zero, |e| e.zero_at(t))
+}
+
+/// One segment file, mapped.
+pub struct Segment {
+    path: PathBuf,
+    map: Mmap,
+    blocks: usize,
+    session: Session,
+    crc: Vec<AtomicU8>,
+    /// tick of the first sample and one sample period past the last one
+    start: u64,
+    end: u64,
+    summary: OnceLock<Option<Vec<SummaryLevel>>>,
+    /// zero updates and the blocks they are in, in order
+    zeros: OnceLock<Vec<(usize, Event)>>,
+    decoded: OnceLock<Decoded>,
+    /// the decoded entry failed its check and is not used
+    stale: AtomicBool,
+}
+
+impl Segment {
+    /// Maps `path`; `index` holds the SESSIONS.IDX records of its card, if any.
+    pub fn open<P: AsRef<Path>>(path: P, index: &[IndexEntry]) -> io::Result<Self> {
+        let path = path.as_ref().to_path_buf();
+        let file = File::open(&path)?;
+        // the device never writes a closed segment again; a segment still
+        // being written is only ever appended to
+        let map = unsafe { Mmap::map(&file)? };
+        let blocks = map.len() / BLOCK_SIZE;
+
+        if blocks == 0 {
+            return Err(invalid(format!("{}: empty segment", path.display())));
+        }
+
+        let session = match log::parse_block(map[..BLOCK_SIZE].try_into().unwrap()).map(|b| b.payload) {
+            Ok(Payload::Session(s)) => s,
+            Ok(_) => return Err(invalid(format!("{}: no session block", path.display()))),
+            Err(e) => return Err(invalid(format!("{}: {}", path.display(), e))),
+        };
+
+        let crc = (0..blocks).map(|i| AtomicU8::new(if i == 0 { CRC_GOOD } else { CRC_UNCHECKED })).collect();
+        let mut segment = Segment {
+            path,
+            map,
+            blocks,
+            session,
+            crc,
+            start: 0,
+            end: 0,
+            summary: OnceLock::new(),
+            zeros: OnceLock::new(),
+            decoded: OnceLock::new(),
+            stale: AtomicBool::new(false),
+        };
+
+        segment.blocks = segment.log_blocks(index);
+        segment.start = segment.next_sample(1).map_or(segment.session.start_tick, |(_, h)| h.time);
+        segment.end = segment.prev_sample(segment.blocks).map_or(segment.start, |(_, h)| segment.block_end(&h));
+
+        Ok(segment)
+    }
+
+    // blocks of the file that hold the log: the indexed count of a segment
+    // that was closed or recovered, the whole of a file shorter than the
+    // preallocation, and otherwise as far as the blocks carry on from the
+    // last one the index counts
+    fn log_blocks(&self, index: &[IndexEntry]) -> usize {
+        let first = self.header(0).map(|h| h.seq);
+        let entry = index.iter().rev().find(|e| {
+            e.session == self.session.session && e.segment == self.session.segment && Some(e.first_seq) == first
+        });
+        let indexed = entry.map_or(1, |e| (e.blocks as usize).clamp(1, self.blocks));
+
+        if entry.is_some_and(|e| e.flags & (log::INDEX_CLOSED | log::INDEX_RECOVERED) != 0) {
+            return indexed;
+        }
+
+        if self.map.len() < log::SEGMENT_SIZE {
+            return self.blocks;
+        }
+
+        let seq = self.header(indexed - 1).map_or(0, |h| h.seq);
+        let sample = self.prev_sample(indexed).map(|(_, h)| (h.seq, self.block_end(&h)));
+        let mut follow = Continuity::new(seq, sample, self.session.sample_ticks);
+        let mut end = indexed;
+
+        for i in indexed..self.blocks {
+            match self.header(i).and_then(|h| follow.follow(&h)) {
+                Some(true) => end = i + 1,
+                Some(false) => {}
+                None => break,
+            }
+        }
+
+        end
+    }
+
+    pub fn path(&self) -> &Path {
+        &self.path
+    }
+
+    pub fn session(&self) -> &Session {
+        &self.session
+    }
+
+    pub fn blocks(&self) -> usize {
+        self.blocks
+    }
+
+    /// TIM5 ticks of the first sample and past the last one.
+    pub fn span(&self) -> (u64, u64) {
+        (self.start, self.end)
+    }
+
+    /// TIM5 tick at wall-clock time `t`, seconds since 1970.
+    pub fn tick_at(&self, t: f64) -> u64 {
+        let s = &self.session;
+        let d = (t - s.wall_time(s.start_tick)) * s.tick_hz as f64;
+
+        (s.start_tick as f64 + d).max(0.0) as u64
+    }
+
+    /// Summary index from the segment trailer, read on first use; `None`
+    /// for a segment that was not closed cleanly.
+    pub fn summary(&self) -> Option<&[SummaryLevel]> {
+        self.summary
+            .get_or_init(|| log::read_summary_index(&mut io::Cursor::new(&self.map[..self.blocks * BLOCK_SIZE])).ok())
+            .as_deref()
+    }
+
+    /// The decoded cache entry, once one is attached and unless it failed
+    /// its check.
+    pub fn decoded(&self) -> Option<&Decoded> {
+        self.decoded.get().filter(|_| !self.stale.load(Ordering::Relaxed))
+    }
+
+    pub(crate) fn raw(&self, i: usize) -> &[u8; BLOCK_SIZE] {
+        self.map[i * BLOCK_SIZE..(i + 1) * BLOCK_SIZE].try_into().unwrap()
+    }
+
+    /// Header of block `i`, without checking its CRC.
+    pub fn header(&self, i: usize) -> Option<Header> {
+        if i < self.blocks {
+            log::parse_header(self.raw(i)).ok()
+        } else {
+            None
+        }
+    }
+
+    /// Decodes block `i`, checking its CRC the first time.
+    pub fn block(&self, i: usize) -> Result<Block, BlockError> {
+        let b = self.raw(i);
+
+        match self.crc[i].load(Ordering::Relaxed) {
+            CRC_GOOD => {}
+            CRC_BAD => return Err(BlockError::Crc),
+            _ => {
+                log::parse_header(b)?;
+
+                let ok = log::block_crc_ok(b);
+                self.crc[i].store(if ok { CRC_GOOD } else { CRC_BAD }, Ordering::Relaxed);
+
+                if !ok {
+                    return Err(BlockError::Crc);
+                }
+            }
+        }
+
+        log::parse_block_unchecked(b)
+    }
+
+    fn block_end(&self, h: &Header) -> u64 {
+        h.time + h.count as u64 * self.session.sample_ticks as u64
+    }
+
+    /// First sample block at or after `i`.
+    fn next_sample(&self, i: usize) -> Option<(usize, Header)> {
+        (i..self.blocks).find_map(|j| self.header(j).filter(is_sample).map(|h| (j, h)))
+    }
+
+    /// Last sample block before `i`.
+    fn prev_sample(&self, i: usize) -> Option<(usize, Header)> {
+        (1..i).rev().find_map(|j| self.header(j).filter(is_sample).map(|h| (j, h)))
+    }
+
+    /// First block from which the samples ending after `tick` are found.
+    pub fn seek(&self, tick: u64) -> usize {
+        let (mut lo, mut hi) = (1, self.blocks);
+
+        // sample block times only increase; the other blocks in between are skipped over
+        while lo < hi {
+            let mid = lo + (hi - lo) / 2;
+
+            match self.next_sample(mid) {
+                Some((_, h)) if self.block_end(&h) <= tick => lo = mid + 1,
+                _ => hi = mid,
+            }
+        }
+
+        lo
+    }
+
+    /// Zero updates of the segment with the blocks they are in, found in
+    /// one pass over the headers on first use.
+    pub fn zeros(&self) -> &[(usize, Event)] {
+        self.zeros.get_or_init(|| {
+            (1..self.blocks)
+                .filter(|&i| self.header(i).is_some_and(|h| h.kind == log::TYPE_EVENT))
+                .filter_map(|i| match self.block(i) {
+                    Ok(Block { payload: Payload::Event(e), .. }) if e.kind == log::EVENT_ZERO => Some((i, e)),
+                    _ => None,
+                })
+                .collect()
+        })
+    }
+
+    // zero updates before block `i`
+    fn zeros_before(&self, i: usize) -> usize {
+        self.zeros().partition_point(|&(j, _)| j < i)
+    }
+
+    /// The last zero update before block `i`; before the first, the
+    /// segment's calibration zero applies.
+    pub fn zero_before(&self, i: usize) -> Option<&Event> {
+        self.zeros_before(i).checked_sub(1).map(|n| &self.zeros()[n].1)
+    }
+
+    /// HV current zero ratio at block `i` and die temperature `t` in C, as
+    /// the device works it out.
+    pub fn zero_at(&self, i: usize, t: f32) -> f32 {
+        zero_at(self.zero_before(i), &self.session, t)
+    }
+
+    /// `plan` over wall-clock times, seconds since 1970.
+    fn plan_range(&self, segment: usize, start: f64, end: f64, out: &mut Vec<Span>) {
+        let (from, to) = (self.tick_at(start).max(self.start), self.tick_at(end).min(self.end));
+
+        if from < to {
+            self.plan(segment, from, to, out);
+        }
+    }
+
+    /// Lists the sample blocks holding samples with `from <= tick < to`,
+    /// reading headers only.
+    fn plan(&self, segment: usize, from: u64, to: u64, out: &mut Vec<Span>) {
+        let first = self.seek(from);
+        let ticks = (self.session.sample_ticks as u64).max(1);
+        let zeros = self.zeros();
+        let mut next = self.zeros_before(first);
+        let mut zero = self.zero_before(first).copied();
+
+        for i in first..self.blocks {
+            let h = match self.header(i) {
+                Some(h) => h,
+                None => continue,
+            };
+
+            if is_sample(&h) {
+                if h.time >= to {
+                    break;
+                }
+
+                while next < zeros.len() && zeros[next].0 < i {
+                    zero = Some(zeros[next].1);
+                    next += 1;
+                }
+
+                let n = h.count as u64;
+                let skip = from.saturating_sub(h.time).div_ceil(ticks).min(n);
+                let end = (to - h.time).div_ceil(ticks).min(n);
+
+                if end > skip {
+                    out.push(Span { segment, block: i, skip: skip as usize, take: (end - skip) as usize, zero });
+                }
+            }
+        }
+    }
+
+    /// Decodes the samples of `span` into `out` from `pos` on, converted with
+    /// the segment calibration and the zero in effect at each sample's die
+    /// temperature; false if the block is bad.
+    fn decode(&self, span: &Span, out: &mut ColumnsMut, pos: usize) -> bool {
+        let h = match self.block(span.block) {
+            Ok(Block { header, payload: Payload::Sample(s) }) if s.len() >= span.skip + span.take => {
+                (header, s)
+            }
+            _ => return false,
+        };
+        let (header, samples) = h;
+        let calib = &self.session.calib;
+        let ticks = self.session.sample_ticks as u64;
+
+        for (k, s) in samples[span.skip..span.skip + span.take].iter().enumerate() {
+            let tick = header.time + (span.skip + k) as u64 * ticks;
+            let r = s[log::CH_5V_REF].max(1) as f32;
+            let v = s[log::CH_HV_VOLTAGE] as f32 * calib.hv_voltage_scale;
+            let t = temperature_c(s[log::CH_TEMPERATURE]);
+            let a = (s[log::CH_HV_CURRENT] as f32 / r - zero_at(span.zero.as_ref(), &self.session, t))
+                * calib.hv_current_span;
+            let j = pos + k;
+
+            out.time[j] = self.session.wall_time(tick);
+            out.voltage[j] = v;
+            out.current[j] = a;
+            out.power[j] = v * a;
+            out.lv_voltage[j] = s[log::CH_LV_VOLTAGE] as f32 * calib.lv_voltage_scale;
+            out.temperature[j] = t;
+        }
+
+        true
+    }
+}
+
+/// Samples of one block that fall in a read, with the zero update in effect
+/// there, if any.
+#[derive(Debug, Clone, Copy)]
+struct Span {
+    segment: usize,
+    block: usize,
+    skip: usize,
+    take: usize,
+    zero: Option<Event>,
+}
+
+/// Samples in columns, physical units.
+#[derive(Debug, Clone, Default, Serialize)]
+pub struct Columns {
+    /// seconds since 1970
+    pub time: Vec<f64>,
+    /// HV voltage, V
+    pub voltage: Vec<f32>,
+    /// HV current, A
+    pub current: Vec<f32>,
+    /// HV power, W
+    pub power: Vec<f32>,
+    /// LV voltage, V
+    pub lv_voltage: Vec<f32>,
+    /// die temperature, C, on the typical sensor curve
+    pub temperature: Vec<f32>,
+    /// blocks in the range left out for a bad CRC
+    pub bad_blocks: u32,
+}
+
+impl Columns {
+    fn zeroed(n: usize) -> Self {
+        Columns {
+            time: vec![0.0; n],
+            voltage: vec![0.0; n],
+            current: vec![0.0; n],
+            power: vec![0.0; n],
+            lv_voltage: vec![0.0; n],
+            temperature: vec![0.0; n],
+            bad_blocks: 0,
+        }
+    }
+
+    fn as_mut(&mut self) -> ColumnsMut<'_> {
+        ColumnsMut {
+            time: &mut self.time,
+            voltage: &mut self.voltage,
+            current: &mut self.current,
+            power: &mut self.power,
+            lv_voltage: &mut self.lv_voltage,
+            temperature: &mut self.temperature,
+        }
+    }
+
+    /// Moves samples `src` down to `dst`.
+    fn shift(&mut self, src: std::ops::Range<usize>, dst: usize) {
+        self.time.copy_within(src.clone(), dst);
+        self.voltage.copy_within(src.clone(), dst);
+        self.current.copy_within(src.clone(), dst);
+        self.power.copy_within(src.clone(), dst);
+        self.lv_voltage.copy_within(src.clone(), dst);
+        self.temperature.copy_within(src, dst);
+    }
+
+    fn truncate(&mut self, n: usize) {
+        self.time.truncate(n);
+        self.voltage.truncate(n);
+        self.current.truncate(n);
+        self.power.truncate(n);
+        self.lv_voltage.truncate(n);
+        self.temperature.truncate(n);
+    }
+
+    /// The f32 columns: voltage, current, power, LV voltage, temperature.
+    pub fn columns(&self) -> [&Vec<f32>; 5] {
+        [&self.voltage, &self.current, &self.power, &self.lv_voltage, &self.temperature]
+    }
+
+    pub fn columns_mut(&mut self) -> [&mut Vec<f32>; 5] {
+        [&mut self.voltage, &mut self.current, &mut self.power, &mut self.lv_voltage, &mut self.temperature]
+    }
+
+    fn append(&mut self, other: Columns) {
+        if self.is_empty() {
+            let bad = self.bad_blocks;
+
+            *self = other;
+            self.bad_blocks += bad;
+            return;
+        }
+
+        self.time.extend_from_slice(&other.time);
+
+        for (col, o) in self.columns_mut().into_iter().zip(other.columns()) {
+            col.extend_from_slice(o);
+        }
+
+        self.bad_blocks += other.bad_blocks;
+    }
+
+    pub fn len(&self) -> usize {
+        self.time.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.time.is_empty()
+    }
+}
+
+/// A stretch of `Columns` one decode task writes.
+struct ColumnsMut<'a> {
+    time: &'a mut [f64],
+    voltage: &'a mut [f32],
+    current: &'a mut [f32],
+    power: &'a mut [f32],
+    lv_voltage: &'a mut [f32],
+    temperature: &'a mut [f32],
+}
+
+impl<'a> ColumnsMut<'a> {
+    fn split_at(self, n: usize) -> (Self, Self) {
+        let (time, time_rest) = self.time.split_at_mut(n);
+        let (voltage, voltage_rest) = self.voltage.split_at_mut(n);
+        let (current, current_rest) = self.current.split_at_mut(n);
+        let (power, power_rest) = self.power.split_at_mut(n);
+        let (lv_voltage, lv_voltage_rest) = self.lv_voltage.split_at_mut(n);
+        let (temperature, temperature_rest) = self.temperature.split_at_mut(n);
+
+        (
+            ColumnsMut { time, voltage, current, power, lv_voltage, temperature },
+            ColumnsMut {
+                time: time_rest,
+                voltage: voltage_rest,
+                current: current_rest,
+                power: power_rest,
+                lv_voltage: lv_voltage_rest,
+                temperature: temperature_rest,
+            },
+        )
+    }
+}
+
+/// What the host shows of an opened log.
+#[derive(Debug, Clone, Serialize)]
+pub struct LogInfo {
+    pub session: u16,
+    pub segments: Vec<String>,
+    pub sample_rate: u16,
+    /// wall-clock span of the samples, seconds since 1970
+    pub start: f64,
+    pub end: f64,
+    /// the RTC was set by a host when the session started
+    pub time_set: bool,
+    pub bytes: u64,
+}
+
+/// Chunks of a read, from `LogFile::chunks`.
+pub struct Chunks<'a> {
+    log: &'a LogFile,
+    spans: Vec<Span>,
+    next: usize,
+    samples: usize,
+    total: usize,
+}
+
+impl Chunks<'_> {
+    /// Samples in all chunks together, bad blocks included.
+    pub fn total(&self) -> usize {
+        self.total
+    }
+
+    /// Hands the chunks to `f` in order, decoding the next one on another
+    /// thread while `f` works on the last; stops at the first error of `f`.
+    pub fn prefetch<E, F: FnMut(Columns) -> Result<(), E>>(self, f: F) -> Result<(), E> {
+        thread::scope(|s| {
+            let (tx, rx) = mpsc::sync_channel(1);
+
+            // ends early when `f` fails and the receiver goes
+            s.spawn(move || {
+                for chunk in self {
+                    if tx.send(chunk).is_err() {
+                        break;
+                    }
+                }
+            });
+
+            rx.into_iter().try_for_each(f)
+        })
+    }
+}
+
+impl Iterator for Chunks<'_> {
+    type Item = Columns;
+
+    fn next(&mut self) -> Option<Columns> {
+        let first = self.next;
+        let mut n = 0;
+
+        while self.next < self.spans.len() && (n == 0 || n + self.spans[self.next].take <= self.samples) {
+            n += self.spans[self.next].take;
+            self.next += 1;
+        }
+
+        (self.next > first).then(|| self.log.decode(&self.spans[first..self.next]).0)
+    }
+}
+
+/// The segments of one session, in order.
+pub struct LogFile {
+    segments: Vec<Segment>,
+}
+
+// segment files are named LOG<session>_<segment>.BIN
+fn segment_name(path: &Path) -> Option<(String, u32)> {
+    let name = path.file_name()?.to_str()?.to_ascii_uppercase();
+    let stem = name.strip_prefix("LOG")?.strip_suffix(".BIN")?;
+    let (session, segment) = stem.split_once('_')?;
+
+    if session.is_empty() || !session.bytes().all(|c| c.is_ascii_digit()) {
+        return None;
+    }
+
+    Some((session.to_string(), segment.parse().ok()?))
+}
+
+impl LogFile {
+    /// Opens the session `path` belongs to: every segment file next to it
+    /// with the same session number, or just `path` if it is not named like
+    /// a segment.
+    pub fn open<P: AsRef<Path>>(path: P) -> io::Result<Self> {
+        let path = path.as_ref();
+        let mut paths = vec![];
+
+        if let (Some((session, _)), Some(dir)) = (segment_name(path), path.parent()) {
+            for entry in fs::read_dir(if dir.as_os_str().is_empty() { Path::new(".") } else { dir })? {
+                let p = entry?.path();
+
+                if let Some((s, n)) = segment_name(&p) {
+                    if s == session {
+                        paths.push((n, p));
+                    }
+                }
+            }
+        }
+
+        if paths.is_empty() {
+            paths.push((0, path.to_path_buf()));
+        }
+
+        paths.sort();
+
+        // without an index, unclosed segments are followed from their start
+        let index = log::read_index(path.with_file_name(log::INDEX_FILE)).unwrap_or_default();
+        let segments = paths.into_iter().map(|(_, p)| Segment::open(p, &index)).collect::<io::Result<Vec<_>>>()?;
+
+        Ok(LogFile { segments })
+    }
+
+    pub fn segments(&self) -> &[Segment] {
+        &self.segments
+    }
+
+    pub fn info(&self) -> LogInfo {
+        let first = &self.segments[0];
+        let last = &self.segments[self.segments.len() - 1];
+
+        LogInfo {
+            session: first.session.session,
+            segments: self.segments.iter().map(|s| s.path.display().to_string()).collect(),
+            sample_rate: first.session.sample_rate,
+            start: first.session.wall_time(first.start),
+            end: last.session.wall_time(last.end),
+            time_set: first.session.flags & log::SESSION_TIME_SET != 0,
+            bytes: self.segments.iter().map(|s| (s.blocks * BLOCK_SIZE) as u64).sum(),
+        }
+    }
+
+    /// Samples from `start` to `end`, wall-clock seconds since 1970.
+    ///
+    /// The blocks in range are listed from their headers first, which also
+    /// fixes where each one's samples go. They are then checked and decoded
+    /// in parallel on the rayon pool, BLOCKS_PER_TASK to a task, straight
+    /// into the columns.
+    pub fn read(&self, start: f64, end: f64) -> Columns {
+        self.read_segments(start, end, |_| true)
+    }
+
+    /// Like `read`, over the segments `pick` selects.
+    pub fn read_segments<F: Fn(&Segment) -> bool>(&self, start: f64, end: f64, pick: F) -> Columns {
+        let mut out = Columns::default();
+        let mut spans = Vec::new();
+
+        // runs of segments without a cache entry are decoded together
+        for (k, seg) in self.segments.iter().enumerate().filter(|(_, seg)| pick(seg)) {
+            match seg.decoded() {
+                Some(d) => {
+                    out.append(self.decode(&spans).0);
+                    spans.clear();
+                    d.read(start, end, &mut out);
+                }
+                None => seg.plan_range(k, start, end, &mut spans),
+            }
+        }
+
+        out.append(self.decode(&spans).0);
+        out
+    }
+
+    /// The samples from `start` to `end` in chunks of about `samples` each,
+    /// oldest first. A chunk is decoded as `read` does when it is taken, so
+    /// only the list of blocks is held for the whole range.
+    pub fn chunks(&self, start: f64, end: f64, samples: usize) -> Chunks<'_> {
+        let spans = self.plan(start, end, |_| true);
+        let total = spans.iter().map(|s| s.take).sum();
+
+        Chunks { log: self, spans, next: 0, samples: samples.max(1), total }
+    }
+
+    fn plan<F: Fn(&Segment) -> bool>(&self, start: f64, end: f64, pick: F) -> Vec<Span> {
+        let mut spans = Vec::new();
+
+        for (k, seg) in self.segments.iter().enumerate().filter(|(_, seg)| pick(seg)) {
+            seg.plan_range(k, start, end, &mut spans);
+        }
+
+        spans
+    }
+
+    /// Attaches the cache entries there are for the segments.
+    pub fn use_cache(&self, cache: &Cache) {
+        for seg in &self.segments {
+            if let Some(d) = cache.load(seg) {
+                let _ = seg.decoded.set(d);
+            }
+        }
+    }
+
+    /// Checks the attached cache entries against the CRCs of all their
+    /// segment's blocks, dropping those that fail, and decodes the segments
+    /// without an entry whole and stores them, so the next open of the
+    /// session does not decode at all.
+    pub fn fill_cache(&self, cache: &Cache) -> io::Result<()> {
+        for (k, seg) in self.segments.iter().enumerate() {
+            if seg.stale.load(Ordering::Relaxed) {
+                continue;
+            }
+
+            if let Some(d) = seg.decoded() {
+                if d.crcs() != cache::crcs(seg) {
+                    seg.stale.store(true, Ordering::Relaxed);
+                    cache.discard(seg)?;
+                }
+
+                continue;
+            }
+
+            let mut spans = Vec::new();
+
+            seg.plan(k, seg.start, seg.end, &mut spans);
+
+            let (columns, bad) = self.decode(&spans);
+            let _ = seg.decoded.set(cache.store(seg, &columns, &bad)?);
+        }
+
+        Ok(())
+    }
+
+    // the samples of `spans` and the time of each block left out for a bad CRC
+    fn decode(&self, spans: &[Span]) -> (Columns, Vec<f64>) {
+        let total = spans.iter().map(|s| s.take).sum();
+        let mut out = Columns::zeroed(total);
+        let mut tasks = Vec::new();
+        let mut rest = out.as_mut();
+        let mut offset = 0;
+
+        for chunk in spans.chunks(BLOCKS_PER_TASK) {
+            let n = chunk.iter().map(|s| s.take).sum();
+            let (head, tail) = rest.split_at(n);
+
+            tasks.push((chunk, head, offset));
+            rest = tail;
+            offset += n;
+        }
+
+        let done: Vec<(usize, usize, Vec<f64>)> = tasks
+            .into_par_iter()
+            .map(|(chunk, mut cols, offset)| {
+                let (mut pos, mut bad) = (0, Vec::new());
+
+                for span in chunk {
+                    let seg = &self.segments[span.segment];
+
+                    if seg.decode(span, &mut cols, pos) {
+                        pos += span.take;
+                    } else {
+                        bad.push(seg.session.wall_time(seg.header(span.block).map_or(seg.start, |h| h.time)));
+                    }
+                }
+
+                (offset, pos, bad)
+            })
+            .collect();
+
+        // a bad block leaves its room unused at the end of its task's stretch; close the gaps
+        let mut len = 0;
+        let mut bad_times = Vec::new();
+
+        for (offset, n, bad) in done {
+            if offset != len {
+                out.shift(offset..offset + n, len);
+            }
+
+            len += n;
+            bad_times.extend(bad);
+        }
+
+        out.truncate(len);
+        out.bad_blocks = bad_times.len() as u32;
+        (out, bad_times)
+    }
+}
+
+/// Logs opened by the host, by the path they were opened with.
+#[derive(Default)]
+pub struct LogState(pub Mutex<HashMap<String, Arc<LogFile>>>);
+
+impl LogState {
+    pub fn get(&self, path: &str) -> Option<Arc<LogFile>> {
+        self.0.lock().unwrap().get(path).cloned()
+    }
+}
@@ -0,0 +1,96 @@
+// Live against the simulated meter (examples/common/meter.rs) on a pty.
+//
+// The simulator streams well past RING_LEN samples, faster than the logged
+// rate, while snapshots are taken every few milliseconds. Each snapshot has
+// to carry on from the last one's cursor with the next sample number, with
+// the values the simulator sent, and reading the whole ring afterwards gives
+// at most RING_LEN samples. Stopping sends STREAM OFF while sample lines are
+// still coming in, so its reply has to be picked out from between them.
+
+#![cfg(unix)]
+
+#[path = "../examples/common/meter.rs"]
+mod meter;
+
+use std::thread;
+use std::time::{Duration, Instant};
+
+use fsk_energymeter_lib::device::Device;
+use fsk_energymeter_lib::live::{self, Live, LiveSample, RING_LEN};
+
+// sample lines a second from the simulator
+const RATE: f64 = 20_000.0;
+const SAMPLES: u64 = RING_LEN as u64 * 3 / 2;
+const TIMEOUT: Duration = Duration::from_secs(120);
+
+// a line carries three decimals
+fn close(got: f32, want: f64) -> bool {
+    (got as f64 - want).abs() <= 1e-3
+}
+
+#[test]
+fn live_stream_through_the_ring() {
+    let meter = meter::Meter::start(RATE).expect("no pty");
+    let dev = Device::open(meter.path()).expect("pty does not open as a port");
+    let live = Live::start(dev).map_err(|(_, e)| e).expect("STREAM ON failed");
+    let deadline = Instant::now() + TIMEOUT;
+    let (mut cursor, mut last) = (0, None);
+
+    while live.ring().written() < SAMPLES {
+        assert!(!live.failed(), "the live reader ended");
+        assert!(Instant::now() < deadline, "{} of {} samples in {:?}", live.ring().written(), SAMPLES, TIMEOUT);
+
+        let (c, next) = live::snapshot(live.ring(), cursor);
+
+        assert_eq!(c.len() as u64, next - cursor, "snapshot after {} skipped or repeated samples", cursor);
+
+        for i in 0..c.len() {
+            let number = (c.time[i] * live::SAMPLE_RATE).round() as u32;
+            let [v, a, lv, t] = meter::values(number);
+
+            if let Some(last) = last {
+                assert_eq!(number, last + 1, "sample after {}", last);
+            }
+
+            assert!(
+                close(c.voltage[i], v)
+                    && close(c.current[i], a)
+                    && close(c.lv_voltage[i], lv)
+                    && close(c.temperature[i], t),
+                "sample {} does not hold what was sent",
+                number
+            );
+
+            last = Some(number);
+        }
+
+        cursor = next;
+        thread::sleep(Duration::from_millis(2));
+    }
+
+    let mut all = Vec::new();
+    let end = live.ring().read(0, &mut all);
+
+    assert!(end >= SAMPLES && !all.is_empty() && all.len() <= RING_LEN, "{} samples held of {}", all.len(), end);
+    assert!(all.windows(2).all(|w| w[1].number == w[0].number + 1), "the ring is out of order");
+
+    let (mut dev, stopped) = live.stop();
+
+    stopped.expect("STREAM OFF failed");
+    dev.time().expect("TIME after the stream failed");
+}
+
+#[test]
+fn sample_lines_parse() {
+    let s = LiveSample { number: 7, voltage: 519.5, current: -12.25, lv_voltage: 24.1, temperature: 38.0 };
+
+    assert_eq!(LiveSample::parse("!S 7 519.500 -12.250 24.100 38.000"), Some(s));
+
+    // no prefix, a field short, one too many, a bad number, a reply
+    let bad =
+        ["S 7 519.5 -12.25 24.1 38", "!S 7 519.5 -12.25 24.1", "!S 7 519.5 -12.25 24.1 38 1", "!S x 1 2 3 4", "OK"];
+
+    for line in bad {
+        assert_eq!(LiveSample::parse(line), None, "{}", line);
+    }
+}
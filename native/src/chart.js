@@ -0,0 +1,584 @@
+// WebGL time-series panels sharing one time axis and cursor.
+//
+// Each panel keeps its channel in a GPU buffer of (time, value) vertices,
+// time taken from an origin so float32 holds it. Panning and zooming only
+// change two shader uniforms, so a frame is a couple of draw calls per
+// panel whatever the point count, and frames are drawn only when something
+// changed. Samples are drawn as a line strip. Min/max envelopes are drawn
+// twice: as a filled triangle strip between the edges, and as a line
+// zigzagging min, max, min, ..., which keeps single-sample points visible.
+// Live samples are appended in place with bufferSubData.
+//
+// Grid, labels and the cursor readout go on a 2D canvas over the GL one.
+
+const VERTEX = `
+attribute vec2 point;
+uniform vec2 scale;
+uniform vec2 offset;
+
+void main() {
+  gl_Position = vec4(point * scale + offset, 0.0, 1.0);
+}`;
+
+const FRAGMENT = `
+precision mediump float;
+uniform vec4 color;
+
+void main() {
+  gl_FragColor = color;
+}`;
+
+// points a live panel keeps before dropping the older half, 22 min at 100 Hz
+const LIVE_CAPACITY = 1 << 17;
+
+const BAND_ALPHA = 0.3;
+const MARK_COLOR = "rgba(224, 56, 84, 0.18)"; // power limit violations
+const ZOOM_STEP = 1.0015; // per wheel delta unit
+const Y_MARGIN = 0.08; // of the visible value range, above and below
+const TIME_STEPS = [
+  0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1, 2, 5, 10, 15, 30, 60, 120, 300, 600, 900, 1800,
+  3600, 7200, 10800, 21600, 43200, 86400,
+];
+
+function valueStep(span, count) {
+  const raw = span / count;
+  const mag = Math.pow(10, Math.floor(Math.log10(raw)));
+  const n = raw / mag;
+
+  return mag * (n < 1.5 ? 1 : n < 3.5 ? 2 : n < 7.5 ? 5 : 10);
+}
+
+function timeStep(span, count) {
+  const raw = span / count;
+
+  return TIME_STEPS.find((s) => s >= raw) ?? valueStep(span, count);
+}
+
+function ticks(lo, hi, step) {
+  const out = [];
+
+  for (let v = Math.ceil(lo / step) * step; v <= hi; v += step) {
+    out.push(v);
+  }
+
+  return out;
+}
+
+// first index in time[0..n) at or after t
+function lowerBound(time, n, t) {
+  let lo = 0;
+  let hi = n;
+
+  while (lo < hi) {
+    const mid = (lo + hi) >> 1;
+
+    if (time[mid] < t) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+function shader(gl, type, source) {
+  const s = gl.createShader(type);
+
+  gl.shaderSource(s, source);
+  gl.compileShader(s);
+
+  if (!gl.getShaderParameter(s, gl.COMPILE_STATUS)) {
+    throw new Error(gl.getShaderInfoLog(s));
+  }
+
+  return s;
+}
+
+class Plot {
+  constructor(group, element, options) {
+    this.group = group;
+    this.options = options;
+    this.element = element;
+
+    this.canvas = document.createElement("canvas");
+    this.overlay = document.createElement("canvas");
+    element.append(this.canvas, this.overlay);
+
+    const gl = this.canvas.getContext("webgl", { antialias: true, premultipliedAlpha: false });
+    const program = gl.createProgram();
+
+    gl.attachShader(program, shader(gl, gl.VERTEX_SHADER, VERTEX));
+    gl.attachShader(program, shader(gl, gl.FRAGMENT_SHADER, FRAGMENT));
+    gl.linkProgram(program);
+    gl.useProgram(program);
+    gl.enable(gl.BLEND);
+    gl.blendFunc(gl.SRC_ALPHA, gl.ONE_MINUS_SRC_ALPHA);
+
+    this.gl = gl;
+    this.point = gl.getAttribLocation(program, "point");
+    this.scale = gl.getUniformLocation(program, "scale");
+    this.offset = gl.getUniformLocation(program, "offset");
+    this.color = gl.getUniformLocation(program, "color");
+    this.buffer = gl.createBuffer();
+
+    this.clear();
+  }
+
+  clear() {
+    this.kind = "line";
+    this.count = 0;
+    this.capacity = 0;
+    this.time = this.min = this.max = this.verts = null;
+    this.yRange = [0, 1];
+  }
+
+  resize() {
+    const ratio = window.devicePixelRatio || 1;
+    const w = Math.max(1, Math.round(this.element.clientWidth * ratio));
+    const h = Math.max(1, Math.round(this.element.clientHeight * ratio));
+
+    for (const c of [this.canvas, this.overlay]) {
+      c.width = w;
+      c.height = h;
+    }
+  }
+
+  // a whole series; `max` only for envelopes
+  set(time, min, max, origin) {
+    const gl = this.gl;
+    const n = time.length;
+    const band = max !== null;
+    const verts = new Float32Array(n * (band ? 4 : 2));
+
+    for (let i = 0, k = 0; i < n; i++) {
+      const t = time[i] - origin;
+
+      verts[k++] = t;
+      verts[k++] = min[i];
+
+      if (band) {
+        verts[k++] = t;
+        verts[k++] = max[i];
+      }
+    }
+
+    gl.bindBuffer(gl.ARRAY_BUFFER, this.buffer);
+    gl.bufferData(gl.ARRAY_BUFFER, verts, gl.STATIC_DRAW);
+
+    this.kind = band ? "band" : "line";
+    this.count = this.capacity = n;
+    this.time = time;
+    this.min = min;
+    this.max = band ? max : min;
+    this.verts = null;
+  }
+
+  // an empty line to append live samples to
+  reserve(capacity) {
+    const gl = this.gl;
+
+    gl.bindBuffer(gl.ARRAY_BUFFER, this.buffer);
+    gl.bufferData(gl.ARRAY_BUFFER, capacity * 8, gl.DYNAMIC_DRAW);
+
+    this.clear();
+    this.capacity = capacity;
+    this.time = new Float64Array(capacity);
+    this.min = this.max = new Float32Array(capacity);
+    this.verts = new Float32Array(capacity * 2);
+  }
+
+  append(time, values, origin) {
+    const gl = this.gl;
+    const cap = this.capacity;
+    let n = time.length;
+
+    if (n > cap) {
+      time = time.subarray(n - cap);
+      values = values.subarray(n - cap);
+      n = cap;
+    }
+
+    gl.bindBuffer(gl.ARRAY_BUFFER, this.buffer);
+
+    // full: keep the newer half and upload it again, once per cap / 2 points
+    if (this.count + n > cap) {
+      const keep = Math.min(this.count, cap >> 1, cap - n);
+      const from = this.count - keep;
+
+      this.time.copyWithin(0, from, this.count);
+      this.min.copyWithin(0, from, this.count);
+      this.verts.copyWithin(0, from * 2, this.count * 2);
+      gl.bufferSubData(gl.ARRAY_BUFFER, 0, this.verts.subarray(0, keep * 2));
+      this.count = keep;
+    }
+
+    const at = this.count;
+
+    for (let i = 0; i < n; i++) {
+      this.time[at + i] = time[i];
+      this.min[at + i] = values[i];
+      this.verts[(at + i) * 2] = time[i] - origin;
+      this.verts[(at + i) * 2 + 1] = values[i];
+    }
+
+    gl.bufferSubData(gl.ARRAY_BUFFER, at * 8, this.verts.subarray(at * 2, (at + n) * 2));
+    this.count += n;
+  }
+
+  // points drawn for the view, one past each edge so lines reach them
+  visible([x0, x1]) {
+    const first = Math.max(0, lowerBound(this.time, this.count, x0) - 1);
+    const last = Math.min(this.count, lowerBound(this.time, this.count, x1) + 1);
+
+    return [first, last];
+  }
+
+  autoscale() {
+    const [first, last] = this.visible(this.group.view);
+    let lo = Infinity;
+    let hi = -Infinity;
+
+    for (let i = first; i < last; i++) {
+      if (this.min[i] < lo) lo = this.min[i];
+      if (this.max[i] > hi) hi = this.max[i];
+    }
+
+    if (!(hi >= lo)) {
+      [lo, hi] = [0, 1];
+    } else if (hi === lo) {
+      [lo, hi] = [lo - 1, hi + 1];
+    }
+
+    const pad = (hi - lo) * Y_MARGIN;
+    this.yRange = [lo - pad, hi + pad];
+  }
+
+  draw() {
+    const gl = this.gl;
+    const [x0, x1] = this.group.view;
+    const [y0, y1] = this.yRange;
+    const [r, g, b] = this.options.color;
+
+    gl.viewport(0, 0, this.canvas.width, this.canvas.height);
+    gl.clearColor(0, 0, 0, 0);
+    gl.clear(gl.COLOR_BUFFER_BIT);
+
+    if (this.count > 0) {
+      const sx = 2 / (x1 - x0);
+      const sy = 2 / (y1 - y0);
+      const [first, last] = this.visible(this.group.view);
+
+      gl.uniform2f(this.scale, sx, sy);
+      gl.uniform2f(this.offset, -1 - (x0 - this.group.origin) * sx, -1 - y0 * sy);
+      gl.bindBuffer(gl.ARRAY_BUFFER, this.buffer);
+      gl.enableVertexAttribArray(this.point);
+      gl.vertexAttribPointer(this.point, 2, gl.FLOAT, false, 0, 0);
+
+      if (this.kind === "band") {
+        gl.uniform4f(this.color, r, g, b, BAND_ALPHA);
+        gl.drawArrays(gl.TRIANGLE_STRIP, first * 2, (last - first) * 2);
+        gl.uniform4f(this.color, r, g, b, 1);
+        gl.drawArrays(gl.LINE_STRIP, first * 2, (last - first) * 2);
+      } else {
+        gl.uniform4f(this.color, r, g, b, 1);
+        gl.drawArrays(gl.LINE_STRIP, first, last - first);
+      }
+    }
+
+    this.drawOverlay();
+  }
+
+  drawOverlay() {
+    const ctx = this.overlay.getContext("2d");
+    const { width: w, height: h } = this.overlay;
+    const ratio = window.devicePixelRatio || 1;
+    const [x0, x1] = this.group.view;
+    const [y0, y1] = this.yRange;
+    const px = (x) => ((x - x0) / (x1 - x0)) * w;
+    const py = (y) => h - ((y - y0) / (y1 - y0)) * h;
+    const { label, unit } = this.options;
+    const ink = getComputedStyle(this.element).color;
+
+    ctx.clearRect(0, 0, w, h);
+
+    // marked intervals, at least a pixel wide however far out
+    ctx.fillStyle = MARK_COLOR;
+
+    for (const { start, end } of this.group.marks) {
+      if (end >= x0 && start <= x1) {
+        const a = Math.max(0, px(start));
+        ctx.fillRect(a, 0, Math.max(1, Math.min(w, px(end)) - a), h);
+      }
+    }
+
+    ctx.font = `${11 * ratio}px sans-serif`;
+    ctx.lineWidth = 1;
+    ctx.strokeStyle = ctx.fillStyle = ink;
+
+    // grid
+    ctx.globalAlpha = 0.15;
+    ctx.beginPath();
+
+    const xStep = timeStep(x1 - x0, w / (90 * ratio));
+    const yStep = valueStep(y1 - y0, Math.max(2, h / (40 * ratio)));
+    const xTicks = ticks(x0, x1, xStep);
+    const yTicks = ticks(y0, y1, yStep);
+
+    for (const x of xTicks) {
+      ctx.moveTo(Math.round(px(x)) + 0.5, 0);
+      ctx.lineTo(Math.round(px(x)) + 0.5, h);
+    }
+
+    for (const y of yTicks) {
+      ctx.moveTo(0, Math.round(py(y)) + 0.5);
+      ctx.lineTo(w, Math.round(py(y)) + 0.5);
+    }
+
+    ctx.stroke();
+    ctx.globalAlpha = 0.7;
+    ctx.textBaseline = "bottom";
+
+    for (const y of yTicks) {
+      ctx.fillText(+y.toPrecision(6) + "", 4 * ratio, py(y) - 2 * ratio);
+    }
+
+    if (this.group.plots.at(-1) === this) {
+      for (const x of xTicks) {
+        ctx.fillText(this.group.formatTime(x, xStep), px(x) + 3 * ratio, h - 2 * ratio);
+      }
+    }
+
+    // title, and the value under the cursor
+    ctx.globalAlpha = 1;
+    ctx.textBaseline = "top";
+
+    let text = `${label} [${unit}]`;
+    const cursor = this.group.cursor;
+
+    if (cursor !== null && this.count > 0) {
+      const x = Math.round(px(cursor)) + 0.5;
+
+      ctx.beginPath();
+      ctx.moveTo(x, 0);
+      ctx.lineTo(x, h);
+      ctx.stroke();
+
+      const i = this.nearest(cursor);
+
+      if (i >= 0) {
+        const lo = +this.min[i].toPrecision(5);
+        const hi = +this.max[i].toPrecision(5);
+
+        text += `  ${lo === hi ? lo : `${lo} … ${hi}`}  @ ${this.group.formatTime(this.time[i], 0)}`;
+      }
+    }
+
+    ctx.textAlign = "right";
+    ctx.fillText(text, w - 6 * ratio, 4 * ratio);
+    ctx.textAlign = "left";
+  }
+
+  nearest(t) {
+    if (this.count === 0) {
+      return -1;
+    }
+
+    const i = lowerBound(this.time, this.count, t);
+
+    if (i === 0) return 0;
+    if (i === this.count) return i - 1;
+
+    return t - this.time[i - 1] < this.time[i] - t ? i - 1 : i;
+  }
+}
+
+/**
+ * Stacked panels, one channel each, zoomed, panned and read out together.
+ *
+ * panels: [{ channel, label, unit, color: [r, g, b] }], channel a key of
+ * the series objects decoded by series.js.
+ *
+ * onview(start, end, width) is called when the user moves the view; the
+ * owner fetches a series for it and hands it back with setEnvelope or
+ * setSamples.
+ */
+export class ChartGroup {
+  constructor(element, panels) {
+    this.element = element;
+    this.plots = panels.map((p) => {
+      const div = document.createElement("div");
+
+      div.className = "plot";
+      element.append(div);
+      return new Plot(this, div, p);
+    });
+
+    this.view = [0, 1];
+    this.extent = [0, 1];
+    this.origin = 0;
+    this.cursor = null;
+    this.marks = [];
+    this.live = 0; // seconds shown up to the newest live sample, 0 when not live
+    this.follow = 0; // live, and not moved away from the newest sample
+    this.frame = 0;
+    this.onview = null;
+    this.formatTime = (t) => t.toFixed(2);
+
+    this.listen();
+    new ResizeObserver(() => {
+      this.plots.forEach((p) => p.resize());
+      this.setView(...this.view);
+    }).observe(element);
+  }
+
+  get width() {
+    return this.element.clientWidth;
+  }
+
+  listen() {
+    const el = this.element;
+    let drag = null;
+
+    const timeAt = (e) => {
+      const r = el.getBoundingClientRect();
+      const [x0, x1] = this.view;
+
+      return x0 + ((e.clientX - r.left) / r.width) * (x1 - x0);
+    };
+
+    el.addEventListener("wheel", (e) => {
+      e.preventDefault();
+
+      const t = timeAt(e);
+      const k = Math.pow(ZOOM_STEP, e.deltaY);
+      const [x0, x1] = this.view;
+
+      this.follow = 0;
+      this.setView(t - (t - x0) * k, t + (x1 - t) * k);
+    }, { passive: false });
+
+    el.addEventListener("pointerdown", (e) => {
+      el.setPointerCapture(e.pointerId);
+      drag = { x: e.clientX, view: this.view };
+    });
+
+    el.addEventListener("pointermove", (e) => {
+      if (drag) {
+        const [x0, x1] = drag.view;
+        const dt = ((e.clientX - drag.x) / el.clientWidth) * (x1 - x0);
+
+        if (dt !== 0) {
+          this.follow = 0;
+          this.setView(x0 - dt, x1 - dt);
+        }
+      }
+
+      this.cursor = timeAt(e);
+      this.render();
+    });
+
+    el.addEventListener("pointerup", () => (drag = null));
+
+    el.addEventListener("pointerleave", () => {
+      this.cursor = null;
+      this.render();
+    });
+
+    el.addEventListener("dblclick", () => {
+      if (this.live) {
+        this.follow = this.live;
+        this.setView(this.extent[1] - this.live, this.extent[1], false);
+      } else {
+        this.setView(...this.extent);
+      }
+    });
+  }
+
+  /** Full range of the data, what a double click goes back to. */
+  setExtent(start, end) {
+    this.extent = [start, end];
+    this.setView(start, end);
+  }
+
+  setView(start, end, notify = true) {
+    if (!(end > start)) {
+      end = start + 1;
+    }
+
+    this.view = [start, end];
+    this.plots.forEach((p) => p.autoscale());
+    this.render();
+
+    if (notify && this.onview) {
+      this.onview(start, end, this.width);
+    }
+  }
+
+  /** Samples as decoded by decodeSamples. */
+  setSamples(series) {
+    this.origin = series.time[0] ?? 0;
+    this.plots.forEach((p) => p.set(series.time, series[p.options.channel], null, this.origin));
+    this.setView(...this.view, false);
+  }
+
+  /** Min/max points as decoded by decodeEnvelope. */
+  setEnvelope(series) {
+    this.origin = series.time[0] ?? 0;
+    this.plots.forEach((p) => {
+      const band = series[p.options.channel];
+      p.set(series.time, band.min, band.max, this.origin);
+    });
+    this.setView(...this.view, false);
+  }
+
+  /** Intervals to shade on every panel, as [{ start, end }] in data time. */
+  setMarks(marks) {
+    this.marks = marks;
+    this.render();
+  }
+
+  /** Empties the panels for appended samples, following the newest `span` seconds. */
+  startLive(span) {
+    this.live = this.follow = span;
+    this.origin = null;
+    this.plots.forEach((p) => p.reserve(LIVE_CAPACITY));
+  }
+
+  /** Keeps the live samples on screen as a still series. */
+  stopLive() {
+    this.live = this.follow = 0;
+  }
+
+  /** Live samples as decoded by decodeLive. */
+  append(series) {
+    const n = series.time.length;
+
+    if (n === 0) {
+      return;
+    }
+
+    this.origin ??= series.time[0];
+    this.plots.forEach((p) => p.append(series.time, series[p.options.channel], this.origin));
+
+    const plot = this.plots[0];
+    this.extent = [plot.time[0], plot.time[plot.count - 1]];
+
+    if (this.follow) {
+      const end = series.time[n - 1];
+      this.setView(end - this.follow, end, false);
+    } else {
+      this.render();
+    }
+  }
+
+  /** Asks for a frame; several changes before it cost one. */
+  render() {
+    if (!this.frame) {
+      this.frame = requestAnimationFrame(() => {
+        this.frame = 0;
+        this.plots.forEach((p) => p.draw());
+      });
+    }
+  }
+}
@@ -1,18 +1,319 @@
+import { ChartGroup } from "./chart.js";
+import { decodeEnvelope, decodeLive } from "./series.js";
+
 const { invoke } = window.__TAURI__.core;
+const { listen } = window.__TAURI__.event;
+
+const PANELS = [
+  { channel: "voltage", label: "HV voltage", unit: "V", color: [0.93, 0.55, 0.13] },
+  { channel: "current", label: "HV current", unit: "A", color: [0.2, 0.55, 0.95] },
+  { channel: "power", label: "HV power", unit: "W", color: [0.88, 0.22, 0.33] },
+];
+
+const LIVE_SPAN = 30; // seconds on screen while following the stream
+const FETCH_DELAY = 50; // ms the view has to rest before it is fetched again
+
+let chart;
+let statusEl;
+let log = null; // { path, info } of the open log
+let live = false;
+let connected = false;
+let fetchTimer = 0;
+let fetchId = 0;
+
+function status(text) {
+  statusEl.textContent = text;
+}
+
+// wall-clock seconds since 1970 as local time, to the tick step
+function clock(t, step) {
+  const d = new Date(t * 1000);
+  const hms = d.toLocaleTimeString([], { hour12: false });
+
+  if (step >= 1) {
+    return hms;
+  }
+
+  return `${hms}.${String(d.getMilliseconds()).padStart(3, "0")}`;
+}
+
+// seconds since device boot
+function uptime(t) {
+  return `${t.toFixed(2)} s`;
+}
+
+// the view plus half of it each side, so panning shows data before the refetch lands
+async function fetchEnvelope(start, end, width) {
+  const id = ++fetchId;
+  const span = end - start;
+
+  try {
+    const buffer = await invoke("log_envelope", {
+      path: log.path,
+      start: start - span / 2,
+      end: end + span / 2,
+      width: Math.round(width * 2),
+    });
+
+    // superseded by a later view, or the log was closed meanwhile
+    if (id === fetchId && log && !live) {
+      const series = decodeEnvelope(buffer);
+
+      chart.setEnvelope(series);
+      status(
+        `${log.path}: ${series.time.length} points, ` +
+          (series.summary_period ? `${series.summary_period} s summaries` : "samples"),
+      );
+    }
+  } catch (e) {
+    status(String(e));
+  }
+}
+
+function viewChanged(start, end, width) {
+  if (!log || live) {
+    return;
+  }
+
+  clearTimeout(fetchTimer);
+  fetchTimer = setTimeout(() => fetchEnvelope(start, end, width), FETCH_DELAY);
+}
+
+async function openLog(path) {
+  try {
+    await stopLive();
+
+    if (log) {
+      await invoke("close_log", { path: log.path });
+    }
+
+    const info = await invoke("open_log", { path });
+
+    log = { path, info };
+    chart.formatTime = clock;
+    chart.setMarks([]);
+    chart.setExtent(info.start, info.end);
+  } catch (e) {
+    log = null;
+    status(String(e));
+  }
+
+  document.querySelector("#export-button").disabled = !log;
+  document.querySelector("#analysis-button").disabled = !log;
+}
+
+// the visible time range, all channels, in the format the file name asks for
+async function exportView(dest) {
+  const button = document.querySelector("#export-button");
+  const [start, end] = chart.view;
+  const options = {
+    format: dest.endsWith(".parquet") ? "parquet" : "csv",
+    start,
+    end,
+    compress: dest.endsWith(".gz"),
+  };
+
+  button.disabled = true;
+
+  const unlisten = await listen("export-progress", ({ payload: p }) => {
+    status(`exporting ${((p.samples * 100) / Math.max(1, p.total)).toFixed(0)} %`);
+  });
+
+  try {
+    const done = await invoke("export_log", { path: log.path, dest, options });
+
+    status(`${dest}: ${done.samples} samples` + (done.bad_blocks ? `, ${done.bad_blocks} bad blocks left out` : ""));
+  } catch (e) {
+    status(String(e));
+  } finally {
+    unlisten();
+    button.disabled = !log;
+  }
+}
+
+function summary(a) {
+  const kw = (w) => (w / 1000).toFixed(1);
+  const sustained = a.violations.filter((v) => v.rule === "sustained").length;
+
+  return (
+    `${a.energy_kwh.toFixed(3)} kWh (${a.regen_kwh.toFixed(3)} regenerated), ${a.charge_ah.toFixed(2)} Ah, ` +
+    `peak ${kw(a.power.max)} kW, 500 ms average up to ${kw(a.average_max)} kW, ` +
+    `${sustained} sustained and ${a.violations.length - sustained} average violations`
+  );
+}
+
+// energy and power-limit violations over the visible range; the violations
+// found so far are marked on the chart while it runs
+async function analyzeView() {
+  const button = document.querySelector("#analysis-button");
+  const [start, end] = chart.view;
+  const path = log.path;
+
+  button.disabled = true;
 
-let greetInputEl;
-let greetMsgEl;
+  const unlisten = await listen("analysis-progress", ({ payload: p }) => {
+    if (log?.path === path) {
+      chart.setMarks(p.analysis.violations);
+      status(`analysing ${((p.samples * 100) / Math.max(1, p.total)).toFixed(0)} %: ${summary(p.analysis)}`);
+    }
+  });
+
+  try {
+    const a = await invoke("analyze_log", { path, start, end });
+
+    if (log?.path === path) {
+      chart.setMarks(a.violations);
+      status(summary(a) + (a.bad_blocks ? `, ${a.bad_blocks} bad blocks left out` : ""));
+    }
+  } catch (e) {
+    status(String(e));
+  } finally {
+    unlisten();
+    button.disabled = !log;
+  }
+}
+
+async function listPorts() {
+  try {
+    const ports = await invoke("list_devices");
+    const list = document.querySelector("#device-ports");
+
+    list.replaceChildren(
+      ...ports.map((p) => {
+        const o = document.createElement("option");
+        o.value = p;
+        return o;
+      }),
+    );
+
+    const input = document.querySelector("#device-port");
+    if (!input.value && ports.length) {
+      input.value = ports[0];
+    }
+  } catch (e) {
+    status(String(e));
+  }
+}
+
+async function toggleDevice() {
+  const button = document.querySelector("#device-connect");
+
+  try {
+    if (connected) {
+      await stopLive();
+      await invoke("disconnect_device");
+      connected = false;
+      status("disconnected");
+    } else {
+      const port = document.querySelector("#device-port").value;
+      const time = await invoke("connect_device", { port });
+
+      connected = true;
+      status(`${port}: clock set, was ${time.offset.toFixed(3)} s off`);
+    }
+  } catch (e) {
+    status(String(e));
+  }
+
+  button.textContent = connected ? "Disconnect" : "Connect";
+  document.querySelector("#live-toggle").disabled = !connected;
+}
+
+// one snapshot per display frame, never more than one in flight
+async function pollLive() {
+  let after = 0;
+
+  while (live) {
+    try {
+      const series = decodeLive(await invoke("live_snapshot", { after }));
+
+      after = series.next;
+      chart.append(series);
+    } catch (e) {
+      status(String(e));
+      await stopLive();
+      break;
+    }
+
+    await new Promise(requestAnimationFrame);
+  }
+}
+
+async function startLive() {
+  try {
+    await invoke("live_start");
+  } catch (e) {
+    status(String(e));
+    return;
+  }
 
-async function greet() {
-  // Learn more about Tauri commands at https://tauri.app/v1/guides/features/command
-  greetMsgEl.textContent = await invoke("greet", { name: greetInputEl.value });
+  // the chart shows one or the other; a log would refetch over the live view
+  if (log) {
+    invoke("close_log", { path: log.path });
+    log = null;
+    chart.setMarks([]);
+    document.querySelector("#export-button").disabled = true;
+    document.querySelector("#analysis-button").disabled = true;
+  }
+
+  live = true;
+  chart.formatTime = uptime;
+  chart.startLive(LIVE_SPAN);
+  document.querySelector("#live-toggle").classList.add("active");
+  status("live; scroll or drag to look back, double click to follow again");
+  pollLive();
+}
+
+async function stopLive() {
+  if (!live) {
+    return;
+  }
+
+  live = false;
+  chart.stopLive();
+  document.querySelector("#live-toggle").classList.remove("active");
+
+  try {
+    await invoke("live_stop");
+  } catch (e) {
+    status(String(e));
+  }
 }
 
 window.addEventListener("DOMContentLoaded", () => {
-  greetInputEl = document.querySelector("#greet-input");
-  greetMsgEl = document.querySelector("#greet-msg");
-  document.querySelector("#greet-form").addEventListener("submit", (e) => {
+  statusEl = document.querySelector("#status");
+  chart = new ChartGroup(document.querySelector("#chart"), PANELS);
+  chart.onview = viewChanged;
+
+  document.querySelector("#log-form").addEventListener("submit", (e) => {
     e.preventDefault();
-    greet();
+    openLog(document.querySelector("#log-path").value.trim());
+  });
+
+  document.querySelector("#export-form").addEventListener("submit", (e) => {
+    e.preventDefault();
+
+    const dest = document.querySelector("#export-path").value.trim();
+    if (log && dest) {
+      exportView(dest);
+    }
   });
+
+  document.querySelector("#analysis-form").addEventListener("submit", (e) => {
+    e.preventDefault();
+
+    if (log) {
+      analyzeView();
+    }
+  });
+
+  document.querySelector("#device-form").addEventListener("submit", (e) => {
+    e.preventDefault();
+    toggleDevice();
+  });
+
+  document.querySelector("#device-port").addEventListener("focus", listPorts);
+  document.querySelector("#live-toggle").addEventListener("click", () => (live ? stopLive() : startLive()));
+
+  listPorts();
 });
@@ -0,0 +1,102 @@
+// Decoders for the binary series the log commands return.
+// Mirrors src-tauri/src/ipc.rs; keep both in sync.
+//
+// The arrays are views on the received buffer, not copies.
+
+const SERIES_SAMPLES = 1;
+const SERIES_ENVELOPE = 2;
+const SERIES_LIVE = 3;
+const SERIES_COMPARISON = 4;
+
+const CHANNELS = ["voltage", "current", "power", "lv_voltage", "temperature"];
+
+function header(buffer, kind) {
+  const view = new DataView(buffer);
+
+  if (view.getUint32(0, true) !== kind) {
+    throw new Error(`unexpected series kind ${view.getUint32(0, true)}`);
+  }
+
+  return view;
+}
+
+function columns(buffer, series, n) {
+  let offset = 16;
+
+  series.time = new Float64Array(buffer, offset, n);
+  offset += n * 8;
+
+  for (const ch of CHANNELS) {
+    series[ch] = new Float32Array(buffer, offset, n);
+    offset += n * 4;
+  }
+
+  return series;
+}
+
+// { time, voltage, current, power, lv_voltage, temperature, bad_blocks }
+export function decodeSamples(buffer) {
+  const view = header(buffer, SERIES_SAMPLES);
+
+  return columns(buffer, { bad_blocks: view.getUint32(8, true) }, view.getUint32(4, true));
+}
+
+// { time, voltage, current, power, lv_voltage, temperature, next }
+// time is seconds since device boot; pass next to the following live_snapshot
+export function decodeLive(buffer) {
+  const view = header(buffer, SERIES_LIVE);
+
+  return columns(buffer, { next: Number(view.getBigUint64(8, true)) }, view.getUint32(4, true));
+}
+
+// { time, resolution, summary_period, voltage: { min, max }, ... }
+export function decodeEnvelope(buffer) {
+  const view = header(buffer, SERIES_ENVELOPE);
+  const n = view.getUint32(4, true);
+  let offset = 24;
+
+  const series = {
+    resolution: view.getFloat64(8, true),
+    summary_period: view.getUint16(16, true),
+  };
+
+  series.time = new Float64Array(buffer, offset, n);
+  offset += n * 8;
+
+  for (const ch of CHANNELS) {
+    const min = new Float32Array(buffer, offset, n);
+    const max = new Float32Array(buffer, offset + n * 4, n);
+
+    series[ch] = { min, max };
+    offset += n * 8;
+  }
+
+  return series;
+}
+
+// { from, step, reference, time, sessions: [{ voltage, current, power, energy, power_diff, energy_diff }] }
+// time is the aligned centre of each bin; energy is kWh since the first bin
+// the session covers, NaN outside the session like the means
+export function decodeComparison(buffer) {
+  const view = header(buffer, SERIES_COMPARISON);
+  const count = view.getUint32(4, true);
+  const n = view.getUint32(8, true);
+  const from = view.getFloat64(16, true);
+  const step = view.getFloat64(24, true);
+  const time = Float64Array.from({ length: n }, (_, i) => from + (i + 0.5) * step);
+  const sessions = [];
+  let offset = 32;
+
+  for (let k = 0; k < count; k++) {
+    const s = {};
+
+    for (const name of ["voltage", "current", "power", "energy", "power_diff", "energy_diff"]) {
+      s[name] = new Float32Array(buffer, offset, n);
+      offset += n * 4;
+    }
+
+    sessions.push(s);
+  }
+
+  return { from, step, reference: view.getUint32(12, true), time, sessions };
+}